@@ -0,0 +1,121 @@
+#include "MicrobenchMemory/MicrobenchMemory.hpp"
+
+#include <benchmark/benchmark.h>
+
+#include <atomic>
+#include <cstddef>
+#include <cstdlib>
+
+MICROBENCH_MEMORY_OVERLOAD_GLOBAL()
+
+
+// Every thread hammers the instrumented global operator new/delete.
+// With sharded counters, the time per iteration should stay flat as the thread count grows.
+void BM_global_new_delete(benchmark::State& state)
+{
+  for (auto _ : state)
+  {
+    auto* ptr = new char[64];
+    benchmark::DoNotOptimize(ptr);
+    delete[] ptr;
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_global_new_delete)->ThreadRange(1, 64)->UseRealTime();
+
+
+// Cost of the call-stack attribution: unwinding and interning the stack in the trie on every allocation
+void BM_global_new_delete_backtraces(benchmark::State& state)
+{
+  MicrobenchMemory::set_backtrace_mode(MicrobenchMemory::backtrace_mode::all);
+  for (auto _ : state)
+  {
+    auto* ptr = new char[64];
+    benchmark::DoNotOptimize(ptr);
+    delete[] ptr;
+  }
+  MicrobenchMemory::set_backtrace_mode(MicrobenchMemory::backtrace_mode::disabled);
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_global_new_delete_backtraces)->ThreadRange(1, 16)->UseRealTime();
+
+
+// Cost of the latency timing: two reads of the cycle counter and a histogram increment per operation
+void BM_global_new_delete_latency_timing(benchmark::State& state)
+{
+  MicrobenchMemory::enable_allocation_latency_timing(true);
+  for (auto _ : state)
+  {
+    auto* ptr = new char[64];
+    benchmark::DoNotOptimize(ptr);
+    delete[] ptr;
+  }
+  MicrobenchMemory::enable_allocation_latency_timing(false);
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_global_new_delete_latency_timing)->ThreadRange(1, 16)->UseRealTime();
+
+
+// Inside a memory region, every allocation is also recorded in the scope of the region
+void BM_global_new_delete_in_region(benchmark::State& state)
+{
+  MicrobenchMemory::memory_region region{"benchmark"};
+  for (auto _ : state)
+  {
+    auto* ptr = new char[64];
+    benchmark::DoNotOptimize(ptr);
+    delete[] ptr;
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_global_new_delete_in_region)->ThreadRange(1, 16)->UseRealTime();
+
+
+// Baseline: the same work accounted on a single shared atomic, which is what sharding avoids.
+static std::atomic<std::size_t> shared_allocation_count{0};
+static std::atomic<std::size_t> shared_deallocation_count{0};
+static std::atomic<std::size_t> shared_total_memory_allocated{0};
+
+void BM_single_atomic_malloc_free(benchmark::State& state)
+{
+  for (auto _ : state)
+  {
+    auto* ptr = std::malloc(64);
+    shared_allocation_count.fetch_add(1, std::memory_order_relaxed);
+    shared_total_memory_allocated.fetch_add(64, std::memory_order_relaxed);
+    benchmark::DoNotOptimize(ptr);
+    shared_deallocation_count.fetch_add(1, std::memory_order_relaxed);
+    std::free(ptr);
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_single_atomic_malloc_free)->ThreadRange(1, 64)->UseRealTime();
+
+
+// Reference: raw malloc/free without any accounting.
+void BM_raw_malloc_free(benchmark::State& state)
+{
+  for (auto _ : state)
+  {
+    auto* ptr = std::malloc(64);
+    benchmark::DoNotOptimize(ptr);
+    std::free(ptr);
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_raw_malloc_free)->ThreadRange(1, 64)->UseRealTime();
+
+
+// The snapshot walks all the shards: its cost is independent from the number of threads.
+void BM_global_snapshot(benchmark::State& state)
+{
+  for (auto _ : state)
+  {
+    auto infos = MicrobenchMemory::get_global_memory_information_snapshot();
+    benchmark::DoNotOptimize(infos);
+  }
+}
+BENCHMARK(BM_global_snapshot);
+
+
+BENCHMARK_MAIN();
@@ -0,0 +1,148 @@
+#include "MicrobenchMemory/MicrobenchMemory.hpp"
+
+#include "detail/system_allocator.hpp"
+
+#include <benchmark/benchmark.h>
+
+#include <cstddef>
+#include <cstdlib>
+#include <new>
+#include <string>
+#include <string_view>
+#include <vector>
+
+MICROBENCH_MEMORY_OVERLOAD_GLOBAL()
+
+/*
+cost of the instrumentation layer: the same new/delete pairs through the instrumented global operators, through the
+operators of an instrumented class and straight to the C library, over
+  - the sizes from 8 B to 1 MiB
+  - the default alignment and 64 bytes
+  - 1 to 16 threads
+  - 1K to 10M live objects allocated the same way, held during the measure
+the results are written as JSON to MicrobenchMemory_overhead.json next to the console output, unless --benchmark_out
+asks for another file; the calibrated overhead (see MicrobenchMemory::get_instrumentation_overhead) is in the context
+*/
+
+enum class allocation_path
+{
+  raw,
+  global,
+  scoped
+};
+
+static MicrobenchMemory::detail::scope_id overhead_scope()
+{
+  static const auto scope = MicrobenchMemory::detail::register_scope("overhead_scope");
+  return scope;
+}
+
+template <allocation_path Path>
+static void* allocate(std::size_t size, std::size_t alignment)
+{
+  if constexpr (Path == allocation_path::raw)
+    // aligned_alloc wants a multiple of the alignment
+    return alignment == 0 ? std::malloc(size) : MicrobenchMemory::detail::aligned_malloc(alignment, (size + alignment - 1) / alignment * alignment);
+  else if constexpr (Path == allocation_path::global)
+    return alignment == 0 ? ::operator new(size) : ::operator new(size, std::align_val_t{alignment});
+  else
+    return alignment == 0 ? MicrobenchMemory::detail::managed_new(overhead_scope(), size) : MicrobenchMemory::detail::managed_new(overhead_scope(), size, std::align_val_t{alignment});
+}
+
+template <allocation_path Path>
+static void deallocate(void* ptr, std::size_t alignment)
+{
+  if constexpr (Path == allocation_path::raw)
+    alignment == 0 ? std::free(ptr) : MicrobenchMemory::detail::aligned_free(ptr);
+  else if constexpr (Path == allocation_path::global)
+    alignment == 0 ? ::operator delete(ptr) : ::operator delete(ptr, std::align_val_t{alignment});
+  else
+    alignment == 0 ? MicrobenchMemory::detail::managed_delete(overhead_scope(), ptr) : MicrobenchMemory::detail::managed_delete(overhead_scope(), ptr, std::align_val_t{alignment});
+}
+
+
+// Size and alignment sweep: the overhead is the difference with the raw path of the same arguments
+template <allocation_path Path>
+void BM_new_delete(benchmark::State& state)
+{
+  auto size      = static_cast<std::size_t>(state.range(0));
+  auto alignment = static_cast<std::size_t>(state.range(1));
+  for (auto _ : state)
+  {
+    auto* ptr = allocate<Path>(size, alignment);
+    benchmark::DoNotOptimize(ptr);
+    deallocate<Path>(ptr, alignment);
+  }
+  state.SetItemsProcessed(state.iterations());
+  state.SetBytesProcessed(state.iterations() * state.range(0));
+}
+
+static void size_sweep(benchmark::internal::Benchmark* benchmark)
+{
+  benchmark->ArgsProduct({{8, 64, 512, 4 << 10, 32 << 10, 256 << 10, 1 << 20}, {0, 64}})->ArgNames({"size", "alignment"})->ThreadRange(1, 16)->UseRealTime();
+}
+
+BENCHMARK_TEMPLATE(BM_new_delete, allocation_path::raw)->Apply(size_sweep);
+BENCHMARK_TEMPLATE(BM_new_delete, allocation_path::global)->Apply(size_sweep);
+BENCHMARK_TEMPLATE(BM_new_delete, allocation_path::scoped)->Apply(size_sweep);
+
+
+// Live set: the scoped path keeps every live pointer in its registry, which grows with the live objects
+template <allocation_path Path>
+void BM_new_delete_live(benchmark::State& state)
+{
+  constexpr std::size_t object_size = 16;
+
+  std::vector<void*> live(static_cast<std::size_t>(state.range(0)));
+  for (auto*& ptr : live)
+    ptr = allocate<Path>(object_size, 0);
+
+  for (auto _ : state)
+  {
+    auto* ptr = allocate<Path>(object_size, 0);
+    benchmark::DoNotOptimize(ptr);
+    deallocate<Path>(ptr, 0);
+  }
+  state.SetItemsProcessed(state.iterations());
+
+  for (auto* ptr : live)
+    deallocate<Path>(ptr, 0);
+}
+
+static void live_sweep(benchmark::internal::Benchmark* benchmark)
+{
+  benchmark->RangeMultiplier(10)->Range(1'000, 10'000'000)->ArgName("live")->Unit(benchmark::kNanosecond);
+}
+
+BENCHMARK_TEMPLATE(BM_new_delete_live, allocation_path::raw)->Apply(live_sweep);
+BENCHMARK_TEMPLATE(BM_new_delete_live, allocation_path::global)->Apply(live_sweep);
+BENCHMARK_TEMPLATE(BM_new_delete_live, allocation_path::scoped)->Apply(live_sweep);
+
+
+int main(int argc, char** argv)
+{
+  std::vector<char*> arguments(argv, argv + argc);
+
+  std::string output = "--benchmark_out=MicrobenchMemory_overhead.json";
+  std::string format = "--benchmark_out_format=json";
+  bool        has_output = false;
+  for (auto* argument : arguments)
+    has_output = has_output || std::string_view{argument}.starts_with("--benchmark_out=");
+  if (!has_output)
+  {
+    arguments.push_back(output.data());
+    arguments.push_back(format.data());
+  }
+
+  auto overhead = MicrobenchMemory::get_instrumentation_overhead();
+  benchmark::AddCustomContext("instrumentation_overhead_global_ns", std::to_string(overhead.global_nanoseconds));
+  benchmark::AddCustomContext("instrumentation_overhead_scoped_ns", std::to_string(overhead.scoped_nanoseconds));
+
+  auto count = static_cast<int>(arguments.size());
+  arguments.push_back(nullptr);
+  benchmark::Initialize(&count, arguments.data());
+  if (benchmark::ReportUnrecognizedArguments(count, arguments.data()))
+    return 1;
+  benchmark::RunSpecifiedBenchmarks();
+  benchmark::Shutdown();
+}
@@ -0,0 +1,93 @@
+#include "detail/pointer_table.hpp"
+#include "detail/vanilla_allocator.hpp"
+
+#include <benchmark/benchmark.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <map>
+#include <memory>
+#include <utility>
+
+using MicrobenchMemory::detail::internal_ptr_infos;
+using MicrobenchMemory::detail::pointer_table;
+using MicrobenchMemory::detail::vanilla_allocator;
+
+// The registry that backed the scoped instrumentation before the pointer table
+using pointer_map_t = std::map<void*, internal_ptr_infos, std::less<void*>, vanilla_allocator<std::pair<void* const, internal_ptr_infos>>>;
+
+// Fake, 16-bytes aligned addresses: the registries never dereference them
+static void* fake_ptr(std::size_t i) { return reinterpret_cast<void*>(std::uintptr_t{0x10000} + i * 16); }
+
+
+// Steady state of a program with state.range(0) live pointers: each iteration registers a new pointer and retires the oldest one.
+void BM_pointer_map_alloc_free(benchmark::State& state)
+{
+  const auto    live = static_cast<std::size_t>(state.range(0));
+  pointer_map_t registry;
+  for (std::size_t i = 0; i < live; ++i)
+    registry.emplace(fake_ptr(i), internal_ptr_infos{16});
+
+  std::size_t next = live;
+  for (auto _ : state)
+  {
+    registry.emplace(fake_ptr(next), internal_ptr_infos{16});
+    auto it = registry.find(fake_ptr(next - live));
+    benchmark::DoNotOptimize(it->second);
+    registry.erase(it);
+    ++next;
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_pointer_map_alloc_free)->Arg(1'000)->Arg(1'000'000)->Arg(10'000'000);
+
+
+void BM_pointer_table_alloc_free(benchmark::State& state)
+{
+  const auto live     = static_cast<std::size_t>(state.range(0));
+  auto       registry = std::make_unique<pointer_table>();
+  for (std::size_t i = 0; i < live; ++i)
+    registry->insert(fake_ptr(i), internal_ptr_infos{16});
+
+  std::size_t next = live;
+  for (auto _ : state)
+  {
+    registry->insert(fake_ptr(next), internal_ptr_infos{16});
+    auto infos = registry->erase(fake_ptr(next - live));
+    benchmark::DoNotOptimize(infos);
+    ++next;
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_pointer_table_alloc_free)->Arg(1'000)->Arg(1'000'000)->Arg(10'000'000);
+
+
+// Concurrent churn on a shared table, each thread working on its own address range
+static pointer_table shared_table;
+
+void BM_pointer_table_alloc_free_concurrent(benchmark::State& state)
+{
+  constexpr std::size_t live_per_thread = 1'000;
+
+  const auto base = (static_cast<std::size_t>(state.thread_index()) + 1) << 32;
+  for (std::size_t i = 0; i < live_per_thread; ++i)
+    shared_table.insert(fake_ptr(base + i), internal_ptr_infos{16});
+
+  std::size_t next = live_per_thread;
+  for (auto _ : state)
+  {
+    shared_table.insert(fake_ptr(base + next), internal_ptr_infos{16});
+    auto infos = shared_table.erase(fake_ptr(base + next - live_per_thread));
+    benchmark::DoNotOptimize(infos);
+    ++next;
+  }
+  state.SetItemsProcessed(state.iterations());
+
+  for (auto i = next - live_per_thread; i < next; ++i)
+    shared_table.erase(fake_ptr(base + i));
+}
+BENCHMARK(BM_pointer_table_alloc_free_concurrent)->ThreadRange(1, 16)->UseRealTime();
+
+
+BENCHMARK_MAIN();
@@ -0,0 +1,118 @@
+#include "MicrobenchMemory/MicrobenchMemory.hpp"
+
+#include <benchmark/benchmark.h>
+
+#include <cstddef>
+#include <vector>
+
+struct named_scope
+{
+  char buff[64];
+  MICROBENCH_MEMORY_INSTRUMENT_CLASS("named_scope");
+};
+
+struct type_scope
+{
+  char buff[64];
+  MICROBENCH_MEMORY_INSTRUMENT_TYPE(type_scope);
+};
+
+struct pooled_scope
+{
+  char buff[64];
+  MICROBENCH_MEMORY_INSTRUMENT_POOLED_CLASS("pooled_scope");
+};
+
+
+// The scope name is interned on first use, the hot path only indexes the scope by its identifier
+void BM_named_scope_new_delete(benchmark::State& state)
+{
+  for (auto _ : state)
+  {
+    auto* ptr = new named_scope;
+    benchmark::DoNotOptimize(ptr);
+    delete ptr;
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_named_scope_new_delete)->ThreadRange(1, 16)->UseRealTime();
+
+
+// The identifier is registered during the static initialization, there is not even a guard to check
+void BM_type_scope_new_delete(benchmark::State& state)
+{
+  for (auto _ : state)
+  {
+    auto* ptr = new type_scope;
+    benchmark::DoNotOptimize(ptr);
+    delete ptr;
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_type_scope_new_delete)->ThreadRange(1, 16)->UseRealTime();
+
+
+// Same as BM_named_scope_new_delete, the objects coming from the thread cache of the pool instead of malloc
+void BM_pooled_scope_new_delete(benchmark::State& state)
+{
+  for (auto _ : state)
+  {
+    auto* ptr = new pooled_scope;
+    benchmark::DoNotOptimize(ptr);
+    delete ptr;
+  }
+  state.SetItemsProcessed(state.iterations());
+  if (state.thread_index() == 0)
+    state.counters["hit_rate"] = MicrobenchMemory::get_object_pool_statistics("pooled_scope").hit_rate();
+}
+BENCHMARK(BM_pooled_scope_new_delete)->ThreadRange(1, 16)->UseRealTime();
+
+
+// The snapshot reads the counters only, whatever the number of live pointers in the scope
+void BM_scope_snapshot(benchmark::State& state)
+{
+  std::vector<named_scope*> live(static_cast<std::size_t>(state.range(0)));
+  for (auto*& ptr : live)
+    ptr = new named_scope;
+
+  for (auto _ : state)
+  {
+    auto infos = MicrobenchMemory::get_memory_information_snapshot("named_scope");
+    benchmark::DoNotOptimize(infos);
+  }
+
+  for (auto* ptr : live)
+    delete ptr;
+}
+BENCHMARK(BM_scope_snapshot)->Arg(0)->Arg(1'000)->Arg(1'000'000);
+
+
+// Sampling: the unsampled allocations skip the registry and only pay for the sampler countdown
+void BM_sampled_scope_new_delete(benchmark::State& state)
+{
+  MicrobenchMemory::set_sampling_interval(static_cast<std::size_t>(state.range(0)));
+  for (auto _ : state)
+  {
+    auto* ptr = new type_scope;
+    benchmark::DoNotOptimize(ptr);
+    delete ptr;
+  }
+  MicrobenchMemory::set_sampling_interval(0);
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_sampled_scope_new_delete)->Arg(4 * 1024)->Arg(512 * 1024)->ThreadRange(1, 16)->UseRealTime();
+
+
+// Slow path: resolving a scope by its name, which is what every allocation used to pay for
+void BM_scope_name_lookup(benchmark::State& state)
+{
+  for (auto _ : state)
+  {
+    auto scope = MicrobenchMemory::detail::register_scope("named_scope");
+    benchmark::DoNotOptimize(scope);
+  }
+}
+BENCHMARK(BM_scope_name_lookup);
+
+
+BENCHMARK_MAIN();
@@ -0,0 +1,482 @@
+#include "MicrobenchMemory/MicrobenchMemory.hpp"
+#include "MicrobenchMemory/ext/trace_reader.hpp"
+#include "MicrobenchMemory/fixture/GoogleBenchmarkBridge/GoogleBenchmarkBridge.hpp"
+
+#include <benchmark/benchmark.h>
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <limits>
+#include <map>
+#include <memory>
+#include <new>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+#if defined(__linux__)
+#include <unistd.h>
+#endif
+
+/*
+replays recorded allocation traces (see start_allocation_trace) through several allocators
+
+usage: TraceReplay_benchmarks_Benchmarks [--trace=<trace file or directory>] [google benchmark flags]
+the trace can also be given with the MICROBENCH_MEMORY_REPLAY_TRACE environment variable, when there is none, the
+trace of a small built-in workload is recorded and replayed
+
+the events of all the threads are replayed in chronological order from a single thread
+*/
+
+MICROBENCH_MEMORY_OVERLOAD_GLOBAL()
+
+
+// A trace compiled into a sequence of operations on slots: the replay never looks a pointer up
+struct replay_op
+{
+  std::uint64_t size;
+  std::uint32_t slot;
+  std::uint16_t alignment;
+  bool          allocate;
+};
+
+struct replay_program
+{
+  std::vector<replay_op> ops;
+  std::size_t            slot_count      = 0;
+  std::size_t            peak_op         = 0; // operation after which the live heap is the highest
+  std::uint64_t          peak_live_bytes = 0;
+};
+
+static replay_program compile_program(const std::vector<MicrobenchMemory::trace_record>& records)
+{
+  replay_program                                   program;
+  std::unordered_map<std::uint64_t, std::uint32_t> live_slots;
+  std::vector<std::uint32_t>                       free_slots;
+  std::vector<std::uint64_t>                       slot_sizes;
+  std::uint64_t                                    live_bytes = 0;
+
+  auto release = [&](std::uint32_t slot, std::uint16_t alignment) {
+    program.ops.push_back({slot_sizes[slot], slot, alignment, false});
+    live_bytes -= slot_sizes[slot];
+    free_slots.push_back(slot);
+  };
+
+  for (const auto& record : records)
+  {
+    auto alignment = static_cast<std::uint16_t>(record.alignment == 0 ? 0 : 1u << record.alignment);
+    if (record.kind == MicrobenchMemory::trace_event_allocation)
+    {
+      std::uint32_t slot = 0;
+      if (free_slots.empty())
+      {
+        slot = static_cast<std::uint32_t>(program.slot_count++);
+        slot_sizes.push_back(0);
+      }
+      else
+      {
+        slot = free_slots.back();
+        free_slots.pop_back();
+      }
+      slot_sizes[slot]       = record.size;
+      live_slots[record.ptr] = slot;
+      program.ops.push_back({record.size, slot, alignment, true});
+
+      live_bytes += record.size;
+      if (live_bytes > program.peak_live_bytes)
+      {
+        program.peak_live_bytes = live_bytes;
+        program.peak_op         = program.ops.size() - 1;
+      }
+    }
+    else if (auto it = live_slots.find(record.ptr); it != live_slots.end())
+    {
+      // the allocations lost when a ring wrapped are not replayed, nor their deallocations
+      release(it->second, alignment);
+      live_slots.erase(it);
+    }
+  }
+
+  // every replay ends with an empty heap
+  for (auto [ptr, slot] : live_slots)
+    release(slot, 0);
+  return program;
+}
+
+
+/*
+the built-in workload, recorded when no trace is given: a long-lived index of strings, buffers with a sliding
+lifetime, and a few over-aligned blocks
+*/
+struct alignas(64) aligned_block
+{
+  char data[192];
+};
+
+[[gnu::noinline]] static void builtin_workload()
+{
+  std::map<int, std::string>                        index;
+  std::vector<std::unique_ptr<std::vector<double>>> buffers;
+  for (int round = 0; round < 4000; ++round)
+  {
+    index.emplace(round, std::string(static_cast<std::size_t>(16 + (round * 37) % 200), 'x'));
+    if (round % 3 == 0)
+      index.erase(round / 2);
+
+    buffers.push_back(std::make_unique<std::vector<double>>(static_cast<std::size_t>((round * 13) % 512 + 1)));
+    if (buffers.size() > 64)
+      buffers.erase(buffers.begin());
+
+    if (round % 10 == 0)
+    {
+      auto* block = new aligned_block{};
+      benchmark::DoNotOptimize(block);
+      delete block;
+    }
+  }
+}
+
+static std::vector<MicrobenchMemory::trace_thread> record_builtin_trace()
+{
+  auto directory = std::filesystem::temp_directory_path() / ("microbench_memory_replay_" + std::to_string(std::chrono::steady_clock::now().time_since_epoch().count()));
+  std::filesystem::create_directories(directory);
+
+  if (!MicrobenchMemory::start_allocation_trace(directory.string()))
+    throw std::runtime_error("Cannot record the built-in trace in " + directory.string());
+  builtin_workload();
+  MicrobenchMemory::stop_allocation_trace();
+
+  auto threads = MicrobenchMemory::read_trace_directory(directory);
+  std::filesystem::remove_all(directory);
+  return threads;
+}
+
+
+// Allocators under test
+struct malloc_backend
+{
+  void* allocate(std::size_t size, std::size_t alignment)
+  {
+    if (alignment <= alignof(std::max_align_t))
+      return std::malloc(size);
+    return std::aligned_alloc(alignment, (size + alignment - 1) & ~(alignment - 1));
+  }
+  void deallocate(void* ptr, std::size_t, std::size_t) { std::free(ptr); }
+};
+
+struct aligned_alloc_backend
+{
+  void* allocate(std::size_t size, std::size_t alignment)
+  {
+    alignment = std::max(alignment, alignof(std::max_align_t));
+    return std::aligned_alloc(alignment, std::max((size + alignment - 1) & ~(alignment - 1), alignment));
+  }
+  void deallocate(void* ptr, std::size_t, std::size_t) { std::free(ptr); }
+};
+
+// Size-class pool: 16-byte classes up to 1 KiB, power-of-two classes up to 64 KiB, malloc above
+class pool_backend
+{
+  static constexpr std::size_t small_class_count = 64;
+  static constexpr std::size_t class_count       = small_class_count + 6;
+  static constexpr std::size_t max_pooled_size   = 64 * 1024;
+  static constexpr std::size_t chunk_size        = 1024 * 1024;
+
+  struct free_block
+  {
+    free_block* next;
+  };
+
+public:
+  pool_backend() = default;
+
+  pool_backend(const pool_backend&)            = delete;
+  pool_backend& operator=(const pool_backend&) = delete;
+
+  ~pool_backend()
+  {
+    while (chunks_)
+    {
+      auto* next = chunks_->next;
+      std::free(chunks_);
+      chunks_ = next;
+    }
+  }
+
+  void* allocate(std::size_t size, std::size_t alignment)
+  {
+    if (size > max_pooled_size || alignment > alignof(std::max_align_t))
+      return malloc_backend{}.allocate(size, alignment);
+
+    auto size_class = class_of(size);
+    if (auto* block = free_lists_[size_class])
+    {
+      free_lists_[size_class] = block->next;
+      return block;
+    }
+    return carve(class_size(size_class));
+  }
+
+  void deallocate(void* ptr, std::size_t size, std::size_t alignment)
+  {
+    if (size > max_pooled_size || alignment > alignof(std::max_align_t))
+      return std::free(ptr);
+
+    auto  size_class        = class_of(size);
+    auto* block             = static_cast<free_block*>(ptr);
+    block->next             = free_lists_[size_class];
+    free_lists_[size_class] = block;
+  }
+
+private:
+  static std::size_t class_of(std::size_t size)
+  {
+    if (size <= small_class_count * 16)
+      return size == 0 ? 0 : (size - 1) / 16;
+    return small_class_count + static_cast<std::size_t>(64 - std::countl_zero(size - 1)) - 11;
+  }
+
+  static std::size_t class_size(std::size_t size_class) { return size_class < small_class_count ? (size_class + 1) * 16 : std::size_t{2048} << (size_class - small_class_count); }
+
+  void* carve(std::size_t size)
+  {
+    if (cursor_ + size > end_)
+    {
+      // the first bytes of a chunk link it to the previous one
+      auto* chunk = static_cast<free_block*>(std::malloc(chunk_size));
+      if (!chunk)
+        return nullptr;
+      chunk->next = chunks_;
+      chunks_     = chunk;
+      cursor_     = reinterpret_cast<std::byte*>(chunk) + alignof(std::max_align_t);
+      end_        = reinterpret_cast<std::byte*>(chunk) + chunk_size;
+    }
+    auto* block = cursor_;
+    cursor_ += size;
+    return block;
+  }
+
+  std::array<free_block*, class_count> free_lists_{};
+  free_block*                          chunks_ = nullptr;
+  std::byte*                           cursor_ = nullptr;
+  std::byte*                           end_    = nullptr;
+};
+
+// The instrumented path of the library, the one of MICROBENCH_MEMORY_OVERLOAD_GLOBAL, over one of its backing allocators
+template <std::size_t BackingAllocator>
+struct managed_backend
+{
+  managed_backend() { MicrobenchMemory::set_allocator_backend(BackingAllocator); }
+  ~managed_backend() { MicrobenchMemory::set_allocator_backend(MicrobenchMemory::malloc_allocator_backend); }
+
+  managed_backend(const managed_backend&)            = delete;
+  managed_backend& operator=(const managed_backend&) = delete;
+
+  void* allocate(std::size_t size, std::size_t alignment)
+  {
+    if (alignment == 0)
+      return MicrobenchMemory::detail::managed_new(size);
+    return MicrobenchMemory::detail::managed_new(size, std::align_val_t{alignment});
+  }
+  void deallocate(void* ptr, std::size_t, std::size_t) { MicrobenchMemory::detail::managed_delete(ptr); }
+};
+
+
+static replay_program& get_program()
+{
+  static replay_program program;
+  return program;
+}
+
+static std::vector<void*>& get_slots()
+{
+  static std::vector<void*> slots;
+  return slots;
+}
+
+// Resident set size, in bytes (linux only)
+static std::size_t current_rss()
+{
+#if defined(__linux__)
+  std::ifstream statm("/proc/self/statm");
+  std::size_t   size = 0, resident = 0;
+  statm >> size >> resident;
+  return resident * static_cast<std::size_t>(::sysconf(_SC_PAGESIZE));
+#else
+  return 0;
+#endif
+}
+
+// The memory is written to, one byte per page, as a program would do
+static void touch(void* ptr, std::size_t size)
+{
+  auto* bytes = static_cast<volatile char*>(ptr);
+  for (std::size_t offset = 0; offset < size; offset += 4096)
+    bytes[offset] = 0;
+}
+
+template <typename Backend, typename OnOp>
+static void replay(Backend& backend, const replay_program& program, void** slots, OnOp&& on_op)
+{
+  for (std::size_t i = 0; i < program.ops.size(); ++i)
+  {
+    const auto& op = program.ops[i];
+    if (op.allocate)
+    {
+      slots[op.slot] = backend.allocate(op.size, op.alignment);
+      touch(slots[op.slot], op.size);
+    }
+    else
+      backend.deallocate(slots[op.slot], op.size, op.alignment);
+    on_op(i);
+  }
+}
+
+// The RSS is sampled on an untimed replay, when the live heap is at its peak
+template <typename Backend>
+static void report_rss(benchmark::State& state, Backend& backend)
+{
+  const auto& program   = get_program();
+  auto        rss_start = current_rss();
+  std::size_t rss_peak  = rss_start;
+  replay(backend, program, get_slots().data(), [&](std::size_t i) {
+    if (i == program.peak_op)
+      rss_peak = current_rss();
+  });
+
+  state.counters["peak_rss"]   = benchmark::Counter(static_cast<double>(rss_peak), benchmark::Counter::kDefaults, benchmark::Counter::OneK::kIs1024);
+  state.counters["rss_growth"] = benchmark::Counter(static_cast<double>(rss_peak > rss_start ? rss_peak - rss_start : 0), benchmark::Counter::kDefaults, benchmark::Counter::OneK::kIs1024);
+  state.counters["peak_live"]  = benchmark::Counter(static_cast<double>(program.peak_live_bytes), benchmark::Counter::kDefaults, benchmark::Counter::OneK::kIs1024);
+}
+
+template <typename Backend>
+void BM_replay_throughput(benchmark::State& state)
+{
+  Backend     backend;
+  const auto& program = get_program();
+  auto*       slots   = get_slots().data();
+  for (auto _ : state)
+    replay(backend, program, slots, [](std::size_t) {});
+
+  state.SetItemsProcessed(state.iterations() * static_cast<std::int64_t>(program.ops.size()));
+  report_rss(state, backend);
+}
+
+/*
+every operation is timed on its own, the cost of reading the clock being measured beforehand and subtracted
+the latencies are binned like the allocation sizes: 4 bins per power of two
+*/
+template <typename Backend>
+void BM_replay_latency(benchmark::State& state)
+{
+  using clock     = std::chrono::steady_clock;
+  using histogram = MicrobenchMemory::allocation_size_histogram;
+
+  std::int64_t clock_overhead = std::numeric_limits<std::int64_t>::max();
+  for (int i = 0; i < 1000; ++i)
+  {
+    auto start     = clock::now();
+    clock_overhead = std::min(clock_overhead, (clock::now() - start).count());
+  }
+
+  Backend     backend;
+  histogram   latencies{};
+  const auto& program = get_program();
+  auto*       slots   = get_slots().data();
+  for (auto _ : state)
+  {
+    auto start = clock::now();
+    replay(backend, program, slots, [&](std::size_t) {
+      auto stop = clock::now();
+      auto ns   = std::max<std::int64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(stop - start).count() - clock_overhead, 0);
+      ++latencies.bins[histogram::bin_index(static_cast<std::size_t>(ns))];
+      start = clock::now();
+    });
+  }
+
+  auto percentile = [&](double q) {
+    auto          target = static_cast<std::uint64_t>(q * static_cast<double>(latencies.total_count()));
+    std::uint64_t seen   = 0;
+    for (std::size_t bin = 0; bin < histogram::bin_count; ++bin)
+      if ((seen += latencies.bins[bin]) > target)
+        return static_cast<double>(histogram::bin_upper_bound(bin));
+    return 0.;
+  };
+  state.counters["p50_ns"]  = percentile(0.5);
+  state.counters["p99_ns"]  = percentile(0.99);
+  state.counters["p999_ns"] = percentile(0.999);
+  state.SetItemsProcessed(state.iterations() * static_cast<std::int64_t>(program.ops.size()));
+}
+
+template <typename Backend>
+static void register_backend(const std::string& name)
+{
+  benchmark::RegisterBenchmark(("BM_replay_throughput/" + name).c_str(), BM_replay_throughput<Backend>)->Unit(benchmark::kMicrosecond);
+  benchmark::RegisterBenchmark(("BM_replay_latency/" + name).c_str(), BM_replay_latency<Backend>)->Unit(benchmark::kMicrosecond);
+}
+
+
+int main(int argc, char** argv)
+{
+  std::string trace_path;
+  if (const char* env = std::getenv("MICROBENCH_MEMORY_REPLAY_TRACE"))
+    trace_path = env;
+
+  // strip our own flag before handing the command line to google benchmark
+  int kept = 1;
+  for (int i = 1; i < argc; ++i)
+  {
+    std::string_view arg = argv[i];
+    if (arg.starts_with("--trace="))
+      trace_path = arg.substr(8);
+    else
+      argv[kept++] = argv[i];
+  }
+  argc = kept;
+
+  try
+  {
+    std::vector<MicrobenchMemory::trace_thread> threads;
+    if (trace_path.empty())
+      threads = record_builtin_trace();
+    else if (std::filesystem::is_directory(trace_path))
+      threads = MicrobenchMemory::read_trace_directory(trace_path);
+    else
+      threads.push_back(MicrobenchMemory::read_trace_file(trace_path));
+
+    get_program() = compile_program(MicrobenchMemory::merge_trace_records(threads));
+    get_slots().resize(get_program().slot_count);
+  }
+  catch (const std::exception& e)
+  {
+    std::cerr << e.what() << '\n';
+    return EXIT_FAILURE;
+  }
+  std::cerr << "replaying " << get_program().ops.size() << " operations, " << get_program().slot_count << " live allocations at most\n";
+
+  register_backend<malloc_backend>("malloc");
+  register_backend<aligned_alloc_backend>("aligned_alloc");
+  register_backend<pool_backend>("pool");
+  // the bump arena is left out: a replay never reclaims its memory
+  register_backend<managed_backend<MicrobenchMemory::malloc_allocator_backend>>("managed_new");
+  register_backend<managed_backend<MicrobenchMemory::pool_allocator_backend>>("managed_new_pool");
+
+  // the memory report of the bridge covers the managed_new backends, the other ones bypass the library
+  MicrobenchMemory::fixtures::GoogleBenchmarkBridge::MemoryManager memory_manager;
+  ::benchmark::RegisterMemoryManager(&memory_manager);
+  ::benchmark::Initialize(&argc, argv);
+  ::benchmark::RunSpecifiedBenchmarks();
+  ::benchmark::RegisterMemoryManager(nullptr);
+}
@@ -0,0 +1,82 @@
+#include "MicrobenchMemory/MicrobenchMemory.hpp"
+#include "MicrobenchMemory/tracking_policy.hpp"
+
+#include <benchmark/benchmark.h>
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <string>
+#include <utility>
+
+using MicrobenchMemory::tracking_features;
+
+template <tracking_features Features>
+struct policy_object
+{
+  char buff[64];
+  MICROBENCH_MEMORY_INSTRUMENT_CLASS_WITH_POLICY("policy_object", Features);
+};
+
+struct regular_object
+{
+  char buff[64];
+  MICROBENCH_MEMORY_INSTRUMENT_CLASS("regular_object");
+};
+
+
+// Per-allocation overhead of a policy: compare with BM_raw_malloc_free, the policy without any feature should match it
+template <typename T>
+void BM_new_delete(benchmark::State& state)
+{
+  for (auto _ : state)
+  {
+    auto* ptr = new T;
+    benchmark::DoNotOptimize(ptr);
+    delete ptr;
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+
+static std::string policy_name(std::uint32_t features)
+{
+  static constexpr const char* names[] = {"counts", "bytes", "live", "pointers", "histogram", "timing"};
+
+  std::string name = "BM_policy_new_delete/";
+  for (std::size_t i = 0; i < std::size(names); ++i)
+    if (features & (1u << i))
+      name += std::string{name.back() == '/' ? "" : "+"} + names[i];
+  return name.back() == '/' ? name + "none" : name;
+}
+
+// Every combination of the features, from none to all
+template <std::uint32_t... Features>
+static bool register_policy_benchmarks(std::integer_sequence<std::uint32_t, Features...>)
+{
+  (benchmark::RegisterBenchmark(policy_name(Features).c_str(), BM_new_delete<policy_object<static_cast<tracking_features>(Features)>>)->ThreadRange(1, 8)->UseRealTime(), ...);
+  return true;
+}
+
+[[maybe_unused]] static const bool policy_benchmarks_registered =
+    register_policy_benchmarks(std::make_integer_sequence<std::uint32_t, static_cast<std::uint32_t>(tracking_features::all) + 1>{});
+
+
+// The regular instrumentation, with its consistent snapshots, pointer table, estimates and histogram
+BENCHMARK_TEMPLATE(BM_new_delete, regular_object)->ThreadRange(1, 8)->UseRealTime();
+
+
+// Reference: raw malloc/free of the same size
+void BM_raw_malloc_free(benchmark::State& state)
+{
+  for (auto _ : state)
+  {
+    auto* ptr = std::malloc(sizeof(regular_object));
+    benchmark::DoNotOptimize(ptr);
+    std::free(ptr);
+  }
+  state.SetItemsProcessed(state.iterations());
+}
+BENCHMARK(BM_raw_malloc_free)->ThreadRange(1, 8)->UseRealTime();
+
+
+BENCHMARK_MAIN();
@@ -4,13 +4,52 @@ set(sources
 
 set(headers
     include/MicrobenchMemory/MicrobenchMemory.hpp
+    include/MicrobenchMemory/cycle_clock.hpp
+    include/MicrobenchMemory/ext/exporters.hpp
     include/MicrobenchMemory/ext/io.hpp
+    include/MicrobenchMemory/ext/trace_reader.hpp
+    include/MicrobenchMemory/memory_resource.hpp
+    include/MicrobenchMemory/trace_format.hpp
+    include/MicrobenchMemory/tracking_policy.hpp
+    src/detail/allocation_header.hpp
+    src/detail/bump_arena.hpp
+    src/detail/byte_sampler.hpp
+    src/detail/object_pool.hpp
+    src/detail/page_allocator.hpp
+    src/detail/pointer_table.hpp
+    src/detail/resident_memory.hpp
+    src/detail/size_class_pool.hpp
+    src/detail/snapshot_sequence.hpp
+    src/detail/spin_lock.hpp
+    src/detail/stack_trie.hpp
+    src/detail/system_allocator.hpp
+    src/detail/time_series.hpp
+    src/detail/trace_ring.hpp
+    src/detail/unwinder.hpp
+    src/detail/vanilla_allocator.hpp
 )
 
 set(test_sources
   src/MicrobenchMemory_tests.cpp
 )
 
+set(benchmark_sources
+  src/GlobalCounters_benchmarks.cpp
+  src/Overhead_benchmarks.cpp
+  src/PointerTable_benchmarks.cpp
+  src/ScopedCounters_benchmarks.cpp
+  src/TrackingPolicy_benchmarks.cpp
+)
+
+set(tool_sources
+  src/trace_replay.cpp
+)
+
+# the LD_PRELOAD shim, built as a shared library embedding the whole instrumentation (linux only)
+set(preload_sources
+  src/preload.cpp
+)
+
 
 if(${PROJECT_NAME}_ENABLE_GOOGLEBENCHMARK_FIXTURE)
   message("Appending GoogleBenchmarkBridge fixture sources")
@@ -24,6 +63,18 @@ if(${PROJECT_NAME}_ENABLE_GOOGLEBENCHMARK_FIXTURE)
   list(APPEND test_sources
     src/fixture/GoogleBenchmarkBridge/GoogleBenchmarkBridge_tests.cpp
   )
+
+  # the replay reports the memory usage through the bridge
+  list(APPEND benchmark_sources
+    src/TraceReplay_benchmarks.cpp
+  )
+endif()
+
+if(${PROJECT_NAME}_USE_GTEST)
+  # header only, the assertions of the allocation budgets
+  list(APPEND headers
+    include/MicrobenchMemory/fixture/GoogleTestAssertions/GoogleTestAssertions.hpp
+  )
 endif()
 
 set(exe_sources
@@ -11,6 +11,7 @@ option(${PROJECT_NAME}_USE_ALT_NAMES "Use alternative names for the project, suc
 #
 
 option(${PROJECT_NAME}_WARNINGS_AS_ERRORS "Treat compiler warnings as errors." OFF)
+option(${PROJECT_NAME}_ENABLE_FRAME_POINTERS "Compile the library and the targets linking to it with frame pointers, for the call-stack attribution." ON)
 
 #
 # Package managers
@@ -34,6 +35,19 @@ option(${PROJECT_NAME}_USE_CATCH2 "Use the Catch2 project for creating unit test
 
 option(${PROJECT_NAME}_ENABLE_GOOGLEBENCHMARK_FIXTURE "Compile Google Benchmark bridge fixture." ON)
 
+#
+# Benchmarks
+#
+# Uses Google Benchmark.
+
+option(${PROJECT_NAME}_ENABLE_BENCHMARKS "Build the benchmarks of the library itself (from the `benchmark` subfolder)." ON)
+
+#
+# Tools
+#
+
+option(${PROJECT_NAME}_ENABLE_TOOLS "Build the companion tools (from the `tools` subfolder), such as the allocation trace replay." ON)
+
 #
 # Static analyzers
 #
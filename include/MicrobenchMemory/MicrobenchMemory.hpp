@@ -1,42 +1,180 @@
 #pragma once
 
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <chrono>
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+#include <new>
 #include <string_view>
 
 namespace MicrobenchMemory
 {
+  // Distribution of the requested allocation sizes: sizes below 4 have their own bin, then each power of two is split in
+  // 4 bins of equal width
+  struct allocation_size_histogram
+  {
+    static constexpr std::size_t sub_bin_bits  = 2;
+    static constexpr std::size_t sub_bin_count = std::size_t{1} << sub_bin_bits;
+    static constexpr std::size_t bin_count     = sub_bin_count + (64 - sub_bin_bits) * sub_bin_count;
+
+    std::array<std::uint64_t, bin_count> bins;
+
+    static constexpr std::size_t bin_index(std::size_t size)
+    {
+      if (size < sub_bin_count)
+        return size;
+      std::size_t exponent = 63 - static_cast<std::size_t>(std::countl_zero(size));
+      std::size_t sub_bin  = (size >> (exponent - sub_bin_bits)) & (sub_bin_count - 1);
+      return sub_bin_count + (exponent - sub_bin_bits) * sub_bin_count + sub_bin;
+    }
+
+    // Smallest size falling in the bin
+    static constexpr std::size_t bin_lower_bound(std::size_t bin)
+    {
+      if (bin < sub_bin_count)
+        return bin;
+      std::size_t exponent = (bin - sub_bin_count) / sub_bin_count + sub_bin_bits;
+      std::size_t sub_bin  = (bin - sub_bin_count) % sub_bin_count;
+      return (sub_bin_count + sub_bin) << (exponent - sub_bin_bits);
+    }
+
+    // Largest size falling in the bin
+    static constexpr std::size_t bin_upper_bound(std::size_t bin) { return bin + 1 < bin_count ? bin_lower_bound(bin + 1) - 1 : static_cast<std::size_t>(-1); }
+
+    std::uint64_t total_count() const
+    {
+      std::uint64_t total = 0;
+      for (auto count : bins)
+        total += count;
+      return total;
+    }
+
+    // Plain element-wise loops over contiguous arrays, vectorized by the compiler
+    allocation_size_histogram& operator+=(const allocation_size_histogram& rhs)
+    {
+      for (std::size_t i = 0; i < bin_count; ++i)
+        bins[i] += rhs.bins[i];
+      return *this;
+    }
+
+    allocation_size_histogram& operator-=(const allocation_size_histogram& rhs)
+    {
+      for (std::size_t i = 0; i < bin_count; ++i)
+        bins[i] -= rhs.bins[i];
+      return *this;
+    }
+  };
+
+  inline allocation_size_histogram operator+(allocation_size_histogram lhs, const allocation_size_histogram& rhs) { return lhs += rhs; }
+  inline allocation_size_histogram operator-(allocation_size_histogram lhs, const allocation_size_histogram& rhs) { return lhs -= rhs; }
+
   struct global_memory_informations
   {
-    std::size_t allocation_count;
-    std::size_t deallocation_count;
-    std::size_t total_memory_allocated;
+    std::size_t               allocation_count;
+    std::size_t               deallocation_count;
+    std::size_t               total_memory_allocated;
+    std::size_t               total_memory_deallocated;
+    std::size_t               peak_memory_used;
+    allocation_size_histogram size_histogram;
 
-    bool has_memory_leak() const { return allocation_count != deallocation_count; }
+    bool        has_memory_leak() const { return allocation_count != deallocation_count; }
+    std::size_t current_memory_used() const { return total_memory_allocated - total_memory_deallocated; }
   };
 
+  // The peak is not additive: combining two snapshots keeps the highest peak
   inline global_memory_informations operator+(const global_memory_informations& lhs, const global_memory_informations& rhs)
   {
-    return {lhs.allocation_count + rhs.allocation_count, lhs.deallocation_count + rhs.deallocation_count, lhs.total_memory_allocated + rhs.total_memory_allocated};
+    return {lhs.allocation_count + rhs.allocation_count,
+            lhs.deallocation_count + rhs.deallocation_count,
+            lhs.total_memory_allocated + rhs.total_memory_allocated,
+            lhs.total_memory_deallocated + rhs.total_memory_deallocated,
+            std::max(lhs.peak_memory_used, rhs.peak_memory_used),
+            lhs.size_histogram + rhs.size_histogram};
   }
 
   inline global_memory_informations operator-(const global_memory_informations& lhs, const global_memory_informations& rhs)
   {
-    return {lhs.allocation_count - rhs.allocation_count, lhs.deallocation_count - rhs.deallocation_count, lhs.total_memory_allocated - rhs.total_memory_allocated};
+    return {lhs.allocation_count - rhs.allocation_count,
+            lhs.deallocation_count - rhs.deallocation_count,
+            lhs.total_memory_allocated - rhs.total_memory_allocated,
+            lhs.total_memory_deallocated - rhs.total_memory_deallocated,
+            std::max(lhs.peak_memory_used, rhs.peak_memory_used),
+            lhs.size_histogram - rhs.size_histogram};
   }
 
+  // Horvitz-Thompson estimate of a total, computed from the sampled allocations
+  struct memory_estimate
+  {
+    double value;
+    double variance;
+
+    // 95% confidence interval
+    double lower_bound() const { return std::max(value - 1.96 * std::sqrt(variance), 0.0); }
+    double upper_bound() const { return value + 1.96 * std::sqrt(variance); }
+  };
+
+  // The variance of a difference between two snapshots is the variance of what was sampled in between
+  inline memory_estimate operator+(const memory_estimate& lhs, const memory_estimate& rhs) { return {lhs.value + rhs.value, lhs.variance + rhs.variance}; }
+  inline memory_estimate operator-(const memory_estimate& lhs, const memory_estimate& rhs) { return {lhs.value - rhs.value, std::max(lhs.variance - rhs.variance, 0.0)}; }
+
+  // When sampling is disabled, the estimates are the exact counters with a null variance
+  struct sampled_memory_estimates
+  {
+    std::size_t     sampling_interval;
+    memory_estimate allocation_count;
+    memory_estimate deallocation_count;
+    memory_estimate total_memory_allocated;
+    memory_estimate total_memory_deallocated;
+
+    memory_estimate current_memory_used() const { return total_memory_allocated - total_memory_deallocated; }
+  };
+
+  inline sampled_memory_estimates operator+(const sampled_memory_estimates& lhs, const sampled_memory_estimates& rhs)
+  {
+    return {lhs.sampling_interval,
+            lhs.allocation_count + rhs.allocation_count,
+            lhs.deallocation_count + rhs.deallocation_count,
+            lhs.total_memory_allocated + rhs.total_memory_allocated,
+            lhs.total_memory_deallocated + rhs.total_memory_deallocated};
+  }
+
+  inline sampled_memory_estimates operator-(const sampled_memory_estimates& lhs, const sampled_memory_estimates& rhs)
+  {
+    return {lhs.sampling_interval,
+            lhs.allocation_count - rhs.allocation_count,
+            lhs.deallocation_count - rhs.deallocation_count,
+            lhs.total_memory_allocated - rhs.total_memory_allocated,
+            lhs.total_memory_deallocated - rhs.total_memory_deallocated};
+  }
+
+  /*
+  when sampling is enabled, the exact counters, the peak, the leaked pointers and the size histogram only cover the
+  sampled allocations, the estimates extrapolate them to all the allocations of the scope
+  */
   struct scoped_memory_informations
   {
-    std::size_t      allocation_count;
-    std::size_t      deallocation_count;
-    std::size_t      total_memory_allocated;
-    std::size_t      total_memory_deallocated;
-    std::size_t      nb_ptr_leaked;
-    std::string_view scope;
+    std::size_t               allocation_count;
+    std::size_t               deallocation_count;
+    std::size_t               total_memory_allocated;
+    std::size_t               total_memory_deallocated;
+    std::size_t               nb_ptr_leaked;
+    std::string_view          scope;
+    std::size_t               peak_memory_used;
+    allocation_size_histogram size_histogram;
+    sampled_memory_estimates  estimates;
 
     bool        has_memory_leak() const { return allocation_count != deallocation_count || total_memory_allocated != total_memory_deallocated; }
     std::size_t count_memory_leaked() const { return total_memory_allocated - total_memory_deallocated; }
     std::size_t count_ptr_leaked() const { return nb_ptr_leaked; }
+    std::size_t current_memory_used() const { return total_memory_allocated - total_memory_deallocated; }
 
-    operator global_memory_informations() const { return {allocation_count, deallocation_count, total_memory_allocated}; }
+    operator global_memory_informations() const
+    {
+      return {allocation_count, deallocation_count, total_memory_allocated, total_memory_deallocated, peak_memory_used, size_histogram};
+    }
   };
 
   inline scoped_memory_informations operator+(const scoped_memory_informations& lhs, const scoped_memory_informations& rhs)
@@ -47,7 +185,10 @@ namespace MicrobenchMemory
             lhs.total_memory_allocated + rhs.total_memory_allocated,
             lhs.total_memory_deallocated + rhs.total_memory_deallocated,
             lhs.nb_ptr_leaked + rhs.nb_ptr_leaked,
-            "(+op)"sv};
+            "(+op)"sv,
+            std::max(lhs.peak_memory_used, rhs.peak_memory_used),
+            lhs.size_histogram + rhs.size_histogram,
+            lhs.estimates + rhs.estimates};
   }
 
   inline scoped_memory_informations operator-(const scoped_memory_informations& lhs, const scoped_memory_informations& rhs)
@@ -58,12 +199,646 @@ namespace MicrobenchMemory
             lhs.total_memory_allocated - rhs.total_memory_allocated,
             lhs.total_memory_deallocated - rhs.total_memory_deallocated,
             lhs.nb_ptr_leaked - rhs.nb_ptr_leaked,
-            "(-op)"sv};
+            "(-op)"sv,
+            std::max(lhs.peak_memory_used, rhs.peak_memory_used),
+            lhs.size_histogram - rhs.size_histogram,
+            lhs.estimates - rhs.estimates};
   }
 
+  namespace detail
+  {
+    // Dense identifier of an instrumented scope, 0 is never handed out
+    using scope_id = std::uint32_t;
+
+    // Interns the scope name: the same name always gets back the same identifier
+    scope_id register_scope(std::string_view scope);
+
+    // Returns the region of the thread before entering the new one, to be given back to leave_memory_region
+    scope_id enter_memory_region(std::string_view name);
+    void     leave_memory_region(scope_id previous) noexcept;
+
+    // Name of the type as spelled by the compiler, computed at compile time
+    template <typename T>
+    constexpr std::string_view type_name()
+    {
+#if defined(_MSC_VER)
+      std::string_view name  = __FUNCSIG__;
+      auto             start = name.find("type_name<") + 10;
+      auto             end   = name.rfind(">(void)");
+#else
+      std::string_view name  = __PRETTY_FUNCTION__;
+      auto             start = name.find("T = ") + 4;
+      auto             end   = name.find_first_of(";]", start);
+#endif
+      return name.substr(start, end - start);
+    }
+
+    /*
+    scope keyed on a type, the scope name being the type name
+    the identifier is registered during the static initialization, the instrumented operators only read it
+    an allocation happening before that, from another static initializer, registers it on the spot
+    */
+    template <typename T>
+    struct type_scope
+    {
+      static constexpr std::string_view name = type_name<T>();
+
+      static scope_id id()
+      {
+        auto scope = registered_id;
+        return scope != 0 ? scope : register_scope(name);
+      }
+
+      static inline scope_id registered_id = register_scope(name);
+    };
+  } // namespace detail
+
+  /*
+  the snapshots never block the allocating threads: the counters of a snapshot are read consistently with each other,
+  the deallocations it counts never outnumber the allocations, and the counts always match the bytes
+  */
   global_memory_informations get_global_memory_information_snapshot();
   scoped_memory_informations get_memory_information_snapshot(std::string_view scope);
 
+  // Writes the snapshots of the instrumented scopes into the snapshots buffer, in registration order, without allocating.
+  // Returns the number of scopes, which can be larger than count: only the first count snapshots are written.
+  std::size_t snapshot_all_scopes(scoped_memory_informations* snapshots, std::size_t count);
+
+  // Snapshot of a structure instrumented with MICROBENCH_MEMORY_INSTRUMENT_TYPE
+  template <typename T>
+  scoped_memory_informations get_memory_information_snapshot()
+  {
+    return get_memory_information_snapshot(detail::type_scope<T>::name);
+  }
+
+  /*
+  enumeration of the pointers of a scope still live (its leaks, at the end of a program), streamed by batches without
+  allocating: each call writes up to count pointers and moves the cursor, which starts at 0, past them; the enumeration
+  is over when a call returns 0
+  the pointers allocated or freed during the enumeration may or may not be listed; with sampling, only the sampled
+  pointers are
+  */
+  struct leaked_pointer
+  {
+    void*       ptr;
+    std::size_t size;
+  };
+
+  std::size_t get_leaked_pointers(std::string_view scope, leaked_pointer* pointers, std::size_t count, std::size_t& cursor);
+
+  template <typename F>
+  void for_each_leaked_pointer(std::string_view scope, F&& f)
+  {
+    std::array<leaked_pointer, 64> batch;
+    std::size_t                    cursor = 0;
+    while (auto count = get_leaked_pointers(scope, batch.data(), batch.size(), cursor))
+      for (std::size_t i = 0; i < count; ++i)
+        f(batch[i]);
+  }
+
+  // Restart the peak tracking from the current memory usage, so that a region of the program can measure its own peak
+  void reset_global_peak_memory();
+  void reset_peak_memory(std::string_view scope);
+
+  template <typename T>
+  void reset_peak_memory()
+  {
+    reset_peak_memory(detail::type_scope<T>::name);
+  }
+
+  // The size histograms are filled only when enabled (disabled by default)
+  void enable_allocation_size_histogram(bool enabled);
+
+  /*
+  sampling of the instrumented structures: on average one allocation is recorded every `bytes` bytes allocated, an
+  allocation of size s being recorded with probability 1 - exp(-s / bytes)
+  0 records every allocation (default), the global counters are always exact
+  */
+  void        set_sampling_interval(std::size_t bytes);
+  std::size_t get_sampling_interval();
+
+  // Distribution of latencies: each power of two of clock ticks is split in 8 bins, the percentiles are within 12.5%
+  struct latency_histogram
+  {
+    static constexpr std::size_t sub_bin_bits  = 3;
+    static constexpr std::size_t sub_bin_count = std::size_t{1} << sub_bin_bits;
+    static constexpr std::size_t max_exponent  = 40;
+    static constexpr std::size_t bin_count     = sub_bin_count + (max_exponent - sub_bin_bits) * sub_bin_count;
+
+    std::array<std::uint64_t, bin_count> bins;
+    double                               nanoseconds_per_tick;
+
+    // The last bin also holds all the latencies above 2^40 ticks
+    static constexpr std::size_t bin_index(std::uint64_t ticks)
+    {
+      if (ticks < sub_bin_count)
+      {
+        std::size_t bin = ticks;
+        return bin;
+      }
+      std::size_t exponent = 63 - static_cast<std::size_t>(std::countl_zero(ticks));
+      if (exponent >= max_exponent)
+        return bin_count - 1;
+      std::size_t sub_bin = (ticks >> (exponent - sub_bin_bits)) & (sub_bin_count - 1);
+      return sub_bin_count + (exponent - sub_bin_bits) * sub_bin_count + sub_bin;
+    }
+
+    // Smallest tick count falling in the bin
+    static constexpr std::uint64_t bin_lower_bound(std::size_t bin)
+    {
+      if (bin < sub_bin_count)
+        return bin;
+      std::size_t exponent = (bin - sub_bin_count) / sub_bin_count + sub_bin_bits;
+      std::size_t sub_bin  = (bin - sub_bin_count) % sub_bin_count;
+      return std::uint64_t{sub_bin_count + sub_bin} << (exponent - sub_bin_bits);
+    }
+
+    std::uint64_t total_count() const
+    {
+      std::uint64_t total = 0;
+      for (auto count : bins)
+        total += count;
+      return total;
+    }
+
+    // The q-quantile (0.99 for the p99) in nanoseconds, taken in the middle of its bin; 0 when empty
+    double percentile(double q) const
+    {
+      auto          rank = static_cast<std::uint64_t>(q * static_cast<double>(total_count()));
+      std::uint64_t seen = 0;
+      for (std::size_t bin = 0; bin < bin_count; ++bin)
+        if ((seen += bins[bin]) > rank)
+        {
+          auto lower = static_cast<double>(bin_lower_bound(bin));
+          auto upper = bin + 1 < bin_count ? static_cast<double>(bin_lower_bound(bin + 1)) : lower;
+          return (lower + upper) / 2 * nanoseconds_per_tick;
+        }
+      return 0.;
+    }
+
+    latency_histogram& operator+=(const latency_histogram& rhs)
+    {
+      for (std::size_t i = 0; i < bin_count; ++i)
+        bins[i] += rhs.bins[i];
+      return *this;
+    }
+
+    latency_histogram& operator-=(const latency_histogram& rhs)
+    {
+      for (std::size_t i = 0; i < bin_count; ++i)
+        bins[i] -= rhs.bins[i];
+      return *this;
+    }
+  };
+
+  inline latency_histogram operator+(latency_histogram lhs, const latency_histogram& rhs) { return lhs += rhs; }
+  inline latency_histogram operator-(latency_histogram lhs, const latency_histogram& rhs) { return lhs -= rhs; }
+
+  /*
+  latency of the backing allocator: when enabled, every allocation and deallocation of the instrumented operators is
+  timed with the cycle counter (rdtsc on x86, the steady clock elsewhere), calibrated against the steady clock when the
+  timing is first enabled
+  the latencies are recorded per size class of the requested size: up to 64 bytes, then up to 4 times the bound of the
+  previous class, the last class holding everything above 256 KiB
+  */
+  inline constexpr std::size_t latency_size_class_count = 8;
+
+  constexpr std::size_t latency_size_class(std::size_t size)
+  {
+    std::size_t size_class = 0;
+    for (std::size_t bound = 64; size > bound && size_class + 1 < latency_size_class_count; bound *= 4)
+      ++size_class;
+    return size_class;
+  }
+
+  // Largest size of the class
+  constexpr std::size_t latency_size_class_upper_bound(std::size_t size_class)
+  {
+    return size_class + 1 < latency_size_class_count ? std::size_t{64} << (2 * size_class) : static_cast<std::size_t>(-1);
+  }
+
+  struct allocation_latencies
+  {
+    std::array<latency_histogram, latency_size_class_count> allocations;
+    std::array<latency_histogram, latency_size_class_count> deallocations;
+
+    // All the size classes together
+    latency_histogram all_allocations() const { return merge(allocations); }
+    latency_histogram all_deallocations() const { return merge(deallocations); }
+
+  private:
+    static latency_histogram merge(const std::array<latency_histogram, latency_size_class_count>& histograms)
+    {
+      auto merged = histograms[0];
+      for (std::size_t i = 1; i < latency_size_class_count; ++i)
+        merged += histograms[i];
+      return merged;
+    }
+  };
+
+  inline allocation_latencies operator-(const allocation_latencies& lhs, const allocation_latencies& rhs)
+  {
+    auto diff = lhs;
+    for (std::size_t i = 0; i < latency_size_class_count; ++i)
+    {
+      diff.allocations[i] -= rhs.allocations[i];
+      diff.deallocations[i] -= rhs.deallocations[i];
+    }
+    return diff;
+  }
+
+  // Disabled by default, the instrumented operators then only pay for a relaxed load
+  void                 enable_allocation_latency_timing(bool enabled);
+  bool                 is_allocation_latency_timing_enabled();
+  allocation_latencies get_allocation_latencies();
+
+  /*
+  cost of the instrumentation itself: the time a new/delete pair of 64 bytes spends in the instrumented operators on
+  top of the backing allocator, global and scoped, with the settings of the time of the calibration (sampling, timing,
+  profiling...)
+  the calibration times a few rounds of pairs made by the calling thread outside of any memory region, and keeps the
+  fastest round; its allocations are only counted by the microbench_memory_calibration scope, the global counters, the
+  latencies, the budgets, the sites and the trace don't see them
+  */
+  struct instrumentation_overhead
+  {
+    double global_nanoseconds; // per pair of the global operators
+    double scoped_nanoseconds; // per pair of the operators of an instrumented class
+  };
+
+  // Measured on the first call, the later calls return the same values until the next calibration
+  instrumentation_overhead get_instrumentation_overhead();
+  instrumentation_overhead calibrate_instrumentation_overhead();
+
+  /*
+  allocation lifetimes: when enabled, the registry of a scope keeps when and by which thread its pointers are allocated,
+  and their deallocation records how long they lived, in time and in allocations made in between by their thread
+  the deallocations are classified by the order the pointers are freed in:
+    - lifo: freed by their thread once it is back to the live pointers it had when allocating them, the lifetimes nest
+      like stack frames: the memory could come from a stack buffer
+    - same_thread: freed by their thread in another order: the memory could come from a monotonic arena or from a pool
+      released at the end of the request
+    - cross_thread: freed by another thread
+  only the pointers allocated while enabled and recorded by the sampling are profiled, the allocations in between and
+  the live pointers of a thread are the profiled ones of all the scopes
+  */
+  struct allocation_lifetimes
+  {
+    latency_histogram durations;   // in clock ticks, the percentiles are in nanoseconds
+    latency_histogram allocations; // allocations in between, for the pointers freed by their thread; the percentiles are counts
+    std::size_t       lifo_count;
+    std::size_t       same_thread_count;
+    std::size_t       cross_thread_count;
+
+    std::size_t deallocation_count() const { return lifo_count + same_thread_count + cross_thread_count; }
+
+    // Share of the profiled deallocations that are lifo, between 0 and 1
+    double lifo_share() const { return deallocation_count() == 0 ? 0. : static_cast<double>(lifo_count) / static_cast<double>(deallocation_count()); }
+  };
+
+  // Disabled by default, the instrumented operators then only pay for a relaxed load
+  void                 enable_allocation_lifetime_profiling(bool enabled);
+  bool                 is_allocation_lifetime_profiling_enabled();
+  allocation_lifetimes get_allocation_lifetimes(std::string_view scope);
+
+  template <typename T>
+  allocation_lifetimes get_allocation_lifetimes()
+  {
+    return get_allocation_lifetimes(detail::type_scope<T>::name);
+  }
+
+  /*
+  allocation slack: when enabled, the usable size of every block of the instrumented operators is asked to its backing
+  allocator, and the bytes it holds beyond the requested size are aggregated per size class (the classes of the latency
+  histograms) and per scope; the header of the instrumentation is left out
+  the padding is the part of the slack due to the alignment, in front of an over-aligned pointer and at the end of its
+  block, the rest being the rounding of the allocator; the blocks of the object pools are not measured
+  */
+  struct allocation_slack
+  {
+    std::size_t allocation_count;     // allocations measured
+    std::size_t requested_bytes;      // bytes they asked for
+    std::size_t usable_bytes;         // bytes the backing allocator gave them
+    std::size_t padding_bytes;        // alignment padding among the usable bytes
+    std::size_t live_requested_bytes; // same, for the measured allocations not freed yet
+    std::size_t live_usable_bytes;
+
+    std::size_t slack_bytes() const { return usable_bytes - requested_bytes; }
+    std::size_t live_slack_bytes() const { return live_usable_bytes - live_requested_bytes; }
+
+    // Share of the live usable bytes that is never asked for, between 0 and 1
+    double internal_fragmentation() const { return live_usable_bytes == 0 ? 0. : static_cast<double>(live_slack_bytes()) / static_cast<double>(live_usable_bytes); }
+
+    allocation_slack& operator+=(const allocation_slack& rhs)
+    {
+      allocation_count += rhs.allocation_count;
+      requested_bytes += rhs.requested_bytes;
+      usable_bytes += rhs.usable_bytes;
+      padding_bytes += rhs.padding_bytes;
+      live_requested_bytes += rhs.live_requested_bytes;
+      live_usable_bytes += rhs.live_usable_bytes;
+      return *this;
+    }
+  };
+
+  /*
+  the slack correlated with the memory the process holds: its resident memory (linux only), and the heap of the C
+  library allocator (glibc only, from mallinfo2, which locks the arenas while it walks them)
+  */
+  struct heap_overhead
+  {
+    std::array<allocation_slack, latency_size_class_count> size_classes;
+    std::uint64_t                                          live_memory;      // requested and not freed yet, from the global counters
+    std::uint64_t                                          resident_memory;  // 0 if unknown
+    std::uint64_t                                          system_heap_size; // obtained from the OS by the C library allocator, 0 if unknown
+    std::uint64_t                                          system_heap_used; // handed out by it, header and slack included
+
+    allocation_slack all_size_classes() const
+    {
+      auto all = size_classes[0];
+      for (std::size_t i = 1; i < latency_size_class_count; ++i)
+        all += size_classes[i];
+      return all;
+    }
+
+    double internal_fragmentation() const { return all_size_classes().internal_fragmentation(); }
+
+    // Share of the heap of the C library allocator sitting in its free lists
+    double external_fragmentation() const
+    {
+      return system_heap_size == 0 ? 0. : static_cast<double>(system_heap_size - system_heap_used) / static_cast<double>(system_heap_size);
+    }
+
+    // Resident bytes per live requested byte
+    double overhead_ratio() const { return live_memory == 0 ? 0. : static_cast<double>(resident_memory) / static_cast<double>(live_memory); }
+  };
+
+  // Disabled by default, the instrumented operators then only pay for a relaxed load
+  void             enable_allocation_slack_tracking(bool enabled);
+  bool             is_allocation_slack_tracking_enabled();
+  heap_overhead    get_heap_overhead();
+  allocation_slack get_allocation_slack(std::string_view scope);
+
+  /*
+  allocation trace: while running, every allocation and deallocation is appended to a ring of trace_record kept by its
+  thread, in a memory-mapped file of the directory: <directory>/microbench_memory.<pid>.<thread index>.trace
+  each thread keeps the last records_per_thread events (32 bytes each), the format is described in trace_format.hpp
+  and the files can be read with ext/trace_reader.hpp
+
+  returns false if the directory is not writable (or on Windows, which is not supported)
+  */
+  bool start_allocation_trace(std::string_view directory, std::size_t records_per_thread = std::size_t{1} << 20);
+  void stop_allocation_trace();
+
+  /*
+  memory sampler: a background thread polls the counters every interval and appends a sample to a columnar time series,
+  preallocated for capacity samples when the sampler starts; the sampling stops when the series is full
+  each sample holds the resident memory of the process (linux only, 0 elsewhere), the global counters, and the live
+  memory of the scopes given to the sampler, registered as needed
+  the sampler never allocates through the instrumented operators
+
+  returns false if the sampler is already running, if the series can't be allocated, or on Windows, which is not supported
+  */
+  inline constexpr std::size_t max_sampled_scope_count = 16;
+
+  bool start_memory_sampler(std::chrono::nanoseconds interval, std::size_t capacity, const std::string_view* scopes = nullptr, std::size_t scope_count = 0);
+  void stop_memory_sampler();
+
+  // The columns of the series hold sample_count values each
+  struct memory_time_series
+  {
+    std::size_t          sample_count;
+    std::size_t          scope_count;
+    const std::uint64_t* timestamp;              // nanoseconds since the start of the sampler
+    const std::uint64_t* resident_memory;        // bytes
+    const std::uint64_t* live_memory;            // bytes allocated by the instrumented operators and not freed yet
+    const std::uint64_t* allocation_count;       // the counters are cumulative, the rates are the differences between samples
+    const std::uint64_t* deallocation_count;
+    const std::uint64_t* total_memory_allocated;
+    std::array<const std::uint64_t*, max_sampled_scope_count> scope_live_memory; // in the order of the scopes given to the sampler
+  };
+
+  // Series of the last sampler started, valid until the next one starts. It can be read while the sampler runs.
+  memory_time_series get_memory_time_series();
+
+  /*
+  binary layout, in the byte order of the machine:
+  - the magic "MBMSERIE", then the format version (1) and the number of columns, on 32 bits, and the number of samples, on 64 bits
+  - the name of each column: its length on 32 bits followed by its characters, without terminating null
+  - the values of each column on 64 bits, one column after the other
+  the columns are the ones of memory_time_series, in order, the scopes being named after themselves
+  */
+  enum class time_series_format
+  {
+    csv, // one line of column names, then one line per sample
+    binary
+  };
+
+  // Returns false if the file can't be written
+  bool write_memory_time_series(std::string_view path, time_series_format format);
+
+  /*
+  call-stack attribution: the call stack of the allocations can be captured with a frame-pointer unwinder (linux only)
+  the code has to be compiled with frame pointers, which is the case of the targets linking to the library when the
+  project option MicrobenchMemory_ENABLE_FRAME_POINTERS is on (default)
+  */
+  enum class backtrace_mode
+  {
+    disabled, // default
+    sampled,  // the allocations selected by the sampler, see set_sampling_interval
+    all
+  };
+
+  void set_backtrace_mode(backtrace_mode mode);
+
+  inline constexpr std::size_t max_allocation_site_depth = 32;
+
+  // The totals are estimated when the sites are sampled
+  struct allocation_site
+  {
+    std::size_t                                  allocation_count;
+    std::size_t                                  total_memory_allocated;
+    std::size_t                                  depth;
+    std::array<void*, max_allocation_site_depth> frames; // return addresses, innermost first, starting inside the library
+  };
+
+  enum class allocation_site_order
+  {
+    by_bytes,
+    by_count
+  };
+
+  // Writes the top allocation sites into the sites buffer, in decreasing order, and returns their number
+  std::size_t get_top_allocation_sites(allocation_site* sites, std::size_t count, allocation_site_order order);
+
+  /*
+  memory regions: while a memory_region lives, the global allocations of its thread are also accounted in the scope of
+  the region, named after its path: '/' followed by the name of the region, appended to the path of the enclosing region
+  of the thread if any, e.g. "/request/parse"
+  a deallocation is accounted in the region of its allocation, wherever it happens
+
+  entering a region interns its path under the lock of the scope registry: regions are meant for coarse-grained stages
+  like request handlers or pipeline stages; outside of any region, the global operators only pay for a thread-local load
+  */
+  class memory_region
+  {
+  public:
+    explicit memory_region(std::string_view name) : previous_{detail::enter_memory_region(name)} {}
+    ~memory_region() { detail::leave_memory_region(previous_); }
+
+    memory_region(const memory_region&)            = delete;
+    memory_region& operator=(const memory_region&) = delete;
+
+  private:
+    detail::scope_id previous_;
+  };
+
+  /*
+  allocation budgets: while an allocation_budget lives, the allocations of its thread through the instrumented operators,
+  global and scoped, are charged to it and to the budgets of the thread it is nested in; the allocation going over the
+  count or the bytes of a budget, and every allocation after it, is a violation, handled on the spot:
+    - record: the violation is counted, the first max_recorded_violations ones are kept with their size and scope
+    - trap: the violation is written to the standard error and the process aborts, within the offending call
+  the deallocations are not charged: a budget bounds what is allocated, not what is live
+  the budgets of a thread must be destroyed in the reverse order of their construction, like the memory regions
+  */
+  inline constexpr std::size_t unlimited_budget = static_cast<std::size_t>(-1);
+
+  enum class budget_action
+  {
+    record,
+    trap
+  };
+
+  struct allocation_violation
+  {
+    std::size_t      size;             // requested
+    std::string_view scope;            // instrumented class or memory region, empty for a global allocation outside of any region
+    std::size_t      allocation_index; // among the allocations charged to the budget, from 0
+  };
+
+  class allocation_budget;
+
+  namespace detail
+  {
+    // Returns the budget of the thread before entering the new one, to be given back to leave_allocation_budget
+    allocation_budget* enter_allocation_budget(allocation_budget* budget) noexcept;
+    void               leave_allocation_budget(allocation_budget* previous) noexcept;
+    void               charge_allocation_budgets(scope_id scope, std::size_t sz) noexcept;
+  } // namespace detail
+
+  class allocation_budget
+  {
+  public:
+    static constexpr std::size_t max_recorded_violations = 16;
+
+    explicit allocation_budget(std::size_t max_allocations, std::size_t max_bytes = unlimited_budget, budget_action action = budget_action::record)
+        : max_allocations_{max_allocations}
+        , max_bytes_{max_bytes}
+        , action_{action}
+        , previous_{detail::enter_allocation_budget(this)}
+    {
+    }
+
+    ~allocation_budget() { detail::leave_allocation_budget(previous_); }
+
+    allocation_budget(const allocation_budget&)            = delete;
+    allocation_budget& operator=(const allocation_budget&) = delete;
+
+    std::size_t max_allocations() const { return max_allocations_; }
+    std::size_t max_bytes() const { return max_bytes_; }
+    std::size_t allocation_count() const { return allocation_count_; }
+    std::size_t allocated_bytes() const { return allocated_bytes_; }
+    std::size_t violation_count() const { return violation_count_; }
+    bool        violated() const { return violation_count_ != 0; }
+
+    // The first violations, recorded_violation_count() of them
+    const allocation_violation* violations() const { return violations_.data(); }
+    std::size_t                 recorded_violation_count() const { return std::min(violation_count_, max_recorded_violations); }
+
+  private:
+    friend void detail::charge_allocation_budgets(detail::scope_id scope, std::size_t sz) noexcept;
+
+    std::size_t                                               max_allocations_;
+    std::size_t                                               max_bytes_;
+    budget_action                                             action_;
+    std::size_t                                               allocation_count_ = 0;
+    std::size_t                                               allocated_bytes_  = 0;
+    std::size_t                                               violation_count_  = 0;
+    std::array<allocation_violation, max_recorded_violations> violations_{};
+    allocation_budget*                                        previous_;
+  };
+
+  // Budget of no allocation at all
+  class no_alloc_guard : public allocation_budget
+  {
+  public:
+    explicit no_alloc_guard(budget_action action = budget_action::record)
+        : allocation_budget{0, 0, action}
+    {
+    }
+  };
+
+  // Statistics of a region and of all the regions nested in it, the peak being the highest peak among them.
+  // The region alone is an ordinary scope: get_memory_information_snapshot(path).
+  scoped_memory_informations get_region_memory_information_snapshot(std::string_view path);
+
+  // Statistics of the pool of a class instrumented with MICROBENCH_MEMORY_INSTRUMENT_POOLED_CLASS, zero until its first allocation
+  struct object_pool_statistics
+  {
+    std::size_t block_size;       // object size plus the allocation header
+    std::size_t slab_count;       // slabs of 64 KiB, or of 16 blocks for the larger objects
+    std::size_t capacity;         // blocks in the slabs
+    std::size_t live_blocks;      // blocks handed out, the ones kept in the thread caches are free
+    std::size_t allocation_count; // allocations served by the pool
+    std::size_t free_list_hits;   // allocations served by the cache of their thread, without locking the pool
+
+    double occupancy() const { return capacity == 0 ? 0. : static_cast<double>(live_blocks) / static_cast<double>(capacity); }
+    double hit_rate() const { return allocation_count == 0 ? 0. : static_cast<double>(free_list_hits) / static_cast<double>(allocation_count); }
+  };
+
+  object_pool_statistics get_object_pool_statistics(std::string_view scope);
+
+  /*
+  backing allocator of the instrumented operators: every allocation goes through the current backend and is given back
+  to the backend that allocated it, whichever is current by then
+  the counters are the same whatever the backend, so that allocators can be compared under the same instrumentation
+
+  a backend receives the whole block, header included: the alignment is at least 16, and for over-aligned blocks the
+  size is a multiple of the alignment; allocate returns nullptr on failure, and neither function may throw
+  usable_size is optional, it gives the bytes actually reserved for a block for the slack tracking, the size of the block
+  being taken otherwise
+  */
+  struct allocator_backend
+  {
+    const char* name;
+    void* (*allocate)(void* context, std::size_t size, std::size_t alignment);
+    void (*deallocate)(void* context, void* ptr, std::size_t size, std::size_t alignment);
+    void* context;
+    std::size_t (*usable_size)(void* context, void* ptr, std::size_t size, std::size_t alignment) = nullptr;
+  };
+
+  enum builtin_allocator_backend : std::size_t
+  {
+    malloc_allocator_backend = 0, // default
+    // size classes of 16 bytes up to 1 KiB, then powers of two up to 64 KiB, spread over per-thread arenas; the larger or
+    // over-aligned blocks are left to malloc, and the memory of the pool is never returned to the OS
+    pool_allocator_backend = 1,
+    // per-thread bump pointer, deallocations are no-ops and the memory is only reclaimed by reset_bump_arena
+    bump_arena_allocator_backend = 2,
+  };
+
+  inline constexpr std::size_t max_allocator_backend_count = 16;
+
+  // Returns the index of the new backend, to be passed to set_allocator_backend. Backends can't be unregistered.
+  std::size_t register_allocator_backend(const allocator_backend& backend);
+  void        set_allocator_backend(std::size_t index);
+  std::size_t get_allocator_backend();
+  const char* get_allocator_backend_name(std::size_t index);
+
+  // Releases all the memory of the bump arena: none of its blocks may still be live, nor be deleted afterwards
+  void reset_bump_arena();
+
   namespace detail
   {
     [[nodiscard]] void* managed_new(std::size_t sz);
@@ -80,19 +855,41 @@ namespace MicrobenchMemory
     void managed_delete_array(void* ptr, [[maybe_unused]] std::size_t sz) noexcept;
     void managed_delete_array(void* ptr, [[maybe_unused]] std::size_t sz, [[maybe_unused]] std::align_val_t al) noexcept;
 
-    [[nodiscard]] void* managed_new(std::string_view class_name, std::size_t sz);
-    [[nodiscard]] void* managed_new(std::string_view class_name, std::size_t count, std::align_val_t al);
-    [[nodiscard]] void* managed_new_array(std::string_view class_name, std::size_t count);
-    [[nodiscard]] void* managed_new_array(std::string_view class_name, std::size_t count, std::align_val_t al);
-
-    void managed_delete(std::string_view class_name, void* ptr) noexcept;
-    void managed_delete(std::string_view class_name, void* ptr, [[maybe_unused]] std::align_val_t al) noexcept;
-    void managed_delete(std::string_view class_name, void* ptr, [[maybe_unused]] std::size_t sz) noexcept;
-    void managed_delete(std::string_view class_name, void* ptr, [[maybe_unused]] std::size_t sz, [[maybe_unused]] std::align_val_t al) noexcept;
-    void managed_delete_array(std::string_view class_name, void* ptr) noexcept;
-    void managed_delete_array(std::string_view class_name, void* ptr, [[maybe_unused]] std::align_val_t al) noexcept;
-    void managed_delete_array(std::string_view class_name, void* ptr, [[maybe_unused]] std::size_t sz) noexcept;
-    void managed_delete_array(std::string_view class_name, void* ptr, [[maybe_unused]] std::size_t sz, [[maybe_unused]] std::align_val_t al) noexcept;
+    // Malloc family, see the LD_PRELOAD shim in tools/src/preload.cpp. Returns nullptr on failure, an alignment of 0 means the default one.
+    [[nodiscard]] void* managed_malloc(std::size_t sz, std::size_t alignment) noexcept;
+    void                managed_free(void* ptr) noexcept;
+    std::size_t         managed_usable_size(void* ptr) noexcept;
+
+    [[nodiscard]] void* managed_new(scope_id scope, std::size_t sz);
+    [[nodiscard]] void* managed_new(scope_id scope, std::size_t count, std::align_val_t al);
+    [[nodiscard]] void* managed_new_array(scope_id scope, std::size_t count);
+    [[nodiscard]] void* managed_new_array(scope_id scope, std::size_t count, std::align_val_t al);
+
+    void managed_delete(scope_id scope, void* ptr) noexcept;
+    void managed_delete(scope_id scope, void* ptr, [[maybe_unused]] std::align_val_t al) noexcept;
+    void managed_delete(scope_id scope, void* ptr, [[maybe_unused]] std::size_t sz) noexcept;
+    void managed_delete(scope_id scope, void* ptr, [[maybe_unused]] std::size_t sz, [[maybe_unused]] std::align_val_t al) noexcept;
+    void managed_delete_array(scope_id scope, void* ptr) noexcept;
+    void managed_delete_array(scope_id scope, void* ptr, [[maybe_unused]] std::align_val_t al) noexcept;
+    void managed_delete_array(scope_id scope, void* ptr, [[maybe_unused]] std::size_t sz) noexcept;
+    void managed_delete_array(scope_id scope, void* ptr, [[maybe_unused]] std::size_t sz, [[maybe_unused]] std::align_val_t al) noexcept;
+
+    [[nodiscard]] void* managed_pooled_new(scope_id scope, std::size_t sz);
+    void                managed_pooled_delete(scope_id scope, void* ptr) noexcept;
+
+    // The nothrow operators: the block of the throwing allocation, or nullptr when it fails
+    template <typename Allocate>
+    [[nodiscard]] void* nothrow_new(Allocate&& allocate) noexcept
+    {
+      try
+      {
+        return allocate();
+      }
+      catch (const std::bad_alloc&)
+      {
+        return nullptr;
+      }
+    }
   } // namespace detail
 } // namespace MicrobenchMemory
 
@@ -103,6 +900,23 @@ namespace MicrobenchMemory
   [[nodiscard]] void* operator new[](std::size_t count) { return MicrobenchMemory::detail::managed_new_array(count); }                                                             \
   [[nodiscard]] void* operator new[](std::size_t count, std::align_val_t al) { return MicrobenchMemory::detail::managed_new_array(count, al); }                                    \
                                                                                                                                                                                    \
+  [[nodiscard]] void* operator new(std::size_t sz, const std::nothrow_t&) noexcept                                                                                                 \
+  {                                                                                                                                                                                \
+    return MicrobenchMemory::detail::nothrow_new([&] { return MicrobenchMemory::detail::managed_new(sz); });                                                                       \
+  }                                                                                                                                                                                \
+  [[nodiscard]] void* operator new(std::size_t count, std::align_val_t al, const std::nothrow_t&) noexcept                                                                         \
+  {                                                                                                                                                                                \
+    return MicrobenchMemory::detail::nothrow_new([&] { return MicrobenchMemory::detail::managed_new(count, al); });                                                                \
+  }                                                                                                                                                                                \
+  [[nodiscard]] void* operator new[](std::size_t count, const std::nothrow_t&) noexcept                                                                                            \
+  {                                                                                                                                                                                \
+    return MicrobenchMemory::detail::nothrow_new([&] { return MicrobenchMemory::detail::managed_new_array(count); });                                                              \
+  }                                                                                                                                                                                \
+  [[nodiscard]] void* operator new[](std::size_t count, std::align_val_t al, const std::nothrow_t&) noexcept                                                                       \
+  {                                                                                                                                                                                \
+    return MicrobenchMemory::detail::nothrow_new([&] { return MicrobenchMemory::detail::managed_new_array(count, al); });                                                          \
+  }                                                                                                                                                                                \
+                                                                                                                                                                                   \
   void operator delete(void* ptr) noexcept { return MicrobenchMemory::detail::managed_delete(ptr); }                                                                               \
   void operator delete(void* ptr, std::align_val_t al) noexcept { return MicrobenchMemory::detail::managed_delete(ptr, al); }                                                      \
   void operator delete(void* ptr, std::size_t sz) noexcept { return MicrobenchMemory::detail::managed_delete(ptr, sz); }                                                           \
@@ -111,22 +925,65 @@ namespace MicrobenchMemory
   void operator delete[](void* ptr) noexcept { return MicrobenchMemory::detail::managed_delete_array(ptr); }                                                                       \
   void operator delete[](void* ptr, std::align_val_t al) noexcept { return MicrobenchMemory::detail::managed_delete_array(ptr, al); }                                              \
   void operator delete[](void* ptr, std::size_t sz) noexcept { return MicrobenchMemory::detail::managed_delete_array(ptr, sz); }                                                   \
-  void operator delete[](void* ptr, std::size_t sz, std::align_val_t al) noexcept { return MicrobenchMemory::detail::managed_delete_array(ptr, sz, al); }
+  void operator delete[](void* ptr, std::size_t sz, std::align_val_t al) noexcept { return MicrobenchMemory::detail::managed_delete_array(ptr, sz, al); }                          \
+                                                                                                                                                                                   \
+  void operator delete(void* ptr, const std::nothrow_t&) noexcept { return MicrobenchMemory::detail::managed_delete(ptr); }                                                        \
+  void operator delete(void* ptr, std::align_val_t al, const std::nothrow_t&) noexcept { return MicrobenchMemory::detail::managed_delete(ptr, al); }                               \
+  void operator delete[](void* ptr, const std::nothrow_t&) noexcept { return MicrobenchMemory::detail::managed_delete_array(ptr); }                                                \
+  void operator delete[](void* ptr, std::align_val_t al, const std::nothrow_t&) noexcept { return MicrobenchMemory::detail::managed_delete_array(ptr, al); }
 
-// Insert inside a class declaration
-#define MICROBENCH_MEMORY_INSTRUMENT_CLASS(class_name)                                                                                                                             \
-  [[nodiscard]] static void* operator new(std::size_t sz) { return MicrobenchMemory::detail::managed_new(class_name, sz); }                                                        \
-  [[nodiscard]] static void* operator new(std::size_t count, std::align_val_t al) { return MicrobenchMemory::detail::managed_new(class_name, count, al); }                         \
+#define MICROBENCH_MEMORY_DETAIL_INSTRUMENT_ARRAY_OPERATORS(scope)                                                                                                                 \
+  [[nodiscard]] static void* operator new[](std::size_t count) { return MicrobenchMemory::detail::managed_new_array(scope, count); }                                               \
+  [[nodiscard]] static void* operator new[](std::size_t count, std::align_val_t al) { return MicrobenchMemory::detail::managed_new_array(scope, count, al); }                      \
                                                                                                                                                                                    \
-  [[nodiscard]] static void* operator new[](std::size_t count) { return MicrobenchMemory::detail::managed_new_array(class_name, count); }                                          \
-  [[nodiscard]] static void* operator new[](std::size_t count, std::align_val_t al) { return MicrobenchMemory::detail::managed_new_array(class_name, count, al); }                 \
+  static void operator delete[](void* ptr) noexcept { return MicrobenchMemory::detail::managed_delete_array(scope, ptr); }                                                         \
+  static void operator delete[](void* ptr, std::align_val_t al) noexcept { return MicrobenchMemory::detail::managed_delete_array(scope, ptr, al); }                                \
+  static void operator delete[](void* ptr, std::size_t sz) noexcept { return MicrobenchMemory::detail::managed_delete_array(scope, ptr, sz); }                                     \
+  static void operator delete[](void* ptr, std::size_t sz, std::align_val_t al) noexcept { return MicrobenchMemory::detail::managed_delete_array(scope, ptr, sz, al); }
+
+#define MICROBENCH_MEMORY_DETAIL_INSTRUMENT_OPERATORS(scope)                                                                                                                       \
+  [[nodiscard]] static void* operator new(std::size_t sz) { return MicrobenchMemory::detail::managed_new(scope, sz); }                                                             \
+  [[nodiscard]] static void* operator new(std::size_t count, std::align_val_t al) { return MicrobenchMemory::detail::managed_new(scope, count, al); }                              \
                                                                                                                                                                                    \
-  static void operator delete(void* ptr) noexcept { return MicrobenchMemory::detail::managed_delete(class_name, ptr); }                                                            \
-  static void operator delete(void* ptr, std::align_val_t al) noexcept { return MicrobenchMemory::detail::managed_delete(class_name, ptr, al); }                                   \
-  static void operator delete(void* ptr, std::size_t sz) noexcept { return MicrobenchMemory::detail::managed_delete(class_name, ptr, sz); }                                        \
-  static void operator delete(void* ptr, std::size_t sz, std::align_val_t al) noexcept { return MicrobenchMemory::detail::managed_delete(class_name, ptr, sz, al); }               \
+  static void operator delete(void* ptr) noexcept { return MicrobenchMemory::detail::managed_delete(scope, ptr); }                                                                 \
+  static void operator delete(void* ptr, std::align_val_t al) noexcept { return MicrobenchMemory::detail::managed_delete(scope, ptr, al); }                                        \
+  static void operator delete(void* ptr, std::size_t sz) noexcept { return MicrobenchMemory::detail::managed_delete(scope, ptr, sz); }                                             \
+  static void operator delete(void* ptr, std::size_t sz, std::align_val_t al) noexcept { return MicrobenchMemory::detail::managed_delete(scope, ptr, sz, al); }                    \
                                                                                                                                                                                    \
-  static void operator delete[](void* ptr) noexcept { return MicrobenchMemory::detail::managed_delete_array(class_name, ptr); }                                                    \
-  static void operator delete[](void* ptr, std::align_val_t al) noexcept { return MicrobenchMemory::detail::managed_delete_array(class_name, ptr, al); }                           \
-  static void operator delete[](void* ptr, std::size_t sz) noexcept { return MicrobenchMemory::detail::managed_delete_array(class_name, ptr, sz); }                                \
-  static void operator delete[](void* ptr, std::size_t sz, std::align_val_t al) noexcept { return MicrobenchMemory::detail::managed_delete_array(class_name, ptr, sz, al); }
+  MICROBENCH_MEMORY_DETAIL_INSTRUMENT_ARRAY_OPERATORS(scope)
+
+// Only the single objects of the exact class size come from the pool, arrays and over-aligned objects are allocated as usual
+#define MICROBENCH_MEMORY_DETAIL_INSTRUMENT_POOLED_OPERATORS(scope)                                                                                                                \
+  [[nodiscard]] static void* operator new(std::size_t sz) { return MicrobenchMemory::detail::managed_pooled_new(scope, sz); }                                                      \
+  [[nodiscard]] static void* operator new(std::size_t count, std::align_val_t al) { return MicrobenchMemory::detail::managed_new(scope, count, al); }                              \
+                                                                                                                                                                                   \
+  static void operator delete(void* ptr) noexcept { return MicrobenchMemory::detail::managed_pooled_delete(scope, ptr); }                                                          \
+  static void operator delete(void* ptr, std::align_val_t al) noexcept { return MicrobenchMemory::detail::managed_delete(scope, ptr, al); }                                        \
+  static void operator delete(void* ptr, [[maybe_unused]] std::size_t sz) noexcept { return MicrobenchMemory::detail::managed_pooled_delete(scope, ptr); }                         \
+  static void operator delete(void* ptr, std::size_t sz, std::align_val_t al) noexcept { return MicrobenchMemory::detail::managed_delete(scope, ptr, sz, al); }                    \
+                                                                                                                                                                                   \
+  MICROBENCH_MEMORY_DETAIL_INSTRUMENT_ARRAY_OPERATORS(scope)
+
+// Insert inside a class declaration
+// The scope name is resolved once, on first use, to an identifier
+#define MICROBENCH_MEMORY_INSTRUMENT_CLASS(class_name)                                                                                                                             \
+  static MicrobenchMemory::detail::scope_id microbench_memory_scope_id()                                                                                                           \
+  {                                                                                                                                                                                \
+    static const auto scope = MicrobenchMemory::detail::register_scope(class_name);                                                                                                \
+    return scope;                                                                                                                                                                  \
+  }                                                                                                                                                                                \
+  MICROBENCH_MEMORY_DETAIL_INSTRUMENT_OPERATORS(microbench_memory_scope_id())
+
+// Insert inside a class declaration
+// The scope is keyed on the type and named after it: get_memory_information_snapshot<type>()
+#define MICROBENCH_MEMORY_INSTRUMENT_TYPE(type) MICROBENCH_MEMORY_DETAIL_INSTRUMENT_OPERATORS(MicrobenchMemory::detail::type_scope<type>::id())
+
+// Insert inside a class declaration
+// Same as MICROBENCH_MEMORY_INSTRUMENT_CLASS, the objects being allocated from a pool: see get_object_pool_statistics
+#define MICROBENCH_MEMORY_INSTRUMENT_POOLED_CLASS(class_name)                                                                                                                      \
+  static MicrobenchMemory::detail::scope_id microbench_memory_scope_id()                                                                                                           \
+  {                                                                                                                                                                                \
+    static const auto scope = MicrobenchMemory::detail::register_scope(class_name);                                                                                                \
+    return scope;                                                                                                                                                                  \
+  }                                                                                                                                                                                \
+  MICROBENCH_MEMORY_DETAIL_INSTRUMENT_POOLED_OPERATORS(microbench_memory_scope_id())
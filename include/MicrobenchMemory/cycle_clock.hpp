@@ -0,0 +1,49 @@
+#pragma once
+
+#include <chrono>
+#include <cstdint>
+
+#if defined(_MSC_VER) && (defined(_M_X64) || defined(_M_IX86))
+#include <intrin.h>
+#define MICROBENCH_MEMORY_DETAIL_HAS_RDTSC 1
+#elif defined(__x86_64__) || defined(__i386__)
+#include <x86intrin.h>
+#define MICROBENCH_MEMORY_DETAIL_HAS_RDTSC 1
+#endif
+
+namespace MicrobenchMemory::detail
+{
+  /*
+  cheapest monotonic clock of the platform: the time stamp counter on x86, which ticks at a constant rate on every
+  processor since the invariant TSC, and the steady clock elsewhere
+  the ticks are only converted to nanoseconds when the measures are read, with the rate measured by calibrate
+  */
+  inline std::uint64_t read_cycle_clock()
+  {
+#ifdef MICROBENCH_MEMORY_DETAIL_HAS_RDTSC
+    return __rdtsc();
+#else
+    return static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count());
+#endif
+  }
+
+  // Returns the nanoseconds per tick, measured against the steady clock over about 10 ms
+  inline double calibrate_cycle_clock()
+  {
+#ifdef MICROBENCH_MEMORY_DETAIL_HAS_RDTSC
+    using clock = std::chrono::steady_clock;
+
+    auto start_time  = clock::now();
+    auto start_ticks = read_cycle_clock();
+    auto stop_time   = start_time;
+    while (stop_time - start_time < std::chrono::milliseconds{10})
+      stop_time = clock::now();
+    auto stop_ticks = read_cycle_clock();
+
+    auto elapsed = std::chrono::duration<double, std::nano>(stop_time - start_time).count();
+    return stop_ticks > start_ticks ? elapsed / static_cast<double>(stop_ticks - start_ticks) : 1.;
+#else
+    return 1.;
+#endif
+  }
+} // namespace MicrobenchMemory::detail
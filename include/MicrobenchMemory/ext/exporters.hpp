@@ -0,0 +1,464 @@
+#pragma once
+
+#include "MicrobenchMemory/MicrobenchMemory.hpp"
+
+#include <algorithm>
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <string_view>
+
+/*
+machine-readable exports of the snapshots, the size histograms and the leaked pointers: JSON, CSV and the Prometheus
+text exposition format
+the writers stream into a buffer provided by the caller and never allocate, so that they can run inside the instrumented
+process, e.g. during the teardown of a benchmark, without disturbing the counters
+*/
+namespace MicrobenchMemory
+{
+  // Appends to a character buffer. Once it is full the output is truncated, but size() keeps counting what was written.
+  class buffer_writer
+  {
+  public:
+    buffer_writer(char* buffer, std::size_t capacity) : buffer_{buffer}, capacity_{capacity} {}
+
+    void put(char c)
+    {
+      if (size_ < capacity_)
+        buffer_[size_] = c;
+      ++size_;
+    }
+
+    void write(std::string_view text)
+    {
+      if (size_ < capacity_)
+        std::memcpy(buffer_ + size_, text.data(), std::min(text.size(), capacity_ - size_));
+      size_ += text.size();
+    }
+
+    void write_number(std::uint64_t value, int base = 10)
+    {
+      char digits[64];
+      auto result = std::to_chars(digits, digits + sizeof(digits), value, base);
+      write({digits, static_cast<std::size_t>(result.ptr - digits)});
+    }
+
+    // Shortest representation that reads back to the same value
+    void write_number(double value)
+    {
+      char digits[32];
+      auto result = std::to_chars(digits, digits + sizeof(digits), value);
+      write({digits, static_cast<std::size_t>(result.ptr - digits)});
+    }
+
+    void write_address(const void* ptr)
+    {
+      write("0x");
+      write_number(reinterpret_cast<std::uintptr_t>(ptr), 16);
+    }
+
+    // Size of the whole output, larger than the capacity once truncated
+    std::size_t      size() const { return size_; }
+    bool             truncated() const { return size_ > capacity_; }
+    std::string_view view() const { return {buffer_, std::min(size_, capacity_)}; }
+
+  private:
+    char*       buffer_;
+    std::size_t capacity_;
+    std::size_t size_ = 0;
+  };
+
+  namespace detail
+  {
+    // Label values escape the backslashes, the double quotes and the line feeds
+    inline void write_prometheus_label_value(buffer_writer& writer, std::string_view value)
+    {
+      for (auto c : value)
+      {
+        if (c == '\\' || c == '"' || c == '\n')
+          writer.put('\\');
+        writer.put(c == '\n' ? 'n' : c);
+      }
+    }
+
+    inline void write_json_string(buffer_writer& writer, std::string_view text)
+    {
+      writer.put('"');
+      for (auto c : text)
+      {
+        if (c == '"' || c == '\\')
+        {
+          writer.put('\\');
+          writer.put(c);
+        }
+        else if (static_cast<unsigned char>(c) < 0x20)
+        {
+          writer.write("\\u00");
+          writer.put("0123456789abcdef"[(c >> 4) & 0xF]);
+          writer.put("0123456789abcdef"[c & 0xF]);
+        }
+        else
+          writer.put(c);
+      }
+      writer.put('"');
+    }
+
+    inline void write_json_field(buffer_writer& writer, std::string_view name, std::uint64_t value)
+    {
+      writer.put('"');
+      writer.write(name);
+      writer.write("\":");
+      writer.write_number(value);
+    }
+
+    inline void write_json_estimate(buffer_writer& writer, std::string_view name, const memory_estimate& estimate)
+    {
+      writer.put('"');
+      writer.write(name);
+      writer.write("\":{\"value\":");
+      writer.write_number(estimate.value);
+      writer.write(",\"variance\":");
+      writer.write_number(estimate.variance);
+      writer.put('}');
+    }
+
+    // The fields shared by the global and the scoped snapshots
+    inline void write_json_counters(buffer_writer& writer, const global_memory_informations& infos)
+    {
+      write_json_field(writer, "allocation_count", infos.allocation_count);
+      writer.put(',');
+      write_json_field(writer, "deallocation_count", infos.deallocation_count);
+      writer.put(',');
+      write_json_field(writer, "total_memory_allocated", infos.total_memory_allocated);
+      writer.put(',');
+      write_json_field(writer, "total_memory_deallocated", infos.total_memory_deallocated);
+      writer.put(',');
+      write_json_field(writer, "current_memory_used", infos.current_memory_used());
+      writer.put(',');
+      write_json_field(writer, "peak_memory_used", infos.peak_memory_used);
+    }
+
+    inline void write_csv_field(buffer_writer& writer, std::string_view field)
+    {
+      if (field.find_first_of(",\"\n") == std::string_view::npos)
+        return writer.write(field);
+
+      writer.put('"');
+      for (auto c : field)
+      {
+        if (c == '"')
+          writer.put('"');
+        writer.put(c);
+      }
+      writer.put('"');
+    }
+
+    inline void write_csv_counters(buffer_writer& writer, const global_memory_informations& infos)
+    {
+      writer.write_number(infos.allocation_count);
+      writer.put(',');
+      writer.write_number(infos.deallocation_count);
+      writer.put(',');
+      writer.write_number(infos.total_memory_allocated);
+      writer.put(',');
+      writer.write_number(infos.total_memory_deallocated);
+      writer.put(',');
+      writer.write_number(infos.current_memory_used());
+      writer.put(',');
+      writer.write_number(infos.peak_memory_used);
+    }
+
+    inline constexpr std::string_view csv_counters_header = "allocation_count,deallocation_count,total_memory_allocated,total_memory_deallocated,current_memory_used,peak_memory_used";
+
+    /*
+    a family of samples, one per scope, labelled with the name of the scope; the global snapshot is written as a single
+    scope without label
+    the scoped families are named microbench_memory_scope_* so that a global and a scoped export can be concatenated
+    */
+    inline void write_prometheus_name(buffer_writer& writer, std::string_view name, bool labelled)
+    {
+      writer.write(labelled ? "microbench_memory_scope_" : "microbench_memory_");
+      writer.write(name);
+    }
+
+    template <typename Value>
+    void write_prometheus_family(buffer_writer& writer, std::string_view name, std::string_view type, std::string_view help, const scoped_memory_informations* scopes,
+                                 std::size_t count, bool labelled, Value&& value)
+    {
+      writer.write("# HELP ");
+      write_prometheus_name(writer, name, labelled);
+      writer.put(' ');
+      writer.write(help);
+      writer.write("\n# TYPE ");
+      write_prometheus_name(writer, name, labelled);
+      writer.put(' ');
+      writer.write(type);
+      writer.put('\n');
+
+      for (std::size_t i = 0; i < count; ++i)
+      {
+        write_prometheus_name(writer, name, labelled);
+        if (labelled)
+        {
+          writer.write("{scope=\"");
+          write_prometheus_label_value(writer, scopes[i].scope);
+          writer.write("\"}");
+        }
+        writer.put(' ');
+        writer.write_number(value(scopes[i]));
+        writer.put('\n');
+      }
+    }
+
+    /*
+    the size histograms as Prometheus histograms, with a bucket per power of two: the bucket le="2^k - 1" counts the
+    allocations smaller than 2^k bytes, which matches the bounds of the bins
+    the sizes themselves are not summed by the histograms, the _sum series is left out
+    */
+    inline constexpr std::size_t prometheus_size_bucket_count = 40;
+
+    inline void write_prometheus_size_histograms(buffer_writer& writer, const scoped_memory_informations* scopes, std::size_t count, bool labelled)
+    {
+      writer.write("# HELP ");
+      write_prometheus_name(writer, "allocation_size_bytes", labelled);
+      writer.write(" Requested allocation sizes, when the size histograms are enabled.\n# TYPE ");
+      write_prometheus_name(writer, "allocation_size_bytes", labelled);
+      writer.write(" histogram\n");
+
+      auto write_sample = [&](std::string_view suffix, const scoped_memory_informations& infos, std::string_view le, std::uint64_t value) {
+        write_prometheus_name(writer, "allocation_size_bytes", labelled);
+        writer.write(suffix);
+        if (labelled || !le.empty())
+        {
+          writer.put('{');
+          if (labelled)
+          {
+            writer.write("scope=\"");
+            write_prometheus_label_value(writer, infos.scope);
+            writer.write(le.empty() ? "\"" : "\",");
+          }
+          if (!le.empty())
+          {
+            writer.write("le=\"");
+            writer.write(le);
+            writer.put('"');
+          }
+          writer.put('}');
+        }
+        writer.put(' ');
+        writer.write_number(value);
+        writer.put('\n');
+      };
+
+      for (std::size_t i = 0; i < count; ++i)
+      {
+        const auto&   histogram  = scopes[i].size_histogram;
+        std::size_t   bin        = 0;
+        std::uint64_t cumulative = 0;
+        for (std::size_t k = 1; k <= prometheus_size_bucket_count; ++k)
+        {
+          std::uint64_t bound = (std::uint64_t{1} << k) - 1;
+          for (; bin < allocation_size_histogram::bin_count && allocation_size_histogram::bin_upper_bound(bin) <= bound; ++bin)
+            cumulative += histogram.bins[bin];
+
+          char le[24];
+          auto result = std::to_chars(le, le + sizeof(le), bound);
+          write_sample("_bucket", scopes[i], {le, static_cast<std::size_t>(result.ptr - le)}, cumulative);
+        }
+        write_sample("_bucket", scopes[i], "+Inf", histogram.total_count());
+        write_sample("_count", scopes[i], {}, histogram.total_count());
+      }
+    }
+
+    inline void write_prometheus_counters(buffer_writer& writer, const scoped_memory_informations* scopes, std::size_t count, bool labelled)
+    {
+      write_prometheus_family(writer, "allocations_total", "counter", "Allocations through the instrumented operators.", scopes, count, labelled,
+                              [](const auto& infos) { return std::uint64_t{infos.allocation_count}; });
+      write_prometheus_family(writer, "deallocations_total", "counter", "Deallocations through the instrumented operators.", scopes, count, labelled,
+                              [](const auto& infos) { return std::uint64_t{infos.deallocation_count}; });
+      write_prometheus_family(writer, "allocated_bytes_total", "counter", "Bytes allocated through the instrumented operators.", scopes, count, labelled,
+                              [](const auto& infos) { return std::uint64_t{infos.total_memory_allocated}; });
+      write_prometheus_family(writer, "deallocated_bytes_total", "counter", "Bytes deallocated through the instrumented operators.", scopes, count, labelled,
+                              [](const auto& infos) { return std::uint64_t{infos.total_memory_deallocated}; });
+      write_prometheus_family(writer, "live_bytes", "gauge", "Bytes allocated and not freed yet.", scopes, count, labelled,
+                              [](const auto& infos) { return std::uint64_t{infos.current_memory_used()}; });
+      write_prometheus_family(writer, "peak_bytes", "gauge", "Highest number of bytes in use at once.", scopes, count, labelled,
+                              [](const auto& infos) { return std::uint64_t{infos.peak_memory_used}; });
+    }
+  } // namespace detail
+
+  /*
+  JSON: a snapshot is an object holding the counters, the current memory used, and the non-empty bins of its size
+  histogram as an array of {"lower_bound", "upper_bound", "count"}; the scoped snapshots also hold their name, their
+  number of live pointers and their estimates
+  */
+  inline void write_json(buffer_writer& writer, const allocation_size_histogram& histogram)
+  {
+    writer.put('[');
+    bool first = true;
+    for (std::size_t bin = 0; bin < allocation_size_histogram::bin_count; ++bin)
+    {
+      if (histogram.bins[bin] == 0)
+        continue;
+      if (!first)
+        writer.put(',');
+      first = false;
+
+      writer.put('{');
+      detail::write_json_field(writer, "lower_bound", allocation_size_histogram::bin_lower_bound(bin));
+      writer.put(',');
+      detail::write_json_field(writer, "upper_bound", allocation_size_histogram::bin_upper_bound(bin));
+      writer.put(',');
+      detail::write_json_field(writer, "count", histogram.bins[bin]);
+      writer.put('}');
+    }
+    writer.put(']');
+  }
+
+  inline void write_json(buffer_writer& writer, const global_memory_informations& infos)
+  {
+    writer.put('{');
+    detail::write_json_counters(writer, infos);
+    writer.write(",\"size_histogram\":");
+    write_json(writer, infos.size_histogram);
+    writer.put('}');
+  }
+
+  inline void write_json(buffer_writer& writer, const scoped_memory_informations& infos)
+  {
+    writer.write("{\"scope\":");
+    detail::write_json_string(writer, infos.scope);
+    writer.put(',');
+    detail::write_json_counters(writer, infos);
+    writer.put(',');
+    detail::write_json_field(writer, "nb_ptr_leaked", infos.nb_ptr_leaked);
+    writer.write(",\"size_histogram\":");
+    write_json(writer, infos.size_histogram);
+
+    const auto& estimates = infos.estimates;
+    writer.write(",\"estimates\":{");
+    detail::write_json_field(writer, "sampling_interval", estimates.sampling_interval);
+    writer.put(',');
+    detail::write_json_estimate(writer, "allocation_count", estimates.allocation_count);
+    writer.put(',');
+    detail::write_json_estimate(writer, "deallocation_count", estimates.deallocation_count);
+    writer.put(',');
+    detail::write_json_estimate(writer, "total_memory_allocated", estimates.total_memory_allocated);
+    writer.put(',');
+    detail::write_json_estimate(writer, "total_memory_deallocated", estimates.total_memory_deallocated);
+    writer.write("}}");
+  }
+
+  // An array of the snapshots, e.g. the ones filled by snapshot_all_scopes
+  inline void write_json(buffer_writer& writer, const scoped_memory_informations* scopes, std::size_t count)
+  {
+    writer.put('[');
+    for (std::size_t i = 0; i < count; ++i)
+    {
+      if (i != 0)
+        writer.put(',');
+      write_json(writer, scopes[i]);
+    }
+    writer.put(']');
+  }
+
+  // An array of {"address", "size"}, the addresses being hexadecimal strings, e.g. the pointers given by get_leaked_pointers
+  inline void write_json(buffer_writer& writer, const leaked_pointer* pointers, std::size_t count)
+  {
+    writer.put('[');
+    for (std::size_t i = 0; i < count; ++i)
+    {
+      if (i != 0)
+        writer.put(',');
+      writer.write("{\"address\":\"");
+      writer.write_address(pointers[i].ptr);
+      writer.write("\",");
+      detail::write_json_field(writer, "size", pointers[i].size);
+      writer.put('}');
+    }
+    writer.put(']');
+  }
+
+  // CSV: a header line, then a line per snapshot, bin or pointer
+  inline void write_csv(buffer_writer& writer, const global_memory_informations& infos)
+  {
+    writer.write(detail::csv_counters_header);
+    writer.put('\n');
+    detail::write_csv_counters(writer, infos);
+    writer.put('\n');
+  }
+
+  inline void write_csv(buffer_writer& writer, const scoped_memory_informations* scopes, std::size_t count)
+  {
+    writer.write("scope,");
+    writer.write(detail::csv_counters_header);
+    writer.write(",nb_ptr_leaked\n");
+    for (std::size_t i = 0; i < count; ++i)
+    {
+      detail::write_csv_field(writer, scopes[i].scope);
+      writer.put(',');
+      detail::write_csv_counters(writer, scopes[i]);
+      writer.put(',');
+      writer.write_number(scopes[i].nb_ptr_leaked);
+      writer.put('\n');
+    }
+  }
+
+  // The non-empty bins
+  inline void write_csv(buffer_writer& writer, const allocation_size_histogram& histogram)
+  {
+    writer.write("lower_bound,upper_bound,count\n");
+    for (std::size_t bin = 0; bin < allocation_size_histogram::bin_count; ++bin)
+    {
+      if (histogram.bins[bin] == 0)
+        continue;
+      writer.write_number(allocation_size_histogram::bin_lower_bound(bin));
+      writer.put(',');
+      writer.write_number(allocation_size_histogram::bin_upper_bound(bin));
+      writer.put(',');
+      writer.write_number(histogram.bins[bin]);
+      writer.put('\n');
+    }
+  }
+
+  inline void write_csv(buffer_writer& writer, const leaked_pointer* pointers, std::size_t count)
+  {
+    writer.write("address,size\n");
+    for (std::size_t i = 0; i < count; ++i)
+    {
+      writer.write_address(pointers[i].ptr);
+      writer.put(',');
+      writer.write_number(pointers[i].size);
+      writer.put('\n');
+    }
+  }
+
+  /*
+  Prometheus text exposition format: the counters as microbench_memory_* metrics, and the size histograms as the
+  microbench_memory_allocation_size_bytes histogram; the scopes are exported as microbench_memory_scope_* metrics, told
+  apart by a "scope" label
+  */
+  inline void write_prometheus(buffer_writer& writer, const global_memory_informations& infos)
+  {
+    scoped_memory_informations global{infos.allocation_count,
+                                      infos.deallocation_count,
+                                      infos.total_memory_allocated,
+                                      infos.total_memory_deallocated,
+                                      0,
+                                      {},
+                                      infos.peak_memory_used,
+                                      infos.size_histogram,
+                                      {}};
+    detail::write_prometheus_counters(writer, &global, 1, false);
+    detail::write_prometheus_size_histograms(writer, &global, 1, false);
+  }
+
+  inline void write_prometheus(buffer_writer& writer, const scoped_memory_informations* scopes, std::size_t count)
+  {
+    detail::write_prometheus_counters(writer, scopes, count, true);
+    detail::write_prometheus_family(writer, "live_pointers", "gauge", "Pointers allocated and not freed yet.", scopes, count, true,
+                                    [](const auto& infos) { return std::uint64_t{infos.nb_ptr_leaked}; });
+    detail::write_prometheus_size_histograms(writer, scopes, count, true);
+  }
+} // namespace MicrobenchMemory
@@ -4,23 +4,62 @@
 
 #include <ostream>
 
-std::ostream& operator<<(std::ostream& os, const MicrobenchMemory::scoped_memory_informations& minfo)
+inline std::ostream& operator<<(std::ostream& os, const MicrobenchMemory::allocation_size_histogram& histogram)
+{
+  using MicrobenchMemory::allocation_size_histogram;
+
+  os << "Allocation sizes:";
+  if (histogram.total_count() == 0)
+    return os << " (none)\n";
+
+  os << '\n';
+  for (std::size_t bin = 0; bin < allocation_size_histogram::bin_count; ++bin)
+    if (histogram.bins[bin] != 0)
+      os << "  [" << allocation_size_histogram::bin_lower_bound(bin) << ", " << allocation_size_histogram::bin_upper_bound(bin) << "]: " << histogram.bins[bin] << '\n';
+  return os;
+}
+
+inline std::ostream& operator<<(std::ostream& os, const MicrobenchMemory::memory_estimate& estimate)
+{
+  return os << estimate.value << " [" << estimate.lower_bound() << ", " << estimate.upper_bound() << "]";
+}
+
+inline std::ostream& operator<<(std::ostream& os, const MicrobenchMemory::sampled_memory_estimates& estimates)
+{
+  if (estimates.sampling_interval == 0)
+    return os;
+
+  os << "Estimates, sampled every " << estimates.sampling_interval << " bytes (95% confidence):\n"
+     << "  Total allocations: " << estimates.allocation_count << '\n'
+     << "  Total deallocations: " << estimates.deallocation_count << '\n'
+     << "  Total memory allocated: " << estimates.total_memory_allocated << '\n'
+     << "  Total memory deallocated: " << estimates.total_memory_deallocated << '\n'
+     << "  Current memory used: " << estimates.current_memory_used() << '\n';
+  return os;
+}
+
+inline std::ostream& operator<<(std::ostream& os, const MicrobenchMemory::scoped_memory_informations& minfo)
 {
   os << "Memory information snapshot for scope: <" << minfo.scope << ">:\n"
      << "Total allocations: " << minfo.allocation_count << '\n'
      << "Total deallocations: " << minfo.deallocation_count << '\n'
      << "Total memory allocated: " << minfo.total_memory_allocated << '\n'
      << "Total memory deallocated: " << minfo.total_memory_deallocated << '\n'
-     << "---\n";
+     << "Current memory used: " << minfo.current_memory_used() << '\n'
+     << "Peak memory used: " << minfo.peak_memory_used << '\n'
+     << minfo.size_histogram << minfo.estimates << "---\n";
   return os;
 }
 
-std::ostream& operator<<(std::ostream& os, const MicrobenchMemory::global_memory_informations& minfo)
+inline std::ostream& operator<<(std::ostream& os, const MicrobenchMemory::global_memory_informations& minfo)
 {
   os << "Memory information snapshot for global scope:\n"
      << "Total allocations: " << minfo.allocation_count << '\n'
      << "Total deallocations: " << minfo.deallocation_count << '\n'
      << "Total memory allocated: " << minfo.total_memory_allocated << '\n'
-     << "---\n";
+     << "Total memory deallocated: " << minfo.total_memory_deallocated << '\n'
+     << "Current memory used: " << minfo.current_memory_used() << '\n'
+     << "Peak memory used: " << minfo.peak_memory_used << '\n'
+     << minfo.size_histogram << "---\n";
   return os;
 }
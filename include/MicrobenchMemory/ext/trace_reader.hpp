@@ -0,0 +1,107 @@
+#pragma once
+
+#include "MicrobenchMemory/trace_format.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <filesystem>
+#include <fstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+namespace MicrobenchMemory
+{
+  struct trace_thread
+  {
+    trace_file_header         header;
+    std::vector<trace_record> records; // chronological order
+
+    // The ring was full: the oldest events are lost
+    bool wrapped() const { return header.record_count > header.capacity; }
+  };
+
+  // Throws std::runtime_error if the file can't be read or is not a trace
+  inline trace_thread read_trace_file(const std::filesystem::path& path)
+  {
+    std::ifstream file(path, std::ios::binary);
+    if (!file)
+      throw std::runtime_error("Cannot open trace file " + path.string());
+
+    trace_thread thread{};
+    if (!file.read(reinterpret_cast<char*>(&thread.header), sizeof(thread.header)) || std::memcmp(thread.header.magic, trace_magic, sizeof(trace_magic)) != 0 ||
+        thread.header.version != trace_version || thread.header.record_size != sizeof(trace_record) || thread.header.capacity == 0)
+      throw std::runtime_error("Invalid trace file " + path.string());
+
+    const auto&               header = thread.header;
+    auto                      count  = std::min(header.record_count, header.capacity);
+    std::vector<trace_record> ring(count);
+    if (!file.read(reinterpret_cast<char*>(ring.data()), static_cast<std::streamsize>(count * sizeof(trace_record))))
+      throw std::runtime_error("Truncated trace file " + path.string());
+
+    // once wrapped, the oldest record is the one that is overwritten next
+    auto oldest = thread.wrapped() ? header.record_count % header.capacity : 0;
+    thread.records.reserve(ring.size());
+    thread.records.insert(thread.records.end(), ring.begin() + static_cast<std::ptrdiff_t>(oldest), ring.end());
+    thread.records.insert(thread.records.end(), ring.begin(), ring.begin() + static_cast<std::ptrdiff_t>(oldest));
+    return thread;
+  }
+
+  // Reads all the trace files of the directory
+  inline std::vector<trace_thread> read_trace_directory(const std::filesystem::path& directory)
+  {
+    std::vector<trace_thread> threads;
+    for (const auto& entry : std::filesystem::directory_iterator(directory))
+      if (entry.is_regular_file() && entry.path().extension() == ".trace")
+        threads.push_back(read_trace_file(entry.path()));
+    return threads;
+  }
+
+  // Events of all the threads, in chronological order
+  inline std::vector<trace_record> merge_trace_records(const std::vector<trace_thread>& threads)
+  {
+    std::vector<trace_record> records;
+    for (const auto& thread : threads)
+      records.insert(records.end(), thread.records.begin(), thread.records.end());
+    std::stable_sort(records.begin(), records.end(), [](const trace_record& lhs, const trace_record& rhs) { return lhs.timestamp < rhs.timestamp; });
+    return records;
+  }
+
+  struct live_heap_sample
+  {
+    std::uint64_t timestamp;
+    std::int64_t  live_bytes;
+    std::int64_t  live_allocations;
+  };
+
+  /*
+  replays the events to rebuild the live heap after each of them
+  the curve is relative to the start of the trace: when rings wrapped, the deallocations of the lost allocations make
+  it go below 0
+  */
+  inline std::vector<live_heap_sample> live_heap_curve(const std::vector<trace_record>& records)
+  {
+    std::vector<live_heap_sample> curve;
+    curve.reserve(records.size());
+
+    live_heap_sample sample{0, 0, 0};
+    for (const auto& record : records)
+    {
+      auto size = static_cast<std::int64_t>(record.size);
+      if (record.kind == trace_event_allocation)
+      {
+        sample.live_bytes += size;
+        ++sample.live_allocations;
+      }
+      else if (record.kind == trace_event_deallocation)
+      {
+        sample.live_bytes -= size;
+        --sample.live_allocations;
+      }
+      sample.timestamp = record.timestamp;
+      curve.push_back(sample);
+    }
+    return curve;
+  }
+} // namespace MicrobenchMemory
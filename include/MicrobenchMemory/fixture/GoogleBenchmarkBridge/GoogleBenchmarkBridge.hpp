@@ -4,15 +4,129 @@
 
 #include <benchmark/benchmark.h>
 
+#include <cstddef>
+#include <optional>
+#include <string_view>
+#include <vector>
+
 namespace MicrobenchMemory::fixtures::GoogleBenchmarkBridge
 {
 
+  // Reports, for the measured region:
+  // - num_allocs: the number of allocations
+  // - max_bytes_used: the peak memory usage, above the usage at the start of the region
+  // - total_allocated_bytes: the cumulated size of the allocations
+  // - net_heap_growth: the memory allocated minus the memory deallocated
+  //
+  // By default the global statistics (MICROBENCH_MEMORY_OVERLOAD_GLOBAL) are reported. A scope filter restricts the
+  // report to the allocations of one instrumented class (MICROBENCH_MEMORY_INSTRUMENT_CLASS).
   class MemoryManager : public ::benchmark::MemoryManager
   {
+  public:
+    MemoryManager() = default;
+
+    // Report only the allocations of the given scope, for every benchmark
+    explicit MemoryManager(std::string_view scope);
+
+    // Report only the allocations of the given scope for the benchmark being run.
+    // Call it inside the benchmark body, before the measured loop. Thread-safe: the first request of a run is kept.
+    static void filter_scope(std::string_view scope);
+
     void Start() override;
     void Stop(::benchmark::MemoryManager::Result* result) override;
 
-    MicrobenchMemory::global_memory_informations start_;
+  private:
+    std::optional<std::string_view>              scope_;
+    MicrobenchMemory::global_memory_informations start_{};
+    MicrobenchMemory::scoped_memory_informations scoped_start_{};
+  };
+
+  // Reports the latency percentiles of the backing allocator as counters of the benchmark, for the operations made during
+  // the lifetime of the object: new_p50_ns, new_p99_ns, new_p999_ns, delete_p50_ns, delete_p99_ns and delete_p999_ns
+  //
+  // Create it in the benchmark body, before the measured loop: the latency timing is enabled while it lives. In
+  // multi-threaded benchmarks, the thread 0 reports the latencies of all the threads.
+  class AllocationLatencyCounters
+  {
+  public:
+    explicit AllocationLatencyCounters(::benchmark::State& state);
+    ~AllocationLatencyCounters();
+
+    AllocationLatencyCounters(const AllocationLatencyCounters&)            = delete;
+    AllocationLatencyCounters& operator=(const AllocationLatencyCounters&) = delete;
+
+  private:
+    ::benchmark::State&                    state_;
+    bool                                   reporting_;
+    bool                                   was_enabled_ = false;
+    MicrobenchMemory::allocation_latencies start_{};
+  };
+
+  // Reports the allocations of the instrumented operators per iteration, as the counters allocs_per_iter and
+  // bytes_per_iter, counted by an allocation_budget of the thread: a multi-threaded benchmark creates one in every
+  // thread, their counts add up. With a maximum, a benchmark allocating more per iteration is reported as an error.
+  //
+  // Create it in the benchmark body, right before the measured loop.
+  class AllocationsPerIteration
+  {
+  public:
+    explicit AllocationsPerIteration(::benchmark::State& state, std::size_t max_allocations_per_iteration = MicrobenchMemory::unlimited_budget);
+    ~AllocationsPerIteration();
+
+    AllocationsPerIteration(const AllocationsPerIteration&)            = delete;
+    AllocationsPerIteration& operator=(const AllocationsPerIteration&) = delete;
+
+  private:
+    ::benchmark::State&                 state_;
+    std::size_t                         max_allocations_per_iteration_;
+    MicrobenchMemory::allocation_budget budget_;
+  };
+
+  // Reports the instrumented allocations made during the lifetime of the object, per iteration, as the counters
+  // instrumented_allocations (global operators) and instrumented_scoped_allocations (the given scope, if any), for
+  // OverheadCompensatingReporter to take the cost of the instrumentation out of the timings
+  //
+  // Create it in the benchmark body, before the measured loop. In multi-threaded benchmarks, the thread 0 reports the
+  // allocations of all the threads.
+  class InstrumentationOverheadCounters
+  {
+  public:
+    explicit InstrumentationOverheadCounters(::benchmark::State& state);
+    InstrumentationOverheadCounters(::benchmark::State& state, std::string_view scope);
+    ~InstrumentationOverheadCounters();
+
+    InstrumentationOverheadCounters(const InstrumentationOverheadCounters&)            = delete;
+    InstrumentationOverheadCounters& operator=(const InstrumentationOverheadCounters&) = delete;
+
+  private:
+    ::benchmark::State&                          state_;
+    bool                                         reporting_;
+    std::optional<std::string_view>              scope_;
+    MicrobenchMemory::global_memory_informations start_{};
+    MicrobenchMemory::scoped_memory_informations scoped_start_{};
+  };
+
+  // Forwards the runs to another reporter, their timings decreased by the overhead of the instrumented allocations
+  // reported by InstrumentationOverheadCounters, see MicrobenchMemory::get_instrumentation_overhead. The overhead of
+  // the concurrent threads is taken to overlap like their real time and to add up like their cpu time. The aggregates
+  // of the repetitions are forwarded as computed by Google Benchmark, from the timings not compensated.
+  //
+  //   ::benchmark::ConsoleReporter console;
+  //   OverheadCompensatingReporter reporter{console};
+  //   ::benchmark::RunSpecifiedBenchmarks(&reporter);
+  class OverheadCompensatingReporter : public ::benchmark::BenchmarkReporter
+  {
+  public:
+    explicit OverheadCompensatingReporter(::benchmark::BenchmarkReporter& reporter);
+    OverheadCompensatingReporter(::benchmark::BenchmarkReporter& reporter, MicrobenchMemory::instrumentation_overhead overhead);
+
+    bool ReportContext(const Context& context) override;
+    void ReportRuns(const std::vector<Run>& runs) override;
+    void Finalize() override;
+
+  private:
+    ::benchmark::BenchmarkReporter&            reporter_;
+    MicrobenchMemory::instrumentation_overhead overhead_;
   };
 
 } // namespace MicrobenchMemory::fixtures::GoogleBenchmarkBridge
@@ -0,0 +1,59 @@
+#pragma once
+
+#include "MicrobenchMemory/MicrobenchMemory.hpp"
+
+#include <gtest/gtest.h>
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+
+namespace MicrobenchMemory::fixtures::GoogleTestAssertions
+{
+  /*
+  runs f under an allocation_budget, and fails with the violations when it allocates more than the budget
+  the budget only sees the allocations of the calling thread through the instrumented operators
+  */
+  template <typename F>
+  ::testing::AssertionResult allocates_within(const char* statement, std::size_t max_allocations, std::size_t max_bytes, F&& f)
+  {
+    using violation_array = std::array<MicrobenchMemory::allocation_violation, MicrobenchMemory::allocation_budget::max_recorded_violations>;
+
+    std::size_t     allocation_count = 0, allocated_bytes = 0, violation_count = 0;
+    violation_array violations{};
+    {
+      MicrobenchMemory::allocation_budget budget{max_allocations, max_bytes};
+      f();
+      allocation_count = budget.allocation_count();
+      allocated_bytes  = budget.allocated_bytes();
+      violation_count  = budget.violation_count();
+      std::copy_n(budget.violations(), budget.recorded_violation_count(), violations.begin());
+    }
+    if (violation_count == 0)
+      return ::testing::AssertionSuccess();
+
+    auto failure = ::testing::AssertionFailure() << statement << " made " << allocation_count << " allocations of " << allocated_bytes << " bytes, over the budget of "
+                                                 << max_allocations << " allocations";
+    if (max_bytes != MicrobenchMemory::unlimited_budget)
+      failure << " and " << max_bytes << " bytes";
+    for (std::size_t i = 0; i < std::min(violation_count, violations.size()); ++i)
+    {
+      failure << "\n  allocation #" << violations[i].allocation_index << ": " << violations[i].size << " bytes";
+      if (!violations[i].scope.empty())
+        failure << " in " << violations[i].scope;
+    }
+    if (violation_count > violations.size())
+      failure << "\n  and " << violation_count - violations.size() << " more";
+    return failure;
+  }
+} // namespace MicrobenchMemory::fixtures::GoogleTestAssertions
+
+// The statement must not allocate through the instrumented operators of its thread
+#define EXPECT_NO_ALLOCATION(statement) EXPECT_TRUE(::MicrobenchMemory::fixtures::GoogleTestAssertions::allocates_within(#statement, 0, 0, [&] { statement; }))
+#define ASSERT_NO_ALLOCATION(statement) ASSERT_TRUE(::MicrobenchMemory::fixtures::GoogleTestAssertions::allocates_within(#statement, 0, 0, [&] { statement; }))
+
+// The statement must not allocate more than max_allocations times nor more than max_bytes in total (unlimited_budget for no limit)
+#define EXPECT_ALLOCATIONS_WITHIN(statement, max_allocations, max_bytes)                                                                                                          \
+  EXPECT_TRUE(::MicrobenchMemory::fixtures::GoogleTestAssertions::allocates_within(#statement, max_allocations, max_bytes, [&] { statement; }))
+#define ASSERT_ALLOCATIONS_WITHIN(statement, max_allocations, max_bytes)                                                                                                          \
+  ASSERT_TRUE(::MicrobenchMemory::fixtures::GoogleTestAssertions::allocates_within(#statement, max_allocations, max_bytes, [&] { statement; }))
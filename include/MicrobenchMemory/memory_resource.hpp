@@ -0,0 +1,198 @@
+#pragma once
+
+#include "MicrobenchMemory/MicrobenchMemory.hpp"
+
+#include <algorithm>
+#include <cstddef>
+#include <memory_resource>
+#include <new>
+#include <string_view>
+#include <type_traits>
+
+namespace MicrobenchMemory
+{
+  /*
+  growth pattern of a container, inferred from the blocks it asks for: a block replaced by a larger one, allocated while
+  it is live and then freed, is a reallocation, its bytes being copied or moved into the larger one
+  a vector replaces its buffer this way when it grows, a hash table its buckets when it rehashes
+  */
+  struct container_growth
+  {
+    std::size_t allocation_count;
+    std::size_t deallocation_count;
+    std::size_t reallocation_count;
+    std::size_t bytes_copied;     // bytes of the replaced blocks, an upper bound of the elements moved on growth
+    std::size_t current_capacity; // bytes held
+    std::size_t peak_capacity;    // both blocks of a reallocation included
+  };
+
+  namespace detail
+  {
+    using upstream_allocate_function   = void* (*)(void* context, std::size_t size, std::size_t alignment) noexcept;
+    using upstream_deallocate_function = void (*)(void* context, void* ptr, std::size_t size, std::size_t alignment) noexcept;
+
+    /*
+    scoped allocations served by an upstream allocator: the block asked to allocate holds the allocation header, and is
+    given back to deallocate with the size and alignment it was allocated with
+    allocate returns nullptr on failure, managed_upstream_new then throws std::bad_alloc, like when the block can't be
+    recorded, the block being given back to deallocate first
+    */
+    [[nodiscard]] void* managed_upstream_new(scope_id scope, std::size_t sz, std::size_t alignment, upstream_allocate_function allocate,
+                                             upstream_deallocate_function deallocate, void* context);
+    void                managed_upstream_delete(scope_id scope, void* ptr, upstream_deallocate_function deallocate, void* context) noexcept;
+
+    // See container_growth: the largest live block is the buffer of the container, the block it replaced is kept until freed
+    class growth_tracker
+    {
+    public:
+      void log_allocation(void* ptr, std::size_t bytes)
+      {
+        ++growth_.allocation_count;
+        growth_.current_capacity += bytes;
+        growth_.peak_capacity = std::max(growth_.peak_capacity, growth_.current_capacity);
+        if (bytes > largest_bytes_)
+        {
+          replaced_       = largest_;
+          replaced_bytes_ = largest_bytes_;
+          largest_        = ptr;
+          largest_bytes_  = bytes;
+        }
+      }
+
+      void log_deallocation(void* ptr, std::size_t bytes)
+      {
+        ++growth_.deallocation_count;
+        growth_.current_capacity -= bytes;
+        if (ptr == replaced_)
+        {
+          ++growth_.reallocation_count;
+          growth_.bytes_copied += replaced_bytes_;
+          replaced_ = nullptr;
+        }
+        else if (ptr == largest_)
+        {
+          largest_       = nullptr;
+          largest_bytes_ = 0;
+        }
+      }
+
+      const container_growth& growth() const { return growth_; }
+
+    private:
+      container_growth growth_{};
+      void*            largest_        = nullptr;
+      std::size_t      largest_bytes_  = 0;
+      void*            replaced_       = nullptr;
+      std::size_t      replaced_bytes_ = 0;
+    };
+  } // namespace detail
+
+  /*
+  memory resource accounting the blocks it serves in a scope, like the classes instrumented with
+  MICROBENCH_MEMORY_INSTRUMENT_CLASS, the memory itself coming from the upstream resource; the upstream blocks hold the
+  allocation header and are not measured by the slack tracking
+  the global operators of MICROBENCH_MEMORY_OVERLOAD_GLOBAL called by the upstream resource to serve a block, directly
+  or through the default new_delete_resource, leave it out of the global counters: it is only counted once, in the scope
+  a resource per container instance gives the growth pattern of this container: like std::pmr::unsynchronized_pool_resource,
+  the growth is not synchronized, the scoped accounting is
+  a failure of the upstream resource is reported as std::bad_alloc
+  */
+  class tracking_memory_resource : public std::pmr::memory_resource
+  {
+  public:
+    explicit tracking_memory_resource(std::string_view scope, std::pmr::memory_resource* upstream = std::pmr::get_default_resource())
+        : scope_{detail::register_scope(scope)}
+        , upstream_{upstream}
+    {
+    }
+
+    tracking_memory_resource(const tracking_memory_resource&)            = delete;
+    tracking_memory_resource& operator=(const tracking_memory_resource&) = delete;
+
+    std::pmr::memory_resource* upstream_resource() const { return upstream_; }
+    const container_growth&    growth() const { return growth_.growth(); }
+
+  protected:
+    void* do_allocate(std::size_t bytes, std::size_t alignment) override
+    {
+      auto* ptr = detail::managed_upstream_new(scope_, bytes, alignment, allocate_upstream, deallocate_upstream, upstream_);
+      growth_.log_allocation(ptr, bytes);
+      return ptr;
+    }
+
+    void do_deallocate(void* ptr, std::size_t bytes, [[maybe_unused]] std::size_t alignment) override
+    {
+      growth_.log_deallocation(ptr, bytes);
+      detail::managed_upstream_delete(scope_, ptr, deallocate_upstream, upstream_);
+    }
+
+    bool do_is_equal(const std::pmr::memory_resource& other) const noexcept override { return this == &other; }
+
+  private:
+    static void* allocate_upstream(void* context, std::size_t size, std::size_t alignment) noexcept
+    {
+      try
+      {
+        return static_cast<std::pmr::memory_resource*>(context)->allocate(size, alignment);
+      }
+      catch (...)
+      {
+        return nullptr;
+      }
+    }
+
+    static void deallocate_upstream(void* context, void* ptr, std::size_t size, std::size_t alignment) noexcept
+    {
+      static_cast<std::pmr::memory_resource*>(context)->deallocate(ptr, size, alignment);
+    }
+
+    detail::scope_id           scope_;
+    std::pmr::memory_resource* upstream_;
+    detail::growth_tracker     growth_;
+  };
+
+  /*
+  allocator of the standard containers over a tracking_memory_resource, for the containers that are not std::pmr ones
+  the allocator follows the memory of its container on move assignment and swap, so that the growth of the resource
+  keeps describing the container holding its blocks
+  */
+  template <typename T>
+  class tracking_allocator
+  {
+  public:
+    using value_type                             = T;
+    using propagate_on_container_move_assignment = std::true_type;
+    using propagate_on_container_swap            = std::true_type;
+
+    tracking_allocator(tracking_memory_resource& resource) noexcept
+        : resource_{&resource}
+    {
+    }
+
+    template <typename U>
+    tracking_allocator(const tracking_allocator<U>& other) noexcept
+        : resource_{other.resource()}
+    {
+    }
+
+    [[nodiscard]] T* allocate(std::size_t count)
+    {
+      if (count > static_cast<std::size_t>(-1) / sizeof(T))
+        throw std::bad_array_new_length{};
+      return static_cast<T*>(resource_->allocate(count * sizeof(T), alignof(T)));
+    }
+
+    void deallocate(T* ptr, std::size_t count) noexcept { resource_->deallocate(ptr, count * sizeof(T), alignof(T)); }
+
+    tracking_memory_resource* resource() const noexcept { return resource_; }
+
+    template <typename U>
+    bool operator==(const tracking_allocator<U>& rhs) const noexcept
+    {
+      return resource_ == rhs.resource();
+    }
+
+  private:
+    tracking_memory_resource* resource_;
+  };
+} // namespace MicrobenchMemory
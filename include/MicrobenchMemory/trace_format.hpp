@@ -0,0 +1,46 @@
+#pragma once
+
+#include <cstdint>
+
+namespace MicrobenchMemory
+{
+  /*
+  binary format of the allocation traces
+  each traced thread writes its own file: a header followed by a ring of fixed-size records, the oldest records being
+  overwritten once the ring is full
+  */
+  inline constexpr char          trace_magic[8] = {'M', 'B', 'M', 'T', 'R', 'A', 'C', 'E'};
+  inline constexpr std::uint32_t trace_version  = 1;
+
+  enum trace_event_kind : std::uint8_t
+  {
+    trace_event_allocation   = 1,
+    trace_event_deallocation = 2,
+  };
+
+  struct trace_record
+  {
+    std::uint64_t timestamp; // nanoseconds, steady clock
+    std::uint64_t ptr;
+    std::uint64_t size;
+    std::uint32_t scope;     // 0 for the global allocations, the scope identifier otherwise
+    std::uint16_t thread;    // index of the thread, as in the file header
+    std::uint8_t  alignment; // log2 of the alignment, 0 for the default one
+    std::uint8_t  kind;      // trace_event_kind
+  };
+  static_assert(sizeof(trace_record) == 32);
+
+  struct trace_file_header
+  {
+    char          magic[8];
+    std::uint32_t version;
+    std::uint32_t record_size;
+    std::uint64_t capacity;     // number of records in the ring
+    std::uint64_t record_count; // number of records written: the ring wrapped if it is above the capacity
+    std::uint64_t thread_id;    // thread identifier of the OS
+    std::uint32_t thread_index;
+    std::uint32_t reserved;
+    std::uint64_t padding[2];
+  };
+  static_assert(sizeof(trace_file_header) == 64);
+} // namespace MicrobenchMemory
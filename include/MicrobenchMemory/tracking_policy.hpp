@@ -0,0 +1,414 @@
+#pragma once
+
+#include "MicrobenchMemory/MicrobenchMemory.hpp"
+#include "MicrobenchMemory/cycle_clock.hpp"
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <new>
+#include <string_view>
+#include <type_traits>
+
+namespace MicrobenchMemory
+{
+  /*
+  compile-time tracking policies
+  the operators of MICROBENCH_MEMORY_OVERLOAD_GLOBAL_WITH_POLICY and MICROBENCH_MEMORY_INSTRUMENT_CLASS_WITH_POLICY are
+  inline templates over a set of features: a disabled feature compiles away along with its storage, the enabled ones are
+  inlined into the operators
+
+  they are a lighter alternative to the regular instrumentation, for the measures whose own cost matters: the blocks come
+  straight from malloc, a size header is only added when a feature needs the freed size and the pointer registry is not
+  there to give it, and the snapshots read the counters one after the other, without the consistency of the regular ones
+  the memory regions, backends, sampling, allocation sites, traces and slack only work with the regular instrumentation
+  */
+  enum class tracking_features : std::uint32_t
+  {
+    none      = 0,
+    counts    = 1u << 0, // allocation and deallocation counts
+    bytes     = 1u << 1, // bytes allocated and deallocated
+    live      = 1u << 2, // bytes in use and their peak
+    pointers  = 1u << 3, // registry of the live pointers, which detects the frees of unknown pointers
+    histogram = 1u << 4, // size histogram
+    timing    = 1u << 5, // latency of malloc and free, with the cycle counter
+    all       = (1u << 6) - 1,
+  };
+
+  constexpr tracking_features operator|(tracking_features lhs, tracking_features rhs)
+  {
+    return static_cast<tracking_features>(static_cast<std::uint32_t>(lhs) | static_cast<std::uint32_t>(rhs));
+  }
+
+  constexpr bool has_feature(tracking_features features, tracking_features feature) { return (static_cast<std::uint32_t>(features) & static_cast<std::uint32_t>(feature)) != 0; }
+
+  // The members of the disabled features are left to 0
+  struct policy_memory_informations
+  {
+    std::string_view          scope;
+    std::size_t               allocation_count;
+    std::size_t               deallocation_count;
+    std::size_t               total_memory_allocated;
+    std::size_t               total_memory_deallocated;
+    std::size_t               current_memory_used;
+    std::size_t               peak_memory_used;
+    std::size_t               live_pointer_count;
+    allocation_size_histogram size_histogram;
+    latency_histogram         allocation_latency;
+    latency_histogram         deallocation_latency;
+  };
+
+  namespace detail
+  {
+    struct policy_pointer_registry;
+
+    // Pointer registry of a policy, created on first use and never destroyed. Returns nullptr on failure.
+    policy_pointer_registry* create_policy_pointer_registry() noexcept;
+    // Returns false if the registry can't grow anymore
+    bool insert_policy_pointer(policy_pointer_registry& registry, void* ptr, std::size_t sz) noexcept;
+    // Returns the size the pointer was registered with, throws std::runtime_error if it is not registered
+    std::size_t erase_policy_pointer(policy_pointer_registry& registry, void* ptr);
+    std::size_t count_policy_pointers(const policy_pointer_registry& registry) noexcept;
+
+    // Over-aligned blocks, out of line: they are rare, and aligned allocation functions differ between platforms
+    [[nodiscard]] void* policy_aligned_allocate(std::size_t sz, std::size_t alignment) noexcept;
+    void                policy_aligned_deallocate(void* ptr, std::size_t alignment) noexcept;
+
+    // Calibrated on first use, see calibrate_cycle_clock
+    double cycle_clock_nanoseconds_per_tick();
+
+    // unique empty types, so that several disabled members take no room at all
+    template <int Tag>
+    struct policy_disabled
+    {
+    };
+
+    template <bool Enabled, typename T, int Tag>
+    using policy_member = std::conditional_t<Enabled, T, policy_disabled<Tag>>;
+
+    // stripe of the current thread, 0 until its first allocation; constant-initialized, reading it never goes through a guard
+    inline constexpr std::size_t            policy_stripe_count = 16;
+    inline std::atomic<std::size_t>         next_policy_stripe{0};
+    inline constinit thread_local std::size_t policy_stripe_index = 0;
+
+    inline std::size_t current_policy_stripe()
+    {
+      auto index = policy_stripe_index;
+      if (index == 0)
+        index = policy_stripe_index = next_policy_stripe.fetch_add(1, std::memory_order_relaxed) % policy_stripe_count + 1;
+      return index - 1;
+    }
+
+    /*
+    blocks of the policies: a plain malloc block, or with WithSize a block prefixed by a header holding the requested size,
+    the header taking the whole alignment in front of over-aligned pointers
+    */
+    inline constexpr std::size_t policy_header_size = 16;
+
+    template <bool WithSize>
+    [[nodiscard]] inline void* policy_allocate(std::size_t sz, std::size_t alignment) noexcept
+    {
+      if constexpr (!WithSize)
+        return alignment > __STDCPP_DEFAULT_NEW_ALIGNMENT__ ? policy_aligned_allocate(sz, alignment) : std::malloc(sz == 0 ? 1 : sz);
+      else
+      {
+        auto offset = alignment > policy_header_size ? alignment : policy_header_size;
+        if (sz > static_cast<std::size_t>(-1) - offset)
+          return nullptr;
+
+        auto* base = static_cast<std::byte*>(offset > policy_header_size ? policy_aligned_allocate(offset + sz, offset) : std::malloc(offset + sz));
+        if (!base)
+          return nullptr;
+        *reinterpret_cast<std::size_t*>(base + offset - policy_header_size) = sz;
+        return base + offset;
+      }
+    }
+
+    template <bool WithSize>
+    inline void policy_deallocate(void* ptr, std::size_t alignment) noexcept
+    {
+      if constexpr (!WithSize)
+      {
+        if (alignment > __STDCPP_DEFAULT_NEW_ALIGNMENT__)
+          policy_aligned_deallocate(ptr, alignment);
+        else
+          std::free(ptr);
+      }
+      else
+      {
+        auto  offset = alignment > policy_header_size ? alignment : policy_header_size;
+        auto* base   = static_cast<std::byte*>(ptr) - offset;
+        if (offset > policy_header_size)
+          policy_aligned_deallocate(base, offset);
+        else
+          std::free(base);
+      }
+    }
+
+    inline std::size_t policy_block_size(void* ptr) noexcept { return *reinterpret_cast<const std::size_t*>(static_cast<const std::byte*>(ptr) - policy_header_size); }
+
+    template <bool Counts, bool Bytes>
+    struct alignas(64) policy_stripe
+    {
+      [[no_unique_address]] policy_member<Counts, std::atomic<std::size_t>, 0> allocation_count{};
+      [[no_unique_address]] policy_member<Counts, std::atomic<std::size_t>, 1> deallocation_count{};
+      [[no_unique_address]] policy_member<Bytes, std::atomic<std::size_t>, 2>  total_memory_allocated{};
+      [[no_unique_address]] policy_member<Bytes, std::atomic<std::size_t>, 3>  total_memory_deallocated{};
+    };
+
+    template <std::size_t BinCount>
+    using atomic_policy_bins = std::array<std::atomic<std::uint64_t>, BinCount>;
+  } // namespace detail
+
+  template <tracking_features Features>
+  class policy_tracker
+  {
+  public:
+    static constexpr bool track_counts    = has_feature(Features, tracking_features::counts);
+    static constexpr bool track_bytes     = has_feature(Features, tracking_features::bytes);
+    static constexpr bool track_live      = has_feature(Features, tracking_features::live);
+    static constexpr bool track_pointers  = has_feature(Features, tracking_features::pointers);
+    static constexpr bool track_histogram = has_feature(Features, tracking_features::histogram);
+    static constexpr bool track_timing    = has_feature(Features, tracking_features::timing);
+
+    // the freed size is needed by the bytes and the live memory, the pointer registry gives it when enabled
+    static constexpr bool size_header = (track_bytes || track_live) && !track_pointers;
+
+    constexpr explicit policy_tracker(std::string_view name) : name_{name} {}
+
+    policy_tracker(const policy_tracker&)            = delete;
+    policy_tracker& operator=(const policy_tracker&) = delete;
+
+    // An alignment of 0 means the default new alignment, throws std::bad_alloc on failure
+    [[nodiscard]] void* allocate(std::size_t sz, std::size_t alignment)
+    {
+      void* ptr = nullptr;
+      if constexpr (track_timing)
+      {
+        auto start = detail::read_cycle_clock();
+        ptr        = detail::policy_allocate<size_header>(sz, alignment);
+        log_latency(allocation_latency_, detail::read_cycle_clock() - start);
+      }
+      else
+        ptr = detail::policy_allocate<size_header>(sz, alignment);
+      if (!ptr)
+        throw std::bad_alloc{};
+
+      if constexpr (track_pointers)
+      {
+        auto* registry = get_registry();
+        if (!registry || !detail::insert_policy_pointer(*registry, ptr, sz))
+        {
+          detail::policy_deallocate<size_header>(ptr, alignment);
+          throw std::bad_alloc{};
+        }
+      }
+
+      if constexpr (track_counts || track_bytes)
+      {
+        auto& stripe = stripes_[detail::current_policy_stripe()];
+        if constexpr (track_counts)
+          stripe.allocation_count.fetch_add(1, std::memory_order_relaxed);
+        if constexpr (track_bytes)
+          stripe.total_memory_allocated.fetch_add(sz, std::memory_order_relaxed);
+      }
+      if constexpr (track_live)
+      {
+        auto current = current_memory_used_.fetch_add(sz, std::memory_order_relaxed) + sz;
+        auto peak    = peak_memory_used_.load(std::memory_order_relaxed);
+        while (current > peak && !peak_memory_used_.compare_exchange_weak(peak, current, std::memory_order_relaxed))
+        {
+        }
+      }
+      if constexpr (track_histogram)
+        size_bins_[allocation_size_histogram::bin_index(sz)].fetch_add(1, std::memory_order_relaxed);
+      return ptr;
+    }
+
+    void deallocate(void* ptr, std::size_t alignment) noexcept
+    {
+      if (!ptr)
+        return;
+
+      [[maybe_unused]] std::size_t sz = 0;
+      if constexpr (track_pointers)
+      {
+        if (auto* registry = get_registry())
+          sz = detail::erase_policy_pointer(*registry, ptr);
+      }
+      else if constexpr (size_header)
+        sz = detail::policy_block_size(ptr);
+
+      if constexpr (track_counts || track_bytes)
+      {
+        auto& stripe = stripes_[detail::current_policy_stripe()];
+        if constexpr (track_counts)
+          stripe.deallocation_count.fetch_add(1, std::memory_order_relaxed);
+        if constexpr (track_bytes)
+          stripe.total_memory_deallocated.fetch_add(sz, std::memory_order_relaxed);
+      }
+      if constexpr (track_live)
+        current_memory_used_.fetch_sub(sz, std::memory_order_relaxed);
+
+      if constexpr (track_timing)
+      {
+        auto start = detail::read_cycle_clock();
+        detail::policy_deallocate<size_header>(ptr, alignment);
+        log_latency(deallocation_latency_, detail::read_cycle_clock() - start);
+      }
+      else
+        detail::policy_deallocate<size_header>(ptr, alignment);
+    }
+
+    // The deallocations are read before the allocations: a snapshot never counts a deallocation without its allocation
+    policy_memory_informations snapshot() const
+    {
+      policy_memory_informations infos{};
+      infos.scope = name_;
+
+      if constexpr (track_counts || track_bytes)
+      {
+        for (const auto& stripe : stripes_)
+        {
+          if constexpr (track_counts)
+            infos.deallocation_count += stripe.deallocation_count.load(std::memory_order_acquire);
+          if constexpr (track_bytes)
+            infos.total_memory_deallocated += stripe.total_memory_deallocated.load(std::memory_order_acquire);
+        }
+        for (const auto& stripe : stripes_)
+        {
+          if constexpr (track_counts)
+            infos.allocation_count += stripe.allocation_count.load(std::memory_order_acquire);
+          if constexpr (track_bytes)
+            infos.total_memory_allocated += stripe.total_memory_allocated.load(std::memory_order_acquire);
+        }
+      }
+      if constexpr (track_live)
+      {
+        infos.current_memory_used = current_memory_used_.load(std::memory_order_relaxed);
+        infos.peak_memory_used    = peak_memory_used_.load(std::memory_order_relaxed);
+      }
+      if constexpr (track_pointers)
+        if (const auto* registry = registry_.load(std::memory_order_acquire))
+          infos.live_pointer_count = detail::count_policy_pointers(*registry);
+      if constexpr (track_histogram)
+        for (std::size_t bin = 0; bin < allocation_size_histogram::bin_count; ++bin)
+          infos.size_histogram.bins[bin] = size_bins_[bin].load(std::memory_order_relaxed);
+      if constexpr (track_timing)
+      {
+        infos.allocation_latency.nanoseconds_per_tick = infos.deallocation_latency.nanoseconds_per_tick = detail::cycle_clock_nanoseconds_per_tick();
+        for (std::size_t bin = 0; bin < latency_histogram::bin_count; ++bin)
+        {
+          infos.allocation_latency.bins[bin]   = allocation_latency_[bin].load(std::memory_order_relaxed);
+          infos.deallocation_latency.bins[bin] = deallocation_latency_[bin].load(std::memory_order_relaxed);
+        }
+      }
+      return infos;
+    }
+
+    std::string_view name() const { return name_; }
+
+  private:
+    using stripes        = std::array<detail::policy_stripe<track_counts, track_bytes>, detail::policy_stripe_count>;
+    using size_bins      = detail::atomic_policy_bins<allocation_size_histogram::bin_count>;
+    using latency_bins   = detail::atomic_policy_bins<latency_histogram::bin_count>;
+    using registry_state = std::atomic<detail::policy_pointer_registry*>;
+
+    static void log_latency(latency_bins& bins, std::uint64_t ticks) { bins[latency_histogram::bin_index(ticks)].fetch_add(1, std::memory_order_relaxed); }
+
+    detail::policy_pointer_registry* get_registry()
+    {
+      if (auto* registry = registry_.load(std::memory_order_acquire))
+        return registry;
+
+      // the registries are never destroyed, the one of the losing thread is simply left unused
+      auto*                            registry = detail::create_policy_pointer_registry();
+      detail::policy_pointer_registry* expected = nullptr;
+      if (registry && !registry_.compare_exchange_strong(expected, registry, std::memory_order_acq_rel))
+        return expected;
+      return registry;
+    }
+
+    std::string_view name_;
+
+    [[no_unique_address]] detail::policy_member<track_counts || track_bytes, stripes, 0>  stripes_{};
+    [[no_unique_address]] detail::policy_member<track_live, std::atomic<std::size_t>, 1> current_memory_used_{};
+    [[no_unique_address]] detail::policy_member<track_live, std::atomic<std::size_t>, 2> peak_memory_used_{};
+    [[no_unique_address]] detail::policy_member<track_pointers, registry_state, 3>      registry_{};
+    [[no_unique_address]] detail::policy_member<track_histogram, size_bins, 4>          size_bins_{};
+    [[no_unique_address]] detail::policy_member<track_timing, latency_bins, 5>          allocation_latency_{};
+    [[no_unique_address]] detail::policy_member<track_timing, latency_bins, 6>          deallocation_latency_{};
+  };
+
+  // Tracker of the global operators defined by MICROBENCH_MEMORY_OVERLOAD_GLOBAL_WITH_POLICY(features)
+  template <tracking_features Features>
+  inline constinit policy_tracker<Features> global_policy_tracker{"global"};
+
+  template <tracking_features Features>
+  policy_memory_informations get_global_policy_snapshot()
+  {
+    return global_policy_tracker<Features>.snapshot();
+  }
+
+  // Snapshot of a class instrumented with MICROBENCH_MEMORY_INSTRUMENT_CLASS_WITH_POLICY
+  template <typename T>
+  policy_memory_informations get_policy_snapshot()
+  {
+    return T::microbench_memory_tracker().snapshot();
+  }
+} // namespace MicrobenchMemory
+
+#define MICROBENCH_MEMORY_DETAIL_POLICY_OPERATORS(prefix, tracker)                                                                                                                 \
+  [[nodiscard]] prefix void* operator new(std::size_t sz) { return tracker.allocate(sz, 0); }                                                                                      \
+  [[nodiscard]] prefix void* operator new(std::size_t count, std::align_val_t al) { return tracker.allocate(count, static_cast<std::size_t>(al)); }                                \
+                                                                                                                                                                                   \
+  [[nodiscard]] prefix void* operator new[](std::size_t count) { return tracker.allocate(count, 0); }                                                                              \
+  [[nodiscard]] prefix void* operator new[](std::size_t count, std::align_val_t al) { return tracker.allocate(count, static_cast<std::size_t>(al)); }                              \
+                                                                                                                                                                                   \
+  [[nodiscard]] prefix void* operator new(std::size_t sz, const std::nothrow_t&) noexcept                                                                                          \
+  {                                                                                                                                                                                \
+    return MicrobenchMemory::detail::nothrow_new([&] { return tracker.allocate(sz, 0); });                                                                                         \
+  }                                                                                                                                                                                \
+  [[nodiscard]] prefix void* operator new(std::size_t count, std::align_val_t al, const std::nothrow_t&) noexcept                                                                  \
+  {                                                                                                                                                                                \
+    return MicrobenchMemory::detail::nothrow_new([&] { return tracker.allocate(count, static_cast<std::size_t>(al)); });                                                           \
+  }                                                                                                                                                                                \
+  [[nodiscard]] prefix void* operator new[](std::size_t count, const std::nothrow_t&) noexcept                                                                                     \
+  {                                                                                                                                                                                \
+    return MicrobenchMemory::detail::nothrow_new([&] { return tracker.allocate(count, 0); });                                                                                      \
+  }                                                                                                                                                                                \
+  [[nodiscard]] prefix void* operator new[](std::size_t count, std::align_val_t al, const std::nothrow_t&) noexcept                                                                \
+  {                                                                                                                                                                                \
+    return MicrobenchMemory::detail::nothrow_new([&] { return tracker.allocate(count, static_cast<std::size_t>(al)); });                                                           \
+  }                                                                                                                                                                                \
+                                                                                                                                                                                   \
+  prefix void operator delete(void* ptr) noexcept { tracker.deallocate(ptr, 0); }                                                                                                  \
+  prefix void operator delete(void* ptr, std::align_val_t al) noexcept { tracker.deallocate(ptr, static_cast<std::size_t>(al)); }                                                  \
+  prefix void operator delete(void* ptr, [[maybe_unused]] std::size_t sz) noexcept { tracker.deallocate(ptr, 0); }                                                                 \
+  prefix void operator delete(void* ptr, [[maybe_unused]] std::size_t sz, std::align_val_t al) noexcept { tracker.deallocate(ptr, static_cast<std::size_t>(al)); }                 \
+                                                                                                                                                                                   \
+  prefix void operator delete[](void* ptr) noexcept { tracker.deallocate(ptr, 0); }                                                                                                \
+  prefix void operator delete[](void* ptr, std::align_val_t al) noexcept { tracker.deallocate(ptr, static_cast<std::size_t>(al)); }                                                \
+  prefix void operator delete[](void* ptr, [[maybe_unused]] std::size_t sz) noexcept { tracker.deallocate(ptr, 0); }                                                               \
+  prefix void operator delete[](void* ptr, [[maybe_unused]] std::size_t sz, std::align_val_t al) noexcept { tracker.deallocate(ptr, static_cast<std::size_t>(al)); }               \
+                                                                                                                                                                                   \
+  prefix void operator delete(void* ptr, const std::nothrow_t&) noexcept { tracker.deallocate(ptr, 0); }                                                                           \
+  prefix void operator delete(void* ptr, std::align_val_t al, const std::nothrow_t&) noexcept { tracker.deallocate(ptr, static_cast<std::size_t>(al)); }                           \
+  prefix void operator delete[](void* ptr, const std::nothrow_t&) noexcept { tracker.deallocate(ptr, 0); }                                                                         \
+  prefix void operator delete[](void* ptr, std::align_val_t al, const std::nothrow_t&) noexcept { tracker.deallocate(ptr, static_cast<std::size_t>(al)); }
+
+// Replaces MICROBENCH_MEMORY_OVERLOAD_GLOBAL(): features is a MicrobenchMemory::tracking_features constant
+// The counters are read with get_global_policy_snapshot<features>()
+#define MICROBENCH_MEMORY_OVERLOAD_GLOBAL_WITH_POLICY(features) MICROBENCH_MEMORY_DETAIL_POLICY_OPERATORS(, MicrobenchMemory::global_policy_tracker<features>)
+
+// Insert inside a class declaration, in place of MICROBENCH_MEMORY_INSTRUMENT_CLASS
+// The counters are read with get_policy_snapshot<class>()
+#define MICROBENCH_MEMORY_INSTRUMENT_CLASS_WITH_POLICY(class_name, features)                                                                                                       \
+  static MicrobenchMemory::policy_tracker<features>& microbench_memory_tracker()                                                                                                   \
+  {                                                                                                                                                                                \
+    static constinit MicrobenchMemory::policy_tracker<features> tracker{class_name};                                                                                               \
+    return tracker;                                                                                                                                                                \
+  }                                                                                                                                                                                \
+  MICROBENCH_MEMORY_DETAIL_POLICY_OPERATORS(static, microbench_memory_tracker())
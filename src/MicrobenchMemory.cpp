@@ -1,198 +1,706 @@
 #include "MicrobenchMemory/MicrobenchMemory.hpp"
-
+#include "MicrobenchMemory/cycle_clock.hpp"
+#include "MicrobenchMemory/memory_resource.hpp"
+#include "MicrobenchMemory/tracking_policy.hpp"
+
+#include "detail/allocation_header.hpp"
+#include "detail/bump_arena.hpp"
+#include "detail/byte_sampler.hpp"
+#include "detail/object_pool.hpp"
+#include "detail/page_allocator.hpp"
+#include "detail/pointer_table.hpp"
+#include "detail/resident_memory.hpp"
+#include "detail/size_class_pool.hpp"
+#include "detail/snapshot_sequence.hpp"
+#include "detail/stack_trie.hpp"
+#include "detail/time_series.hpp"
+#include "detail/trace_ring.hpp"
+#include "detail/unwinder.hpp"
+#include "detail/vanilla_allocator.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <bit>
+#include <cassert>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
 #include <cstdio>
 #include <cstdlib>
+#include <condition_variable>
+#include <cstring>
 #include <map>
+#include <mutex>
 #include <new>
 #include <stdexcept>
+#include <string>
 #include <string_view>
-#include <vector>
-
-using namespace std::literals;
 
-// As of MSVC 19.29 (VS 16.11)
-// std::aligned_alloc is a compiler intrinsic instead of a standard function
-#ifdef _MSC_VER
-namespace std
-{
-  void* aligned_alloc(std::size_t alignment, std::size_t size) { return _aligned_malloc(size, alignment); }
-} // namespace std
+#ifndef _WIN32
+#include <pthread.h>
 #endif
 
-// As of apple clang, aligned_alloc is not part of std
-// Simply pulling the c function from stdlib.h into the std namespace here
-#ifdef __APPLE__
-namespace std
-{
-  using ::aligned_alloc;
-}
-#endif
+using namespace std::literals;
 
 namespace MicrobenchMemory
 {
   namespace detail
   {
+    // size histograms are opt-in: when disabled, the hot path only pays for this load
+    static std::atomic<bool> size_histogram_enabled{false};
+
+    using atomic_size_bins = std::array<std::atomic<std::uint64_t>, allocation_size_histogram::bin_count>;
+
+    static void log_size(atomic_size_bins& bins, std::size_t sz)
+    {
+      if (size_histogram_enabled.load(std::memory_order_relaxed))
+        bins[allocation_size_histogram::bin_index(sz)].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    static void load_size_bins(const atomic_size_bins& bins, allocation_size_histogram& histogram)
+    {
+      for (std::size_t i = 0; i < allocation_size_histogram::bin_count; ++i)
+        histogram.bins[i] = bins[i].load(std::memory_order_relaxed);
+    }
+
+    // the sampling interval in bytes, 0 records every allocation
+    static std::atomic<std::size_t> sampling_interval{0};
+
+    static bool sample_allocation(std::size_t sz, std::size_t interval)
+    {
+      thread_local byte_sampler sampler;
+      return sampler.sample(sz, interval);
+    }
+
+    static std::atomic<backtrace_mode> backtrace_capture{backtrace_mode::disabled};
+
+    static stack_trie& get_stack_trie()
+    {
+      // never destroyed: allocations may still be captured during the static destruction
+      static auto* trie = new (vanilla_allocator<stack_trie>{}.allocate(1)) stack_trie{};
+      return *trie;
+    }
+
+    static void record_allocation_site(std::size_t sz, double weight)
+    {
+      std::array<void*, max_allocation_site_depth> frames;
+      auto                                         depth = capture_backtrace(frames.data(), frames.size());
+      auto&                                        trie  = get_stack_trie();
+      trie.record(trie.insert(frames.data(), depth), static_cast<std::uint64_t>(std::llround(weight)), static_cast<std::uint64_t>(std::llround(weight * static_cast<double>(sz))));
+    }
+
     /*
-    scoped memory allocator, doesn't work on global level
+    captures the call stack of the allocation if the backtrace mode asks for it
+    `sampled` tells whether the sampler already selected the allocation, with the given interval
     */
-    struct internal_ptr_infos
+    static void log_allocation_site(std::size_t sz, std::size_t interval, bool sampled)
     {
-      std::size_t size  = 0;
-      bool        freed = false;
-    };
+      auto mode = backtrace_capture.load(std::memory_order_relaxed);
+      if (mode == backtrace_mode::all)
+        record_allocation_site(sz, 1.);
+      else if (mode == backtrace_mode::sampled && sampled)
+        record_allocation_site(sz, 1. / byte_sampler::probability(sz, interval));
+    }
 
-    template <typename T>
-    struct vanilla_allocator : std::allocator<T>
+    static void log_global_allocation_site(std::size_t sz)
     {
-      using value_type                             = typename std::allocator<T>::value_type;
-      using size_type                              = typename std::allocator<T>::size_type;
-      using difference_type                        = typename std::allocator<T>::difference_type;
-      using propagate_on_container_move_assignment = typename std::allocator<T>::propagate_on_container_move_assignment;
+      auto mode = backtrace_capture.load(std::memory_order_relaxed);
+      if (mode == backtrace_mode::disabled)
+        return;
 
-      vanilla_allocator() {}
+      // the global counters are exact, the sampler is only run when the sites are sampled
+      auto interval = sampling_interval.load(std::memory_order_relaxed);
+      log_allocation_site(sz, interval, mode == backtrace_mode::sampled && (interval == 0 || sample_allocation(sz, interval)));
+    }
 
-      template <typename U>
-      vanilla_allocator(const vanilla_allocator<U>& u)
-        : std::allocator<T>(u)
+    /*
+    running horvitz-thompson estimate: each sampled allocation stands for 1 / p allocations, p being its probability
+    to be sampled, and contributes (1 - p) / p^2 to the variance of the estimated count
+    */
+    class atomic_memory_estimate
+    {
+    public:
+      void add(double value, double weight)
       {
+        value_.fetch_add(value * weight, std::memory_order_relaxed);
+        variance_.fetch_add(value * value * (weight * weight - weight), std::memory_order_relaxed);
       }
 
-      [[nodiscard]] constexpr T* allocate(size_type size)
+      memory_estimate load() const { return {value_.load(std::memory_order_relaxed), variance_.load(std::memory_order_relaxed)}; }
+
+    private:
+      std::atomic<double> value_{0};
+      std::atomic<double> variance_{0};
+    };
+
+    static void update_peak(std::atomic<std::int64_t>& peak, std::int64_t value)
+    {
+      auto current = peak.load(std::memory_order_relaxed);
+      while (current < value && !peak.compare_exchange_weak(current, value, std::memory_order_relaxed))
       {
-        void* p = std::malloc(size * sizeof(T));
-        if (!p)
-          throw std::bad_alloc();
-        return static_cast<T*>(p);
       }
+    }
+
+    /*
+    the counters updated on the hot path are spread over cache-line-padded slots, one per thread, see counter_shard
+    */
+    inline constexpr std::size_t cache_line_size     = 64;
+    inline constexpr std::size_t counter_shard_count = 128;
+
+    static std::size_t current_counter_shard_index()
+    {
+      // threads are assigned a slot round-robin on first use, the slot is kept for the thread lifetime
+      static std::atomic<std::size_t> next_shard_index{0};
+      thread_local std::size_t        shard_index = next_shard_index.fetch_add(1, std::memory_order_relaxed) % counter_shard_count;
+      return shard_index;
+    }
+
+    /*
+    the counters of a scope are striped the same way, over fewer slots: the threads allocating in the same scope rarely
+    share a stripe, so they don't contend and the snapshots find quiet moments to read each stripe
+    */
+    inline constexpr std::size_t scope_stripe_count = 16;
+
+    struct alignas(cache_line_size) scope_stripe
+    {
+      std::atomic<std::size_t> allocation_count{0};
+      std::atomic<std::size_t> deallocation_count{0};
+      std::atomic<std::size_t> total_memory_allocated{0};
+      std::atomic<std::size_t> total_memory_deallocated{0};
+      snapshot_sequence        sequence;
+    };
+
+    struct scope_counters
+    {
+      std::size_t allocation_count         = 0;
+      std::size_t deallocation_count       = 0;
+      std::size_t total_memory_allocated   = 0;
+      std::size_t total_memory_deallocated = 0;
+    };
+
+    [[noreturn]] static void throw_invalid_free(void* ptr)
+    {
+      char buff[256];
+      std::snprintf(buff, 256, "Attempting to free address <%p> which was not allocated or was already freed.", ptr);
+      throw std::runtime_error(buff);
+    }
+
+    // calibration of the cycle clock, done once by the first timing or profiling enabled
+    static std::atomic<double> nanoseconds_per_tick{0.};
+
+    double cycle_clock_nanoseconds_per_tick()
+    {
+      static std::once_flag calibration;
+      std::call_once(calibration, [] { nanoseconds_per_tick.store(calibrate_cycle_clock(), std::memory_order_release); });
+      return nanoseconds_per_tick.load(std::memory_order_acquire);
+    }
+
+    /*
+    allocation lifetimes
+    a profiled pointer keeps when and by which thread it was allocated, along with the number of profiled allocations and
+    of live profiled pointers of that thread at that time; its deallocation by the same thread compares them with the
+    current ones: the allocations in between, and whether the thread got back to the live pointers it had, like a stack
+    */
+    static std::atomic<bool> lifetime_profiling_enabled{false};
+
+    struct lifetime_thread_state
+    {
+      std::uint32_t id               = 0; // assigned on the first profiled allocation of the thread
+      std::uint32_t live_count       = 0;
+      std::uint64_t allocation_count = 0;
+    };
+
+    static lifetime_thread_state& current_lifetime_thread()
+    {
+      static std::atomic<std::uint32_t> next_thread_id{1};
+      thread_local lifetime_thread_state state;
+      if (state.id == 0)
+        state.id = next_thread_id.fetch_add(1, std::memory_order_relaxed);
+      return state;
+    }
 
-      constexpr void deallocate(T* p, size_type) { std::free(p); }
+    struct lifetime_bins
+    {
+      std::array<std::atomic<std::uint64_t>, latency_histogram::bin_count> durations;
+      std::array<std::atomic<std::uint64_t>, latency_histogram::bin_count> allocations;
+      std::atomic<std::size_t>                                             lifo_count;
+      std::atomic<std::size_t>                                             same_thread_count;
+      std::atomic<std::size_t>                                             cross_thread_count;
     };
 
+    /*
+    scoped memory allocator, doesn't work on global level
+    */
     class internal_memory_information
     {
     public:
-      internal_memory_information()
-        : allocation_count_(0)
-        , deallocation_count_(0)
-        , total_memory_allocated_(0)
-        , total_memory_deallocated_(0)
-        , memory_info_{}
+      internal_memory_information() = default;
+
+      internal_memory_information(const internal_memory_information&)            = delete;
+      internal_memory_information& operator=(const internal_memory_information&) = delete;
+
+      ~internal_memory_information() { deallocate_pages(lifetimes_.load(std::memory_order_relaxed), sizeof(lifetime_bins)); }
+
+      void log_alloc(void* ptr, std::size_t sz, std::size_t interval)
       {
+        internal_ptr_infos infos{sz, interval};
+        auto*              thread = lifetime_profiling_enabled.load(std::memory_order_relaxed) ? &current_lifetime_thread() : nullptr;
+        if (thread)
+        {
+          infos.allocation_ticks        = read_cycle_clock();
+          infos.thread_allocation_index = thread->allocation_count;
+          infos.thread                  = thread->id;
+          infos.thread_live_count       = thread->live_count;
+        }
+
+        if (!memory_info_.insert(ptr, infos))
+          throw std::bad_alloc{};
+
+        if (thread)
+        {
+          ++thread->allocation_count;
+          ++thread->live_count;
+        }
+
+        // log the information
+        auto& stripe = current_stripe();
+        stripe.sequence.begin_update();
+        stripe.allocation_count.fetch_add(1, std::memory_order_relaxed);
+        stripe.total_memory_allocated.fetch_add(sz, std::memory_order_relaxed);
+        stripe.sequence.end_update();
+
+        auto weight = 1. / byte_sampler::probability(sz, interval);
+        estimated_allocation_count_.add(1., weight);
+        estimated_memory_allocated_.add(static_cast<double>(sz), weight);
+
+        auto sdz = static_cast<std::int64_t>(sz);
+        update_peak(peak_memory_used_, current_memory_used_.fetch_add(sdz, std::memory_order_relaxed) + sdz);
+        log_size(size_bins_, sz);
       }
 
-      void log_alloc(void* ptr, std::size_t sz)
+      void log_dealloc(void* ptr)
       {
+        auto ptr_info = memory_info_.erase(ptr);
+
+        // free non-allocated address or double-free detection
+        if (!ptr_info)
+          throw_invalid_free(ptr);
+
         // log the information
-        ++allocation_count_;
-        total_memory_allocated_ += sz;
-        memory_info_.emplace(ptr, internal_ptr_infos{sz, false});
+        auto& stripe = current_stripe();
+        stripe.sequence.begin_update();
+        stripe.deallocation_count.fetch_add(1, std::memory_order_relaxed);
+        stripe.total_memory_deallocated.fetch_add(ptr_info->size, std::memory_order_relaxed);
+        stripe.sequence.end_update();
+
+        // the pointer is weighted as it was when sampled, whatever the current sampling interval is
+        auto weight = 1. / byte_sampler::probability(ptr_info->size, ptr_info->sampling_interval);
+        estimated_deallocation_count_.add(1., weight);
+        estimated_memory_deallocated_.add(static_cast<double>(ptr_info->size), weight);
+
+        current_memory_used_.fetch_sub(static_cast<std::int64_t>(ptr_info->size), std::memory_order_relaxed);
+
+        if (ptr_info->thread != 0)
+          log_lifetime(*ptr_info);
       }
 
-      void log_dealloc(void* ptr)
+      void reset_peak() { peak_memory_used_.store(current_memory_used_.load(std::memory_order_relaxed), std::memory_order_relaxed); }
+
+      // Streams the live pointers by batches, see MicrobenchMemory::get_leaked_pointers
+      std::size_t list_ptr_leaked(leaked_pointer* pointers, std::size_t count, std::size_t& cursor) const
+      {
+        return memory_info_.for_each_from(cursor, count, [&pointers](void* ptr, const internal_ptr_infos& infos) { *pointers++ = {ptr, infos.size}; });
+      }
+
+      bool has_memory_leak() const
+      {
+        auto counters = load_counters();
+        return counters.allocation_count != counters.deallocation_count || counters.total_memory_allocated != counters.total_memory_deallocated;
+      }
+      std::size_t count_memory_leaked() const
+      {
+        auto counters = load_counters();
+        return counters.total_memory_allocated - counters.total_memory_deallocated;
+      }
+      // Every counted allocation is in the pointer table until its deallocation is counted
+      std::size_t count_ptr_leaked() const
+      {
+        auto counters = load_counters();
+        return counters.allocation_count - counters.deallocation_count;
+      }
+
+      /*
+      Fills infos without blocking the updates. The counters are all read at the same point of the updates, the peak, the
+      estimates and the size histogram are read right after them.
+      */
+      void to_user_info(std::string_view scope, scoped_memory_informations& infos) const
+      {
+        auto counters = load_counters();
+        infos         = {counters.allocation_count,
+                         counters.deallocation_count,
+                         counters.total_memory_allocated,
+                         counters.total_memory_deallocated,
+                         counters.allocation_count - counters.deallocation_count,
+                         scope,
+                         static_cast<std::size_t>(peak_memory_used_.load(std::memory_order_relaxed)),
+                         {},
+                         {sampling_interval.load(std::memory_order_relaxed),
+                          estimated_allocation_count_.load(),
+                          estimated_deallocation_count_.load(),
+                          estimated_memory_allocated_.load(),
+                          estimated_memory_deallocated_.load()}};
+        load_size_bins(size_bins_, infos.size_histogram);
+      }
+
+      scoped_memory_informations to_user_info(std::string_view scope) const
+      {
+        scoped_memory_informations infos;
+        to_user_info(scope, infos);
+        return infos;
+      }
+
+      allocation_lifetimes load_lifetimes() const
       {
-        // free non-allocated address detection
-        if (!memory_info_.contains(ptr))
+        allocation_lifetimes lifetimes{};
+        lifetimes.durations.nanoseconds_per_tick   = nanoseconds_per_tick.load(std::memory_order_acquire);
+        lifetimes.allocations.nanoseconds_per_tick = 1.;
+
+        const auto* bins = lifetimes_.load(std::memory_order_acquire);
+        if (!bins)
+          return lifetimes;
+        for (std::size_t bin = 0; bin < latency_histogram::bin_count; ++bin)
         {
-          char buff[256];
-          std::snprintf(buff, 256, "Attempting to free address <%p> which was not allocated.", ptr);
-          throw std::runtime_error(buff);
+          lifetimes.durations.bins[bin]   = bins->durations[bin].load(std::memory_order_relaxed);
+          lifetimes.allocations.bins[bin] = bins->allocations[bin].load(std::memory_order_relaxed);
         }
+        lifetimes.lifo_count         = bins->lifo_count.load(std::memory_order_relaxed);
+        lifetimes.same_thread_count  = bins->same_thread_count.load(std::memory_order_relaxed);
+        lifetimes.cross_thread_count = bins->cross_thread_count.load(std::memory_order_relaxed);
+        return lifetimes;
+      }
 
-        auto& ptr_info = memory_info_[ptr];
+    private:
+      scope_stripe& current_stripe() { return stripes_[current_counter_shard_index() % scope_stripe_count]; }
 
-        // double-free detection
-        if (ptr_info.freed)
+      // The histograms are allocated from the private memory when the first profiled pointer of the scope is freed
+      lifetime_bins* get_lifetime_bins()
+      {
+        if (auto* bins = lifetimes_.load(std::memory_order_acquire))
+          return bins;
+
+        auto* bins = static_cast<lifetime_bins*>(allocate_pages(sizeof(lifetime_bins)));
+        if (!bins)
+          return nullptr;
+        lifetime_bins* expected = nullptr;
+        if (!lifetimes_.compare_exchange_strong(expected, bins, std::memory_order_acq_rel))
         {
-          char buff[256];
-          std::snprintf(buff, 256, "Double free on address <%p>..", ptr);
-          throw std::runtime_error(buff);
+          deallocate_pages(bins, sizeof(lifetime_bins));
+          return expected;
         }
+        return bins;
+      }
 
-        // log the information
-        ++deallocation_count_;
-        total_memory_deallocated_ += ptr_info.size;
+      void log_lifetime(const internal_ptr_infos& infos)
+      {
+        auto  now    = read_cycle_clock();
+        auto& thread = current_lifetime_thread();
+        bool  same   = infos.thread == thread.id;
+        bool  lifo   = same && thread.live_count == infos.thread_live_count + 1;
+        if (same)
+          --thread.live_count;
+
+        auto* bins = get_lifetime_bins();
+        if (!bins)
+          return;
+        // the cycle counters of two cores may be slightly apart
+        bins->durations[latency_histogram::bin_index(now > infos.allocation_ticks ? now - infos.allocation_ticks : 0)].fetch_add(1, std::memory_order_relaxed);
+        if (same)
+          bins->allocations[latency_histogram::bin_index(thread.allocation_count - infos.thread_allocation_index - 1)].fetch_add(1, std::memory_order_relaxed);
+        (lifo ? bins->lifo_count : same ? bins->same_thread_count : bins->cross_thread_count).fetch_add(1, std::memory_order_relaxed);
       }
 
-      auto list_ptr_leaked() const
+      /*
+      each stripe is read at a single point of its updates, the deallocations of all the stripes before the allocations:
+      a pointer is always counted as allocated before it is counted as freed, possibly on another stripe, so the result
+      never counts a deallocation without its allocation
+      */
+      scope_counters load_counters() const
       {
-        std::vector<void*, vanilla_allocator<void*>> ptrs;
-        for (auto [ptr, infos] : memory_info_)
-          if (!infos.freed)
-            ptrs.push_back(ptr);
-        return ptrs;
+        scope_counters counters;
+        for (const auto& stripe : stripes_)
+        {
+          std::size_t deallocation_count = 0, total_memory_deallocated = 0;
+          stripe.sequence.read([&] {
+            deallocation_count       = stripe.deallocation_count.load(std::memory_order_relaxed);
+            total_memory_deallocated = stripe.total_memory_deallocated.load(std::memory_order_relaxed);
+          });
+          counters.deallocation_count += deallocation_count;
+          counters.total_memory_deallocated += total_memory_deallocated;
+        }
+
+        for (const auto& stripe : stripes_)
+        {
+          std::size_t allocation_count = 0, total_memory_allocated = 0;
+          stripe.sequence.read([&] {
+            allocation_count       = stripe.allocation_count.load(std::memory_order_relaxed);
+            total_memory_allocated = stripe.total_memory_allocated.load(std::memory_order_relaxed);
+          });
+          counters.allocation_count += allocation_count;
+          counters.total_memory_allocated += total_memory_allocated;
+        }
+        return counters;
       }
 
-      bool        has_memory_leak() const { return allocation_count_ != deallocation_count_ || total_memory_allocated_ != total_memory_deallocated_; }
-      std::size_t count_memory_leaked() const { return total_memory_allocated_ - total_memory_deallocated_; }
-      std::size_t count_ptr_leaked() const { return list_ptr_leaked().size(); }
+      std::array<scope_stripe, scope_stripe_count> stripes_{};
+      alignas(cache_line_size) std::atomic<std::int64_t> current_memory_used_{0};
+      std::atomic<std::int64_t>                          peak_memory_used_{0};
+      atomic_size_bins                                   size_bins_{};
+      atomic_memory_estimate                             estimated_allocation_count_;
+      atomic_memory_estimate                             estimated_deallocation_count_;
+      atomic_memory_estimate                             estimated_memory_allocated_;
+      atomic_memory_estimate                             estimated_memory_deallocated_;
+      pointer_table                                      memory_info_;
+      std::atomic<lifetime_bins*>                        lifetimes_{nullptr};
+    };
+
+    /*
+    registry of the instrumented scopes
+    each scope name is interned once to a dense identifier, the instrumented operators then index the scopes directly
+    the name lookup and the registration are the slow path, they are serialized by a mutex
 
-      scoped_memory_informations to_user_info(std::string_view scope) const
+    the scopes are never destroyed so that deallocations happening during the static destruction are still accounted
+    */
+    inline constexpr std::size_t max_scope_count = 4096;
+
+    // Slack of the allocations measured by the slack tracking, see allocation_slack
+    struct slack_counters
+    {
+      std::atomic<std::size_t> allocation_count{0};
+      std::atomic<std::size_t> requested_bytes{0};
+      std::atomic<std::size_t> usable_bytes{0};
+      std::atomic<std::size_t> padding_bytes{0};
+      std::atomic<std::size_t> live_requested_bytes{0};
+      std::atomic<std::size_t> live_usable_bytes{0};
+
+      void log_allocation(std::size_t requested, std::size_t usable, std::size_t padding)
       {
-        return {allocation_count_, deallocation_count_, total_memory_allocated_, total_memory_deallocated_, count_ptr_leaked(), scope};
+        allocation_count.fetch_add(1, std::memory_order_relaxed);
+        requested_bytes.fetch_add(requested, std::memory_order_relaxed);
+        usable_bytes.fetch_add(usable, std::memory_order_relaxed);
+        padding_bytes.fetch_add(padding, std::memory_order_relaxed);
+        live_requested_bytes.fetch_add(requested, std::memory_order_relaxed);
+        live_usable_bytes.fetch_add(usable, std::memory_order_relaxed);
       }
 
-    private:
-      std::size_t                                                                                                          allocation_count_;
-      std::size_t                                                                                                          deallocation_count_;
-      std::size_t                                                                                                          total_memory_allocated_;
-      std::size_t                                                                                                          total_memory_deallocated_;
-      std::map<void*, internal_ptr_infos, std::less<void*>, vanilla_allocator<std::pair<void* const, internal_ptr_infos>>> memory_info_;
+      void log_deallocation(std::size_t requested, std::size_t usable)
+      {
+        live_requested_bytes.fetch_sub(requested, std::memory_order_relaxed);
+        live_usable_bytes.fetch_sub(usable, std::memory_order_relaxed);
+      }
+
+      allocation_slack load() const
+      {
+        return {allocation_count.load(std::memory_order_relaxed),     requested_bytes.load(std::memory_order_relaxed),
+                usable_bytes.load(std::memory_order_relaxed),         padding_bytes.load(std::memory_order_relaxed),
+                live_requested_bytes.load(std::memory_order_relaxed), live_usable_bytes.load(std::memory_order_relaxed)};
+      }
     };
 
-    using scoped_memory_information_storage_t =
-        std::map<std::string_view, internal_memory_information, std::less<std::string_view>, vanilla_allocator<std::pair<const std::string_view, internal_memory_information>>>;
+    struct scope_entry
+    {
+      std::basic_string<char, std::char_traits<char>, vanilla_allocator<char>> name;
+      internal_memory_information                                              infos;
+      std::atomic<std::uint32_t>                                               pool_index{0}; // object pool index + 1, 0 until the first pooled allocation
+      slack_counters                                                           slack;
+    };
 
-    static scoped_memory_information_storage_t& get_all_scoped_memory_information()
+    // constant-initialized: reading it never goes through a static initialization guard
+    static std::array<std::atomic<scope_entry*>, max_scope_count> scope_entries{};
+
+    struct scope_registry
     {
-      static scoped_memory_information_storage_t memory_informations{};
-      return memory_informations;
-    }
+      std::mutex                                                                                                        mutex;
+      std::map<std::string_view, scope_id, std::less<>, vanilla_allocator<std::pair<const std::string_view, scope_id>>> ids;
+    };
 
-    static void log_scoped_memory_allocation(std::string_view scope, void* ptr, std::size_t sz)
+    static scope_registry& get_scope_registry()
     {
-      auto& minfo_map = get_all_scoped_memory_information();
-      minfo_map.try_emplace(scope, internal_memory_information{});
-      minfo_map[scope].log_alloc(ptr, sz);
+      static auto* registry = new (vanilla_allocator<scope_registry>{}.allocate(1)) scope_registry{};
+      return *registry;
     }
 
-    static void log_scoped_memory_deallocation(std::string_view scope, void* ptr)
+    scope_id register_scope(std::string_view scope)
     {
-      auto& minfo_map = get_all_scoped_memory_information();
-      minfo_map.try_emplace(scope, internal_memory_information{});
-      minfo_map[scope].log_dealloc(ptr);
+      auto&            registry = get_scope_registry();
+      std::scoped_lock lock{registry.mutex};
+
+      if (auto it = registry.ids.find(scope); it != registry.ids.end())
+        return it->second;
+
+      // identifiers start at 1, 0 is kept for the scopes not registered yet
+      auto id = registry.ids.size() + 1;
+      if (id >= max_scope_count)
+        throw std::length_error("MicrobenchMemory: too many instrumented scopes.");
+
+      // the page allocator keeps the counter stripes aligned on their cache lines
+      auto* storage = allocate_pages(sizeof(scope_entry));
+      if (!storage)
+        throw std::bad_alloc{};
+      auto* entry = new (storage) scope_entry{};
+      entry->name.assign(scope);
+      scope_entries[id].store(entry, std::memory_order_release);
+
+      auto interned_id = static_cast<scope_id>(id);
+      registry.ids.emplace(entry->name, interned_id);
+      return interned_id;
     }
 
+    static scope_entry& get_scope(scope_id scope) { return *scope_entries[scope].load(std::memory_order_acquire); }
+
+    static void log_scoped_memory_allocation(scope_id scope, void* ptr, std::size_t sz, std::size_t interval) { get_scope(scope).infos.log_alloc(ptr, sz, interval); }
+
+    static void log_scoped_memory_deallocation(scope_id scope, void* ptr) { get_scope(scope).infos.log_dealloc(ptr); }
+
+    /*
+    global memory counters, sharded per thread
+    each thread bumps its own cache-line-padded slot so that concurrent allocations never contend on the same cache line
+    the slots are aggregated on demand when a snapshot is requested
+
+    the peak memory usage needs a global view: each slot accumulates its net memory usage in a pending delta, along with
+    the highest value this delta reached, and folds them into the global live memory and peak once the delta grows past
+    a threshold
+    when a single thread allocates, the peak is exact; with concurrent threads it is within one threshold per thread
+    */
+    inline constexpr std::int64_t pending_memory_flush_bytes = 64 * 1024;
+
+    struct alignas(cache_line_size) counter_shard
+    {
+      std::atomic<std::size_t>  allocation_count{0};
+      std::atomic<std::size_t>  deallocation_count{0};
+      std::atomic<std::size_t>  total_memory_allocated{0};
+      std::atomic<std::size_t>  total_memory_deallocated{0};
+      std::atomic<std::int64_t> pending_memory_used{0};
+      std::atomic<std::int64_t> pending_peak_memory_used{0};
+      snapshot_sequence         sequence;
+      atomic_size_bins          size_bins{};
+    };
+
     class light_internal_memory_information
     {
     public:
-      light_internal_memory_information()
-        : allocation_count_(0)
-        , deallocation_count_(0)
-        , total_memory_allocated_(0)
-      {
-      }
+      constexpr light_internal_memory_information() = default;
 
       void log_alloc([[maybe_unused]] void* ptr, std::size_t sz)
       {
         // log the information
-        ++allocation_count_;
-        total_memory_allocated_ += sz;
+        auto& shard = current_shard();
+        shard.sequence.begin_update();
+        shard.allocation_count.fetch_add(1, std::memory_order_relaxed);
+        shard.total_memory_allocated.fetch_add(sz, std::memory_order_relaxed);
+        log_memory_used(shard, static_cast<std::int64_t>(sz));
+        log_size(shard.size_bins, sz);
+        shard.sequence.end_update();
       }
 
-      void log_dealloc([[maybe_unused]] void* ptr)
+      void log_dealloc([[maybe_unused]] void* ptr, std::size_t sz)
       {
         // log the information
-        ++deallocation_count_;
+        auto& shard = current_shard();
+        shard.sequence.begin_update();
+        shard.deallocation_count.fetch_add(1, std::memory_order_relaxed);
+        shard.total_memory_deallocated.fetch_add(sz, std::memory_order_relaxed);
+        log_memory_used(shard, -static_cast<std::int64_t>(sz));
+        shard.sequence.end_update();
+      }
+
+      void reset_peak()
+      {
+        std::int64_t live = memory_used_.load(std::memory_order_relaxed);
+        for (auto& shard : shards_)
+        {
+          shard.sequence.begin_update();
+          auto pending = shard.pending_memory_used.load(std::memory_order_relaxed);
+          shard.pending_peak_memory_used.store(pending, std::memory_order_relaxed);
+          shard.sequence.end_update();
+          live += pending;
+        }
+        peak_memory_used_.store(live, std::memory_order_relaxed);
       }
 
-      bool has_memory_leak() const { return allocation_count_ != deallocation_count_; }
+      bool has_memory_leak() const { return to_user_info().has_memory_leak(); }
+
+      global_memory_informations to_user_info() const
+      {
+        global_memory_informations infos{0, 0, 0, 0, 0, {}};
+        allocation_size_histogram  shard_size_histogram{};
+        std::int64_t               pending_memory_used       = 0;
+        std::int64_t               pending_peak_over_current = 0;
+
+        /*
+        each shard is read at a single point of its updates
+        the deallocations of all the shards are read before the allocations: a block can be freed on a shard other than
+        the one of its allocation, but its allocation is always counted before its deallocation, so the snapshot never
+        counts a deallocation without its allocation
+        */
+        for (const auto& shard : shards_)
+        {
+          std::size_t deallocation_count = 0, total_memory_deallocated = 0;
+          shard.sequence.read([&] {
+            deallocation_count       = shard.deallocation_count.load(std::memory_order_relaxed);
+            total_memory_deallocated = shard.total_memory_deallocated.load(std::memory_order_relaxed);
+          });
+          infos.deallocation_count += deallocation_count;
+          infos.total_memory_deallocated += total_memory_deallocated;
+        }
+
+        for (const auto& shard : shards_)
+        {
+          std::size_t  allocation_count = 0, total_memory_allocated = 0;
+          std::int64_t pending = 0, pending_peak = 0;
+          shard.sequence.read([&] {
+            allocation_count       = shard.allocation_count.load(std::memory_order_relaxed);
+            total_memory_allocated = shard.total_memory_allocated.load(std::memory_order_relaxed);
+            pending                = shard.pending_memory_used.load(std::memory_order_relaxed);
+            pending_peak           = shard.pending_peak_memory_used.load(std::memory_order_relaxed);
+            load_size_bins(shard.size_bins, shard_size_histogram);
+          });
+          infos.size_histogram += shard_size_histogram;
+          infos.allocation_count += allocation_count;
+          infos.total_memory_allocated += total_memory_allocated;
+
+          pending_memory_used += pending;
+          pending_peak_over_current = std::max(pending_peak_over_current, pending_peak - pending);
+        }
 
-      global_memory_informations to_user_info() const { return {allocation_count_, deallocation_count_, total_memory_allocated_}; }
+        // the highest point reached since the last fold is when one of the slots was at its own peak
+        auto peak = std::max(peak_memory_used_.load(std::memory_order_relaxed), memory_used_.load(std::memory_order_relaxed) + pending_memory_used + pending_peak_over_current);
+        infos.peak_memory_used = static_cast<std::size_t>(std::max(peak, std::int64_t{0}));
+        return infos;
+      }
 
     private:
-      std::size_t allocation_count_;
-      std::size_t deallocation_count_;
-      std::size_t total_memory_allocated_;
+      counter_shard& current_shard() { return shards_[current_counter_shard_index()]; }
+
+      void log_memory_used(counter_shard& shard, std::int64_t delta)
+      {
+        auto pending = shard.pending_memory_used.fetch_add(delta, std::memory_order_relaxed) + delta;
+        if (pending > shard.pending_peak_memory_used.load(std::memory_order_relaxed))
+          shard.pending_peak_memory_used.store(pending, std::memory_order_relaxed);
+
+        if (pending >= pending_memory_flush_bytes || pending <= -pending_memory_flush_bytes)
+        {
+          // fold the pending delta and its peak into the global view
+          auto pending_memory_used = shard.pending_memory_used.exchange(0, std::memory_order_relaxed);
+          auto pending_peak        = shard.pending_peak_memory_used.exchange(0, std::memory_order_relaxed);
+          auto memory_used         = memory_used_.fetch_add(pending_memory_used, std::memory_order_relaxed);
+          update_peak(peak_memory_used_, memory_used + pending_peak);
+        }
+      }
+
+      std::array<counter_shard, counter_shard_count> shards_{};
+      alignas(cache_line_size) std::atomic<std::int64_t> memory_used_{0};
+      std::atomic<std::int64_t>                          peak_memory_used_{0};
     };
 
     static light_internal_memory_information& get_global_memory_information()
@@ -201,195 +709,1049 @@ namespace MicrobenchMemory
       return memory_informations;
     }
 
-    static void log_global_memory_allocation(void* ptr, std::size_t sz)
-    {
-      auto& minfo = get_global_memory_information();
-      minfo.log_alloc(ptr, sz);
-    }
-
-    static void log_global_memory_deallocation(void* ptr)
+    // Overrides a thread-local variable for the lifetime of the guard, the previous value is restored on exceptions too
+    template <typename T>
+    class thread_local_override
     {
-      auto& minfo = get_global_memory_information();
-      minfo.log_dealloc(ptr);
-    }
+    public:
+      thread_local_override(T& variable, T value)
+          : variable_{variable}
+          , previous_{variable}
+      {
+        variable_ = value;
+      }
 
-    [[nodiscard]] void* managed_new(std::size_t sz)
-    {
-      auto* ptr = std::malloc(sz);
-      if (!ptr)
-        throw std::bad_alloc{};
+      ~thread_local_override() { variable_ = previous_; }
 
-      log_global_memory_allocation(ptr, sz);
-      return ptr;
-    }
+      thread_local_override(const thread_local_override&)            = delete;
+      thread_local_override& operator=(const thread_local_override&) = delete;
 
-    [[nodiscard]] void* managed_new(std::size_t count, std::align_val_t al)
-    {
-      auto* ptr = std::aligned_alloc(static_cast<std::size_t>(al), count);
-      if (!ptr)
-        throw std::bad_alloc{};
+    private:
+      T& variable_;
+      T  previous_;
+    };
 
-      log_global_memory_allocation(ptr, count);
-      return ptr;
-    }
+    /*
+    the calibration of the instrumentation overhead runs the instrumented operators with the recording of its thread
+    suppressed: the global counters are updated in a private copy, so that they cost the same without being seen, the
+    latencies are timed but not logged, and the budgets, sites, trace and slack tracking are skipped
+    */
+    static thread_local light_internal_memory_information* suppressed_recording = nullptr;
 
-    [[nodiscard]] void* managed_new_array(std::size_t count)
+    static void log_global_memory_allocation(void* ptr, std::size_t sz)
     {
-      auto* ptr = std::malloc(count);
-      if (!ptr)
-        throw std::bad_alloc{};
-
-      log_global_memory_allocation(ptr, count);
-      return ptr;
+      auto& minfo = suppressed_recording ? *suppressed_recording : get_global_memory_information();
+      minfo.log_alloc(ptr, sz);
     }
 
-    [[nodiscard]] void* managed_new_array(std::size_t count, std::align_val_t al)
+    static void log_global_memory_deallocation(void* ptr, std::size_t sz)
     {
-      auto* ptr = std::aligned_alloc(static_cast<std::size_t>(al), count);
-      if (!ptr)
-        throw std::bad_alloc{};
-
-      log_global_memory_allocation(ptr, count);
-      return ptr;
+      auto& minfo = suppressed_recording ? *suppressed_recording : get_global_memory_information();
+      minfo.log_dealloc(ptr, sz);
     }
 
+    /*
+    allocation trace
+    the generation identifies the running trace, it is 0 when none is: each thread opens its own ring on its first
+    event of a generation, in the directory given when the trace was started
+    */
+    inline constexpr std::size_t max_trace_path_length = 4096;
 
-    void managed_delete(void* ptr) noexcept
+    struct trace_settings
     {
-      log_global_memory_deallocation(ptr);
-      std::free(ptr);
-    }
+      std::mutex    mutex;
+      char          directory[max_trace_path_length];
+      std::uint64_t records_per_thread;
+    };
 
-    void managed_delete(void* ptr, [[maybe_unused]] std::align_val_t al) noexcept
+    static trace_settings& get_trace_settings()
     {
-      log_global_memory_deallocation(ptr);
-      std::free(ptr);
+      static trace_settings settings{};
+      return settings;
     }
 
-    void managed_delete(void* ptr, [[maybe_unused]] std::size_t sz) noexcept
-    {
-      log_global_memory_deallocation(ptr);
-      std::free(ptr);
-    }
+    static std::atomic<std::uint32_t> trace_generation{0};
+    static std::atomic<std::uint32_t> last_trace_generation{0};
+    static std::atomic<std::uint32_t> next_trace_thread_index{0};
 
-    void managed_delete(void* ptr, [[maybe_unused]] std::size_t sz, [[maybe_unused]] std::align_val_t al) noexcept
+    struct thread_trace
     {
-      log_global_memory_deallocation(ptr);
-      std::free(ptr);
-    }
+      trace_ring    ring;
+      std::uint32_t generation = 0;
+    };
 
-    void managed_delete_array(void* ptr) noexcept
+    static void open_thread_trace(thread_trace& trace, std::uint32_t generation)
     {
-      log_global_memory_deallocation(ptr);
-      std::free(ptr);
+      auto&            settings = get_trace_settings();
+      std::scoped_lock lock{settings.mutex};
+
+      // a failure is not retried before the next trace
+      trace.generation  = generation;
+      auto thread_index = next_trace_thread_index.fetch_add(1, std::memory_order_relaxed);
+      char path[max_trace_path_length + 64];
+      std::snprintf(path, sizeof(path), "%s/microbench_memory.%lld.%u.trace", settings.directory, static_cast<long long>(current_process_id()), thread_index);
+      trace.ring.open(path, settings.records_per_thread, thread_index);
     }
 
-    void managed_delete_array(void* ptr, [[maybe_unused]] std::align_val_t al) noexcept
-    {
-      log_global_memory_deallocation(ptr);
-      std::free(ptr);
-    }
+    static std::uint8_t alignment_log2(std::size_t alignment) { return alignment == 0 ? 0 : static_cast<std::uint8_t>(std::countr_zero(alignment)); }
 
-    void managed_delete_array(void* ptr, [[maybe_unused]] std::size_t sz) noexcept
+    static void trace_event(const void* ptr, std::size_t sz, scope_id scope, std::size_t alignment, trace_event_kind kind)
     {
-      log_global_memory_deallocation(ptr);
-      std::free(ptr);
+      auto generation = trace_generation.load(std::memory_order_acquire);
+      if (generation == 0) [[likely]]
+        return;
+
+      thread_local thread_trace trace;
+      if (trace.generation != generation) [[unlikely]]
+        open_thread_trace(trace, generation);
+
+      if (trace.ring.is_open())
+      {
+        auto timestamp = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now().time_since_epoch()).count();
+        trace.ring.append(static_cast<std::uint64_t>(timestamp), ptr, sz, scope, alignment_log2(alignment), kind);
+      }
     }
 
-    void managed_delete_array(void* ptr, [[maybe_unused]] std::size_t sz, [[maybe_unused]] std::align_val_t al) noexcept
+    static void trace_deallocation(void* ptr, scope_id scope)
     {
-      log_global_memory_deallocation(ptr);
-      std::free(ptr);
+      const auto& header = header_of(ptr);
+      trace_event(ptr, header.size, scope, header.flags & allocation_flag_aligned ? header.offset : 0, trace_event_deallocation);
     }
 
+    /*
+    memory sampler
+    the sampler runs on a bare POSIX thread: std::thread would allocate its state through the instrumented operators
+    the control mutex serializes the start, the stop and the readers of the series, which is only replaced by a start
+    */
+    inline constexpr std::size_t sampler_counter_column_count = 6;
 
-    [[nodiscard]] void* managed_new(std::string_view class_name, std::size_t sz)
+    struct memory_sampler_state
     {
-      auto* ptr = std::malloc(sz);
-      if (!ptr)
-        throw std::bad_alloc{};
-
-      log_scoped_memory_allocation(class_name, ptr, sz);
-      return ptr;
-    }
+      std::mutex                                    control_mutex;
+      std::mutex                                    wake_mutex;
+      std::condition_variable                       wake;
+      bool                                          stop_requested = false;
+      bool                                          running        = false;
+      std::chrono::nanoseconds                      interval{};
+      std::array<scope_id, max_sampled_scope_count> scopes{};
+      std::size_t                                   scope_count = 0;
+      time_series                                   series;
+#ifndef _WIN32
+      pthread_t thread{};
+#endif
+    };
 
-    [[nodiscard]] void* managed_new(std::string_view class_name, std::size_t count, std::align_val_t al)
+    // never destroyed, the sampler may still be running during the static destruction
+    static memory_sampler_state& get_memory_sampler_state()
     {
-      auto* ptr = std::aligned_alloc(static_cast<std::size_t>(al), count);
-      if (!ptr)
-        throw std::bad_alloc{};
-
-      log_scoped_memory_allocation(class_name, ptr, count);
-      return ptr;
+      static auto* state = new (vanilla_allocator<memory_sampler_state>{}.allocate(1)) memory_sampler_state{};
+      return *state;
     }
 
-    [[nodiscard]] void* managed_new_array(std::string_view class_name, std::size_t count)
+    // Returns false once the series is full
+    static bool take_memory_sample(memory_sampler_state& state, const resident_memory_reader& resident_memory, std::chrono::steady_clock::time_point start)
     {
-      auto* ptr = std::malloc(count);
-      if (!ptr)
-        throw std::bad_alloc{};
-
-      log_scoped_memory_allocation(class_name, ptr, count);
-      return ptr;
+      auto global = get_global_memory_information().to_user_info();
+
+      std::array<std::uint64_t, sampler_counter_column_count + max_sampled_scope_count> sample{};
+      sample[0] = static_cast<std::uint64_t>(std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count());
+      sample[1] = resident_memory.read();
+      sample[2] = global.current_memory_used();
+      sample[3] = global.allocation_count;
+      sample[4] = global.deallocation_count;
+      sample[5] = global.total_memory_allocated;
+      for (std::size_t i = 0; i < state.scope_count; ++i)
+        sample[sampler_counter_column_count + i] = get_scope(state.scopes[i]).infos.count_memory_leaked();
+      return state.series.append(sample.data());
     }
 
-    [[nodiscard]] void* managed_new_array(std::string_view class_name, std::size_t count, std::align_val_t al)
+    static void run_memory_sampler(memory_sampler_state& state)
     {
-      auto* ptr = std::aligned_alloc(static_cast<std::size_t>(al), count);
-      if (!ptr)
-        throw std::bad_alloc{};
+      resident_memory_reader resident_memory;
+      auto                   start = std::chrono::steady_clock::now();
+      auto                   next  = start;
 
-      log_scoped_memory_allocation(class_name, ptr, count);
-      return ptr;
+      std::unique_lock lock{state.wake_mutex};
+      while (!state.stop_requested && take_memory_sample(state, resident_memory, start))
+      {
+        // the ticks missed by a late sample are skipped rather than caught up with
+        next += state.interval;
+        next = std::max(next, std::chrono::steady_clock::now());
+        state.wake.wait_until(lock, next, [&state] { return state.stop_requested; });
+      }
     }
 
-
-    void managed_delete(std::string_view class_name, void* ptr) noexcept
+#ifndef _WIN32
+    static void* memory_sampler_thread(void* state)
     {
-      log_scoped_memory_deallocation(class_name, ptr);
-      std::free(ptr);
+      run_memory_sampler(*static_cast<memory_sampler_state*>(state));
+      return nullptr;
     }
+#endif
 
-    void managed_delete(std::string_view class_name, void* ptr, [[maybe_unused]] std::align_val_t al) noexcept
+    /*
+    backing allocators
+    the backends are kept in a fixed table, written once and never removed: a block can always be given back to the
+    backend that allocated it, whose index is kept in its header
+    */
+    static void* malloc_backend_allocate([[maybe_unused]] void* context, std::size_t size, std::size_t alignment)
     {
-      log_scoped_memory_deallocation(class_name, ptr);
-      std::free(ptr);
+      return alignment > allocation_header_size ? aligned_malloc(alignment, size) : system_malloc(size);
     }
 
-    void managed_delete(std::string_view class_name, void* ptr, [[maybe_unused]] std::size_t sz) noexcept
+    static void malloc_backend_deallocate([[maybe_unused]] void* context, void* ptr, [[maybe_unused]] std::size_t size, std::size_t alignment)
     {
-      log_scoped_memory_deallocation(class_name, ptr);
-      std::free(ptr);
+      if (alignment > allocation_header_size)
+        aligned_free(ptr);
+      else
+        system_free(ptr);
     }
 
-    void managed_delete(std::string_view class_name, void* ptr, [[maybe_unused]] std::size_t sz, [[maybe_unused]] std::align_val_t al) noexcept
+    static std::size_t malloc_backend_usable_size([[maybe_unused]] void* context, void* ptr, std::size_t size, std::size_t alignment)
     {
-      log_scoped_memory_deallocation(class_name, ptr);
-      std::free(ptr);
+      return system_usable_size(ptr, alignment > allocation_header_size ? alignment : 0, size);
     }
 
-    void managed_delete_array(std::string_view class_name, void* ptr) noexcept
-    {
-      log_scoped_memory_deallocation(class_name, ptr);
-      std::free(ptr);
-    }
+    // constant-initialized, the built-in allocators are usable from the very first allocation of the program
+    constinit static size_class_pool builtin_pool;
+    constinit static bump_arena      builtin_arena;
+
+    // over-aligned and large blocks are left to malloc, the pool only has the natural alignment of its size classes
+    static bool pool_handles(std::size_t size, std::size_t alignment) { return alignment <= allocation_header_size && size <= size_class_pool::max_size; }
 
-    void managed_delete_array(std::string_view class_name, void* ptr, [[maybe_unused]] std::align_val_t al) noexcept
+    static void* pool_backend_allocate(void* context, std::size_t size, std::size_t alignment)
     {
-      log_scoped_memory_deallocation(class_name, ptr);
-      std::free(ptr);
+      if (!pool_handles(size, alignment))
+        return malloc_backend_allocate(context, size, alignment);
+      return builtin_pool.allocate(size, current_counter_shard_index());
     }
 
-    void managed_delete_array(std::string_view class_name, void* ptr, [[maybe_unused]] std::size_t sz) noexcept
+    static void pool_backend_deallocate(void* context, void* ptr, std::size_t size, std::size_t alignment)
     {
-      log_scoped_memory_deallocation(class_name, ptr);
-      std::free(ptr);
+      if (!pool_handles(size, alignment))
+        return malloc_backend_deallocate(context, ptr, size, alignment);
+      builtin_pool.deallocate(ptr, size, current_counter_shard_index());
     }
 
-    void managed_delete_array(std::string_view class_name, void* ptr, [[maybe_unused]] std::size_t sz, [[maybe_unused]] std::align_val_t al) noexcept
+    static std::size_t pool_backend_usable_size(void* context, void* ptr, std::size_t size, std::size_t alignment)
     {
-      log_scoped_memory_deallocation(class_name, ptr);
-      std::free(ptr);
+      if (!pool_handles(size, alignment))
+        return malloc_backend_usable_size(context, ptr, size, alignment);
+      return size_class_pool::usable_size(size);
+    }
+
+    static void* arena_backend_allocate([[maybe_unused]] void* context, std::size_t size, std::size_t alignment) { return builtin_arena.allocate(size, alignment); }
+
+    static void arena_backend_deallocate([[maybe_unused]] void* context, [[maybe_unused]] void* ptr, [[maybe_unused]] std::size_t size, [[maybe_unused]] std::size_t alignment) {}
+
+    static std::array<allocator_backend, max_allocator_backend_count> allocator_backends{{
+        {"malloc", malloc_backend_allocate, malloc_backend_deallocate, nullptr, malloc_backend_usable_size},
+        {"pool", pool_backend_allocate, pool_backend_deallocate, nullptr, pool_backend_usable_size},
+        // the blocks of the arena are exactly the requested size, apart from their alignment
+        {"bump_arena", arena_backend_allocate, arena_backend_deallocate, nullptr, nullptr},
+    }};
+
+    static std::atomic<std::size_t> allocator_backend_count{3};
+    static std::atomic<std::size_t> current_allocator_backend{malloc_allocator_backend};
+    static std::mutex               allocator_backend_registration_mutex;
+
+    /*
+    latency of the backing allocator
+    the histograms are sharded like the global counters, a shard being allocated from the private memory the first time
+    one of its threads times an operation
+    */
+    static std::atomic<bool> latency_timing_enabled{false};
+
+    using atomic_latency_bins = std::array<std::atomic<std::uint64_t>, latency_histogram::bin_count>;
+
+    struct latency_shard
+    {
+      std::array<atomic_latency_bins, latency_size_class_count> allocations;
+      std::array<atomic_latency_bins, latency_size_class_count> deallocations;
+    };
+
+    static std::array<std::atomic<latency_shard*>, counter_shard_count> latency_shards{};
+
+    // Shard of the current thread, allocated from the private memory on first use: zero-filled pages are empty counters
+    template <typename Shard>
+    static Shard* get_private_shard(std::array<std::atomic<Shard*>, counter_shard_count>& shards)
+    {
+      auto& slot = shards[current_counter_shard_index()];
+      if (auto* shard = slot.load(std::memory_order_acquire))
+        return shard;
+
+      auto* shard = static_cast<Shard*>(allocate_pages(sizeof(Shard)));
+      if (!shard)
+        return nullptr;
+      Shard* expected = nullptr;
+      if (!slot.compare_exchange_strong(expected, shard, std::memory_order_acq_rel))
+      {
+        deallocate_pages(shard, sizeof(Shard));
+        return expected;
+      }
+      return shard;
+    }
+
+    static void log_latency(std::array<atomic_latency_bins, latency_size_class_count> latency_shard::*histograms, std::size_t sz, std::uint64_t ticks)
+    {
+      // the calibration times the clock reads without showing in the histograms
+      if (suppressed_recording)
+        return;
+      if (auto* shard = get_private_shard(latency_shards))
+        ((*shard).*histograms)[latency_size_class(sz)][latency_histogram::bin_index(ticks)].fetch_add(1, std::memory_order_relaxed);
+    }
+
+    /*
+    allocation slack
+    the size classes are sharded like the latency histograms, the scopes keep their own counters; a measured block is
+    flagged in its header so that its deallocation is only taken out of the live slack if its allocation was added to it
+    the usable size is asked again on deallocation rather than kept in the header, which has no room left for it
+    */
+    static std::atomic<bool> slack_tracking_enabled{false};
+
+    struct slack_shard
+    {
+      std::array<slack_counters, latency_size_class_count> size_classes;
+    };
+
+    static std::array<std::atomic<slack_shard*>, counter_shard_count> slack_shards{};
+
+    struct slack_sample
+    {
+      std::size_t usable;
+      std::size_t padding;
+    };
+
+    static slack_sample measure_slack(void* ptr)
+    {
+      const auto& header  = header_of(ptr);
+      const auto& backend = allocator_backends[backend_of(header)];
+      auto        block   = block_of(ptr);
+      auto        usable  = backend.usable_size ? backend.usable_size(backend.context, block.base, block.size, block.alignment) : block.size;
+      return {usable - allocation_header_size, block.size - allocation_header_size - header.size};
+    }
+
+    static void log_allocation_slack(scope_id scope, void* ptr, std::size_t sz)
+    {
+      if (!slack_tracking_enabled.load(std::memory_order_relaxed))
+        return;
+
+      auto sample = measure_slack(ptr);
+      header_of(ptr).flags |= allocation_flag_slack_measured;
+      if (auto* shard = get_private_shard(slack_shards))
+        shard->size_classes[latency_size_class(sz)].log_allocation(sz, sample.usable, sample.padding);
+      if (scope != 0)
+        get_scope(scope).slack.log_allocation(sz, sample.usable, sample.padding);
+    }
+
+    static void log_deallocation_slack(scope_id scope, void* ptr)
+    {
+      const auto& header = header_of(ptr);
+      if (!(header.flags & allocation_flag_slack_measured))
+        return;
+
+      auto sample = measure_slack(ptr);
+      if (auto* shard = get_private_shard(slack_shards))
+        shard->size_classes[latency_size_class(header.size)].log_deallocation(header.size, sample.usable);
+      if (scope != 0)
+        get_scope(scope).slack.log_deallocation(header.size, sample.usable);
+    }
+
+    [[nodiscard]] static void* allocate_from_backend(std::size_t sz, std::size_t alignment)
+    {
+      auto        index   = current_allocator_backend.load(std::memory_order_acquire);
+      const auto& backend = allocator_backends[index];
+      return allocate_with_header(sz, alignment, static_cast<std::uint32_t>(index),
+                                  [&](std::size_t size, std::size_t block_alignment) { return backend.allocate(backend.context, size, block_alignment); });
+    }
+
+    static void deallocate_to_backend(void* ptr) noexcept
+    {
+      const auto& backend = allocator_backends[backend_of(header_of(ptr))];
+      auto        block   = block_of(ptr);
+      backend.deallocate(backend.context, block.base, block.size, block.alignment);
+    }
+
+    // Returns nullptr on failure
+    [[nodiscard]] static void* allocate_timed(std::size_t sz, std::size_t alignment)
+    {
+      if (!latency_timing_enabled.load(std::memory_order_relaxed))
+        return allocate_from_backend(sz, alignment);
+
+      auto  start = read_cycle_clock();
+      auto* ptr   = allocate_from_backend(sz, alignment);
+      log_latency(&latency_shard::allocations, sz, read_cycle_clock() - start);
+      return ptr;
+    }
+
+    [[nodiscard]] static void* allocate_or_throw(std::size_t sz, std::size_t alignment)
+    {
+      auto* ptr = allocate_timed(sz, alignment);
+      if (!ptr)
+        throw std::bad_alloc{};
+      return ptr;
+    }
+
+    static void deallocate_with_header(void* ptr) noexcept
+    {
+      if (latency_timing_enabled.load(std::memory_order_relaxed))
+      {
+        auto sz    = header_of(ptr).size;
+        auto start = read_cycle_clock();
+        deallocate_to_backend(ptr);
+        log_latency(&latency_shard::deallocations, sz, read_cycle_clock() - start);
+      }
+      else
+        deallocate_to_backend(ptr);
+    }
+
+    static bool log_sampled_scoped_allocation(scope_id scope, void* ptr, std::size_t sz, std::size_t interval)
+    {
+      // unsampled allocations only pay for the sampler countdown
+      auto sampled = interval == 0 || sample_allocation(sz, interval);
+      if (sampled)
+      {
+        header_of(ptr).flags |= allocation_flag_sampled;
+        log_scoped_memory_allocation(scope, ptr, sz, interval);
+      }
+      return sampled;
+    }
+
+    static void record_scoped_allocation(scope_id scope, void* ptr, std::size_t sz, std::size_t alignment)
+    {
+      auto interval = sampling_interval.load(std::memory_order_relaxed);
+      if (suppressed_recording)
+      {
+        log_sampled_scoped_allocation(scope, ptr, sz, interval);
+        return;
+      }
+
+      charge_allocation_budgets(scope, sz);
+      auto sampled = log_sampled_scoped_allocation(scope, ptr, sz, interval);
+      log_allocation_site(sz, interval, sampled);
+      trace_event(ptr, sz, scope, alignment, trace_event_allocation);
+    }
+
+    static void record_scoped_deallocation(scope_id scope, void* ptr)
+    {
+      if (!suppressed_recording)
+        trace_deallocation(ptr, scope);
+      if (header_of(ptr).flags & allocation_flag_sampled)
+        log_scoped_memory_deallocation(scope, ptr);
+    }
+
+    /*
+    memory regions: the region of the thread is kept as a scope identifier, 0 outside of any region
+    constant-initialized, reading it is a plain thread-local load
+    */
+    static_assert(max_scope_count - 1 <= allocation_region_mask >> allocation_region_shift);
+
+    static thread_local scope_id current_region = 0;
+
+    scope_id enter_memory_region(std::string_view name)
+    {
+      auto previous = current_region;
+
+      std::basic_string<char, std::char_traits<char>, vanilla_allocator<char>> path;
+      if (previous != 0)
+        path = get_scope(previous).name;
+      path += '/';
+      path += name;
+
+      current_region = register_scope(path);
+      return previous;
+    }
+
+    void leave_memory_region(scope_id previous) noexcept { current_region = previous; }
+
+    /*
+    allocation budgets: the budgets of the thread are chained from the innermost one, which is constant-initialized like
+    the region, outside of any budget the instrumented operators only pay for a thread-local load
+    */
+    static thread_local allocation_budget* current_allocation_budget = nullptr;
+
+    allocation_budget* enter_allocation_budget(allocation_budget* budget) noexcept
+    {
+      auto* previous            = current_allocation_budget;
+      current_allocation_budget = budget;
+      return previous;
+    }
+
+    void leave_allocation_budget(allocation_budget* previous) noexcept { current_allocation_budget = previous; }
+
+    void charge_allocation_budgets(scope_id scope, std::size_t sz) noexcept
+    {
+      auto* innermost = current_allocation_budget;
+      if (!innermost)
+        return;
+
+      // writing a violation may allocate: the budgets are left meanwhile
+      current_allocation_budget = nullptr;
+      auto name                 = scope != 0 ? std::string_view{get_scope(scope).name} : std::string_view{};
+      for (auto* budget = innermost; budget; budget = budget->previous_)
+      {
+        auto index = budget->allocation_count_++;
+        budget->allocated_bytes_ += sz;
+        if (budget->allocation_count_ <= budget->max_allocations_ && budget->allocated_bytes_ <= budget->max_bytes_)
+          continue;
+
+        if (budget->violation_count_ < allocation_budget::max_recorded_violations)
+          budget->violations_[budget->violation_count_] = {sz, name, index};
+        ++budget->violation_count_;
+
+        if (budget->action_ == budget_action::trap)
+        {
+          std::fprintf(stderr, "MicrobenchMemory: allocation #%zu of %zu bytes in scope \"%.*s\" over the budget of %zu allocations and %zu bytes\n", index, sz,
+                       static_cast<int>(name.size()), name.data(), budget->max_allocations_, budget->max_bytes_);
+          std::abort();
+        }
+      }
+      current_allocation_budget = innermost;
+    }
+
+    /*
+    set while a tracking_memory_resource asks its upstream resource for a block, see managed_upstream_new: the block is
+    accounted in the scope of the resource, the global allocations serving it are left untracked, like the scoped ones
+    */
+    static thread_local bool in_upstream_allocation = false;
+
+    static void record_global_allocation(void* ptr, std::size_t sz, std::size_t alignment)
+    {
+      if (suppressed_recording)
+      {
+        log_global_memory_allocation(ptr, sz);
+        return;
+      }
+      if (in_upstream_allocation)
+      {
+        header_of(ptr).flags |= allocation_flag_untracked;
+        return;
+      }
+
+      charge_allocation_budgets(current_region, sz);
+
+      // the only step that can throw, when the pointer table of the region is full: done before any counter is updated
+      auto region = current_region;
+      if (region != 0)
+      {
+        header_of(ptr).flags |= region << allocation_region_shift;
+        log_sampled_scoped_allocation(region, ptr, sz, sampling_interval.load(std::memory_order_relaxed));
+      }
+      log_global_memory_allocation(ptr, sz);
+      log_global_allocation_site(sz);
+      trace_event(ptr, sz, region, alignment, trace_event_allocation);
+      log_allocation_slack(region, ptr, sz);
+    }
+
+    /*
+    the recording throws std::bad_alloc when the pointer table of the scope can't grow anymore: the block is already
+    allocated then, and given back before the exception goes on
+    */
+    [[nodiscard]] static void* managed_global_new(std::size_t sz, std::size_t alignment)
+    {
+      auto* ptr = allocate_or_throw(sz, alignment);
+      try
+      {
+        record_global_allocation(ptr, sz, alignment);
+      }
+      catch (...)
+      {
+        deallocate_with_header(ptr);
+        throw;
+      }
+      return ptr;
+    }
+
+    static void managed_global_delete(void* ptr) noexcept
+    {
+      if (!ptr)
+        return;
+
+      const auto& header = header_of(ptr);
+      // a block without header, from an allocation function that isn't replaced, would give a random region
+      assert(is_plausible_header(header) && region_of(header) < max_scope_count);
+      auto region = region_of(header);
+      if (header.flags & allocation_flag_untracked)
+        return deallocate_with_header(ptr);
+      if (suppressed_recording)
+      {
+        log_global_memory_deallocation(ptr, header.size);
+        return deallocate_with_header(ptr);
+      }
+
+      trace_deallocation(ptr, region);
+      if (header.flags & allocation_flag_sampled)
+        log_scoped_memory_deallocation(region, ptr);
+      log_global_memory_deallocation(ptr, header.size);
+      log_deallocation_slack(region, ptr);
+      deallocate_with_header(ptr);
+    }
+
+    [[nodiscard]] static void* managed_scoped_new(scope_id scope, std::size_t sz, std::size_t alignment)
+    {
+      auto* ptr = allocate_or_throw(sz, alignment);
+      try
+      {
+        record_scoped_allocation(scope, ptr, sz, alignment);
+      }
+      catch (...)
+      {
+        deallocate_with_header(ptr);
+        throw;
+      }
+      if (!suppressed_recording)
+        log_allocation_slack(scope, ptr, sz);
+      return ptr;
+    }
+
+    static void managed_scoped_delete(scope_id scope, void* ptr) noexcept
+    {
+      if (!ptr)
+        return;
+
+      record_scoped_deallocation(scope, ptr);
+      if (!suppressed_recording)
+        log_deallocation_slack(scope, ptr);
+      deallocate_with_header(ptr);
+    }
+
+    /*
+    object pools of the classes instrumented with MICROBENCH_MEMORY_INSTRUMENT_POOLED_CLASS
+    the pool of a scope is created on its first allocation, with blocks fitting this allocation and its header; the
+    allocations of another size (derived classes) go through the regular scoped path, like the aligned and array ones
+
+    each thread keeps a cache of blocks per pool, refilled and drained by batches: most allocations and deallocations
+    never touch the shared pool
+    the caches live in the private memory, linked together so that the statistics can read the counters of every thread;
+    the cache of an exiting thread gives its blocks back to the pools and is recycled by the next thread
+    */
+    inline constexpr std::size_t   max_object_pool_count = 64;
+    inline constexpr std::size_t   pool_cache_batch_size = 32;
+    inline constexpr std::uint32_t no_object_pool        = static_cast<std::uint32_t>(-1);
+
+    static std::array<std::atomic<object_pool*>, max_object_pool_count> object_pools{};
+    static std::size_t                                                  object_pool_count = 0; // guarded by the scope registry mutex
+
+    // counters of a single thread: written by their thread only, without read-modify-write
+    static void add_thread_counter(std::atomic<std::size_t>& counter, std::size_t value) { counter.store(counter.load(std::memory_order_relaxed) + value, std::memory_order_relaxed); }
+    static void sub_thread_counter(std::atomic<std::size_t>& counter, std::size_t value) { counter.store(counter.load(std::memory_order_relaxed) - value, std::memory_order_relaxed); }
+
+    struct pool_thread_cache
+    {
+      struct entry
+      {
+        pool_free_block*         head = nullptr;
+        std::atomic<std::size_t> count{0};
+        std::atomic<std::size_t> allocation_count{0};
+        std::atomic<std::size_t> hits{0};
+      };
+
+      std::array<entry, max_object_pool_count> entries{};
+      pool_thread_cache*                       next = nullptr;
+      std::atomic<bool>                        in_use{false};
+    };
+
+    static std::atomic<pool_thread_cache*> pool_thread_caches{nullptr};
+
+    static pool_thread_cache* acquire_pool_thread_cache()
+    {
+      for (auto* cache = pool_thread_caches.load(std::memory_order_acquire); cache; cache = cache->next)
+        if (bool expected = false; !cache->in_use.load(std::memory_order_relaxed) && cache->in_use.compare_exchange_strong(expected, true, std::memory_order_acquire))
+          return cache;
+
+      auto* pages = allocate_pages(sizeof(pool_thread_cache));
+      if (!pages)
+        return nullptr;
+      auto* cache = new (pages) pool_thread_cache{};
+      cache->in_use.store(true, std::memory_order_relaxed);
+
+      auto* head = pool_thread_caches.load(std::memory_order_relaxed);
+      do
+        cache->next = head;
+      while (!pool_thread_caches.compare_exchange_weak(head, cache, std::memory_order_release, std::memory_order_relaxed));
+      return cache;
+    }
+
+    static void drain_pool_cache(object_pool& pool, pool_thread_cache::entry& entry, std::size_t count)
+    {
+      if (count == 0)
+        return;
+
+      auto* head = entry.head;
+      auto* tail = head;
+      for (std::size_t i = 1; i < count; ++i)
+        tail = tail->next;
+      entry.head = tail->next;
+      sub_thread_counter(entry.count, count);
+      pool.release(head, tail, count);
+    }
+
+    static thread_local pool_thread_cache* current_pool_thread_cache  = nullptr;
+    static thread_local bool               pool_thread_cache_released = false;
+
+    struct pool_thread_cache_owner
+    {
+      ~pool_thread_cache_owner()
+      {
+        auto* cache = current_pool_thread_cache;
+        if (!cache)
+          return;
+
+        // the counters stay in the cache, they are still part of the statistics
+        for (std::size_t i = 0; i < max_object_pool_count; ++i)
+          if (auto* pool = object_pools[i].load(std::memory_order_acquire))
+            drain_pool_cache(*pool, cache->entries[i], cache->entries[i].count.load(std::memory_order_relaxed));
+        current_pool_thread_cache  = nullptr;
+        pool_thread_cache_released = true;
+        cache->in_use.store(false, std::memory_order_release);
+      }
+    };
+
+    // Returns nullptr once the thread is exiting: its last deallocations bypass the cache
+    static pool_thread_cache* get_pool_thread_cache()
+    {
+      if (auto* cache = current_pool_thread_cache)
+        return cache;
+      if (pool_thread_cache_released)
+        return nullptr;
+
+      thread_local pool_thread_cache_owner owner;
+      current_pool_thread_cache = acquire_pool_thread_cache();
+      return current_pool_thread_cache;
+    }
+
+    static std::uint32_t get_object_pool_index(scope_entry& entry, std::size_t block_size)
+    {
+      if (auto index = entry.pool_index.load(std::memory_order_acquire); index != 0)
+        return index;
+
+      auto&            registry = get_scope_registry();
+      std::scoped_lock lock{registry.mutex};
+      if (auto index = entry.pool_index.load(std::memory_order_relaxed); index != 0)
+        return index;
+
+      std::uint32_t index = no_object_pool;
+      if (object_pool_count < max_object_pool_count)
+      {
+        // blocks are kept 16-byte aligned, like the ones of malloc
+        block_size = (block_size + allocation_header_size - 1) & ~(allocation_header_size - 1);
+        object_pools[object_pool_count].store(new (vanilla_allocator<object_pool>{}.allocate(1)) object_pool{block_size}, std::memory_order_release);
+        index = static_cast<std::uint32_t>(++object_pool_count);
+      }
+      entry.pool_index.store(index, std::memory_order_release);
+      return index;
+    }
+
+    [[nodiscard]] void* managed_pooled_new(scope_id scope, std::size_t sz)
+    {
+      auto  index = get_object_pool_index(get_scope(scope), allocation_header_size + sz);
+      auto* cache = get_pool_thread_cache();
+      if (index == no_object_pool || !cache)
+        return managed_scoped_new(scope, sz, 0);
+
+      auto& pool = *object_pools[index - 1].load(std::memory_order_acquire);
+      if (allocation_header_size + sz > pool.block_size())
+        return managed_scoped_new(scope, sz, 0);
+
+      auto& entry = cache->entries[index - 1];
+      bool  hit   = entry.head != nullptr;
+      if (hit)
+        add_thread_counter(entry.hits, 1);
+      else if (auto count = pool.acquire(entry.head, pool_cache_batch_size); count != 0)
+        add_thread_counter(entry.count, count);
+      else
+        throw std::bad_alloc{};
+
+      auto* block = entry.head;
+      entry.head  = block->next;
+      sub_thread_counter(entry.count, 1);
+      add_thread_counter(entry.allocation_count, 1);
+
+      auto* ptr = reinterpret_cast<std::byte*>(block) + allocation_header_size;
+      new (block) allocation_header{sz, allocation_header_size, allocation_flag_pooled};
+      try
+      {
+        record_scoped_allocation(scope, ptr, sz, 0);
+      }
+      catch (...)
+      {
+        // the pointer table of the scope is full: the block goes back to the cache, as if it was never handed out
+        block      = new (block) pool_free_block{entry.head};
+        entry.head  = block;
+        add_thread_counter(entry.count, 1);
+        sub_thread_counter(entry.allocation_count, 1);
+        if (hit)
+          sub_thread_counter(entry.hits, 1);
+        throw;
+      }
+      return ptr;
+    }
+
+    void managed_pooled_delete(scope_id scope, void* ptr) noexcept
+    {
+      if (!ptr)
+        return;
+      if (!(header_of(ptr).flags & allocation_flag_pooled))
+        return managed_scoped_delete(scope, ptr);
+
+      record_scoped_deallocation(scope, ptr);
+
+      auto  index = get_scope(scope).pool_index.load(std::memory_order_acquire) - 1;
+      auto& pool  = *object_pools[index].load(std::memory_order_acquire);
+      auto* block = reinterpret_cast<pool_free_block*>(static_cast<std::byte*>(ptr) - allocation_header_size);
+
+      auto* cache = get_pool_thread_cache();
+      if (!cache)
+        return pool.release(block, block, 1);
+
+      auto& entry = cache->entries[index];
+      block->next = entry.head;
+      entry.head  = block;
+      add_thread_counter(entry.count, 1);
+      if (entry.count.load(std::memory_order_relaxed) > 2 * pool_cache_batch_size)
+        drain_pool_cache(pool, entry, pool_cache_batch_size);
+    }
+
+
+    [[nodiscard]] void* managed_new(std::size_t sz) { return managed_global_new(sz, 0); }
+    [[nodiscard]] void* managed_new(std::size_t count, std::align_val_t al) { return managed_global_new(count, static_cast<std::size_t>(al)); }
+    [[nodiscard]] void* managed_new_array(std::size_t count) { return managed_global_new(count, 0); }
+    [[nodiscard]] void* managed_new_array(std::size_t count, std::align_val_t al) { return managed_global_new(count, static_cast<std::size_t>(al)); }
+
+    void managed_delete(void* ptr) noexcept { managed_global_delete(ptr); }
+    void managed_delete(void* ptr, [[maybe_unused]] std::align_val_t al) noexcept { managed_global_delete(ptr); }
+    void managed_delete(void* ptr, [[maybe_unused]] std::size_t sz) noexcept { managed_global_delete(ptr); }
+    void managed_delete(void* ptr, [[maybe_unused]] std::size_t sz, [[maybe_unused]] std::align_val_t al) noexcept { managed_global_delete(ptr); }
+    void managed_delete_array(void* ptr) noexcept { managed_global_delete(ptr); }
+    void managed_delete_array(void* ptr, [[maybe_unused]] std::align_val_t al) noexcept { managed_global_delete(ptr); }
+    void managed_delete_array(void* ptr, [[maybe_unused]] std::size_t sz) noexcept { managed_global_delete(ptr); }
+    void managed_delete_array(void* ptr, [[maybe_unused]] std::size_t sz, [[maybe_unused]] std::align_val_t al) noexcept { managed_global_delete(ptr); }
+
+
+    /*
+    malloc family: the blocks are accounted like the ones of the global operators
+    an allocation made while the thread is already in one, e.g. by the C library on behalf of the instrumentation, is
+    served without being accounted: the instrumentation is never reentered
+    */
+    static thread_local bool in_managed_malloc = false;
+
+    [[nodiscard]] void* managed_malloc(std::size_t sz, std::size_t alignment) noexcept
+    {
+      if (in_managed_malloc)
+      {
+        auto* ptr = allocate_from_backend(sz, alignment);
+        if (ptr)
+          header_of(ptr).flags |= allocation_flag_untracked;
+        return ptr;
+      }
+
+      in_managed_malloc = true;
+      auto* ptr         = allocate_timed(sz, alignment);
+      if (ptr)
+      {
+        try
+        {
+          record_global_allocation(ptr, sz, alignment);
+        }
+        catch (const std::bad_alloc&)
+        {
+          deallocate_with_header(ptr);
+          ptr = nullptr;
+        }
+      }
+      in_managed_malloc = false;
+      return ptr;
+    }
+
+    void managed_free(void* ptr) noexcept
+    {
+      if (ptr && header_of(ptr).flags & allocation_flag_untracked)
+        deallocate_to_backend(ptr);
+      else
+        managed_global_delete(ptr);
+    }
+
+    std::size_t managed_usable_size(void* ptr) noexcept { return ptr ? header_of(ptr).size : 0; }
+
+
+    /*
+    scoped allocations of an upstream allocator, see tracking_memory_resource
+    the blocks are flagged with the malloc backend, which is never asked for them: neither freed through the backends nor
+    measured by the slack tracking
+    */
+    [[nodiscard]] void* managed_upstream_new(scope_id scope, std::size_t sz, std::size_t alignment, upstream_allocate_function allocate,
+                                             upstream_deallocate_function deallocate, void* context)
+    {
+      void* ptr = nullptr;
+      {
+        thread_local_override<bool> upstream_allocation{in_upstream_allocation, true};
+        ptr = allocate_with_header(sz, alignment, malloc_allocator_backend,
+                                   [&](std::size_t size, std::size_t block_alignment) { return allocate(context, size, block_alignment); });
+      }
+      if (!ptr)
+        throw std::bad_alloc{};
+      try
+      {
+        record_scoped_allocation(scope, ptr, sz, alignment);
+      }
+      catch (...)
+      {
+        auto block = block_of(ptr);
+        deallocate(context, block.base, block.size, block.alignment);
+        throw;
+      }
+      return ptr;
+    }
+
+    void managed_upstream_delete(scope_id scope, void* ptr, upstream_deallocate_function deallocate, void* context) noexcept
+    {
+      if (!ptr)
+        return;
+
+      record_scoped_deallocation(scope, ptr);
+      auto block = block_of(ptr);
+      deallocate(context, block.base, block.size, block.alignment);
+    }
+
+
+    /*
+    calibration of the instrumentation overhead, see instrumentation_overhead
+    the baseline goes through the backing allocator with the header, which is what the instrumented operators add to
+    */
+    inline constexpr std::size_t calibration_round_count = 5;
+    inline constexpr std::size_t calibration_pair_count  = 20'000;
+    inline constexpr std::size_t calibration_size        = 64;
+
+    template <typename F>
+    static double time_fastest_round(F&& new_delete_pair)
+    {
+      auto fastest = std::chrono::steady_clock::duration::max();
+      for (std::size_t round = 0; round < calibration_round_count; ++round)
+      {
+        auto start = std::chrono::steady_clock::now();
+        for (std::size_t i = 0; i < calibration_pair_count; ++i)
+          new_delete_pair();
+        fastest = std::min(fastest, std::chrono::steady_clock::now() - start);
+      }
+      return std::chrono::duration<double, std::nano>(fastest).count() / static_cast<double>(calibration_pair_count);
+    }
+
+    static instrumentation_overhead measure_instrumentation_overhead()
+    {
+      // the optimizer must not see through the pairs
+      static void* volatile sink = nullptr;
+
+      // the counters of the calibration, its pairs leave them balanced
+      static light_internal_memory_information calibration_counters{};
+
+      auto scope    = register_scope("microbench_memory_calibration");
+      auto baseline = time_fastest_round([] {
+        auto* ptr = allocate_from_backend(calibration_size, 0);
+        if (!ptr)
+          throw std::bad_alloc{};
+        sink = ptr;
+        deallocate_to_backend(ptr);
+      });
+
+      // restored when the calibration returns, or throws std::bad_alloc
+      thread_local_override<scope_id>                           no_region{current_region, 0};
+      thread_local_override<light_internal_memory_information*> suppressed{suppressed_recording, &calibration_counters};
+
+      auto global = time_fastest_round([] {
+        sink = managed_global_new(calibration_size, 0);
+        managed_global_delete(sink);
+      });
+      auto scoped = time_fastest_round([scope] {
+        sink = managed_scoped_new(scope, calibration_size, 0);
+        managed_scoped_delete(scope, sink);
+      });
+      return {std::max(global - baseline, 0.), std::max(scoped - baseline, 0.)};
+    }
+
+    struct overhead_calibration
+    {
+      std::mutex               mutex;
+      bool                     calibrated = false;
+      instrumentation_overhead overhead{};
+    };
+
+    static overhead_calibration& get_overhead_calibration()
+    {
+      static auto* calibration = new (vanilla_allocator<overhead_calibration>{}.allocate(1)) overhead_calibration{};
+      return *calibration;
+    }
+
+
+    /*
+    out-of-line parts of the tracking policies, see tracking_policy.hpp
+    a pointer registry is a pointer table in the private memory, with the count of its pointers
+    */
+    struct policy_pointer_registry
+    {
+      pointer_table            pointers;
+      std::atomic<std::size_t> size{0};
+    };
+
+    policy_pointer_registry* create_policy_pointer_registry() noexcept
+    {
+      auto* storage = allocate_pages(sizeof(policy_pointer_registry));
+      return storage ? new (storage) policy_pointer_registry{} : nullptr;
+    }
+
+    bool insert_policy_pointer(policy_pointer_registry& registry, void* ptr, std::size_t sz) noexcept
+    {
+      if (!registry.pointers.insert(ptr, internal_ptr_infos{sz, 0}))
+        return false;
+      registry.size.fetch_add(1, std::memory_order_relaxed);
+      return true;
+    }
+
+    std::size_t erase_policy_pointer(policy_pointer_registry& registry, void* ptr)
+    {
+      auto infos = registry.pointers.erase(ptr);
+      if (!infos)
+        throw_invalid_free(ptr);
+      registry.size.fetch_sub(1, std::memory_order_relaxed);
+      return infos->size;
+    }
+
+    std::size_t count_policy_pointers(const policy_pointer_registry& registry) noexcept { return registry.size.load(std::memory_order_relaxed); }
+
+    // aligned_alloc wants a size multiple of the alignment
+    [[nodiscard]] void* policy_aligned_allocate(std::size_t sz, std::size_t alignment) noexcept
+    {
+      if (sz > static_cast<std::size_t>(-1) - alignment)
+        return nullptr;
+      return aligned_malloc(alignment, ((sz == 0 ? 1 : sz) + alignment - 1) & ~(alignment - 1));
+    }
+
+    void policy_aligned_deallocate(void* ptr, [[maybe_unused]] std::size_t alignment) noexcept { aligned_free(ptr); }
+
+
+    [[nodiscard]] void* managed_new(scope_id scope, std::size_t sz) { return managed_scoped_new(scope, sz, 0); }
+    [[nodiscard]] void* managed_new(scope_id scope, std::size_t count, std::align_val_t al)
+    {
+      return managed_scoped_new(scope, count, static_cast<std::size_t>(al));
+    }
+    [[nodiscard]] void* managed_new_array(scope_id scope, std::size_t count) { return managed_scoped_new(scope, count, 0); }
+    [[nodiscard]] void* managed_new_array(scope_id scope, std::size_t count, std::align_val_t al)
+    {
+      return managed_scoped_new(scope, count, static_cast<std::size_t>(al));
+    }
+
+    void managed_delete(scope_id scope, void* ptr) noexcept { managed_scoped_delete(scope, ptr); }
+    void managed_delete(scope_id scope, void* ptr, [[maybe_unused]] std::align_val_t al) noexcept { managed_scoped_delete(scope, ptr); }
+    void managed_delete(scope_id scope, void* ptr, [[maybe_unused]] std::size_t sz) noexcept { managed_scoped_delete(scope, ptr); }
+    void managed_delete(scope_id scope, void* ptr, [[maybe_unused]] std::size_t sz, [[maybe_unused]] std::align_val_t al) noexcept
+    {
+      managed_scoped_delete(scope, ptr);
+    }
+    void managed_delete_array(scope_id scope, void* ptr) noexcept { managed_scoped_delete(scope, ptr); }
+    void managed_delete_array(scope_id scope, void* ptr, [[maybe_unused]] std::align_val_t al) noexcept { managed_scoped_delete(scope, ptr); }
+    void managed_delete_array(scope_id scope, void* ptr, [[maybe_unused]] std::size_t sz) noexcept { managed_scoped_delete(scope, ptr); }
+    void managed_delete_array(scope_id scope, void* ptr, [[maybe_unused]] std::size_t sz, [[maybe_unused]] std::align_val_t al) noexcept
+    {
+      managed_scoped_delete(scope, ptr);
     }
 
   } // namespace detail
@@ -397,6 +1759,329 @@ namespace MicrobenchMemory
 
   global_memory_informations get_global_memory_information_snapshot() { return detail::get_global_memory_information().to_user_info(); }
 
-  scoped_memory_informations get_memory_information_snapshot(std::string_view scope) { return detail::get_all_scoped_memory_information()[scope].to_user_info(scope); }
+  scoped_memory_informations get_memory_information_snapshot(std::string_view scope)
+  {
+    const auto& entry = detail::get_scope(detail::register_scope(scope));
+    return entry.infos.to_user_info(entry.name);
+  }
+
+  std::size_t snapshot_all_scopes(scoped_memory_informations* snapshots, std::size_t count)
+  {
+    // the identifiers are dense, the scope entries are published in registration order
+    std::size_t scope_count = 0;
+    for (std::size_t id = 1; id < detail::max_scope_count; ++id)
+    {
+      const auto* entry = detail::scope_entries[id].load(std::memory_order_acquire);
+      if (!entry)
+        break;
+      if (scope_count < count)
+        entry->infos.to_user_info(entry->name, snapshots[scope_count]);
+      ++scope_count;
+    }
+    return scope_count;
+  }
+
+  std::size_t get_leaked_pointers(std::string_view scope, leaked_pointer* pointers, std::size_t count, std::size_t& cursor)
+  {
+    return detail::get_scope(detail::register_scope(scope)).infos.list_ptr_leaked(pointers, count, cursor);
+  }
+
+  void reset_global_peak_memory() { detail::get_global_memory_information().reset_peak(); }
+
+  void reset_peak_memory(std::string_view scope) { detail::get_scope(detail::register_scope(scope)).infos.reset_peak(); }
+
+  void enable_allocation_size_histogram(bool enabled) { detail::size_histogram_enabled.store(enabled, std::memory_order_relaxed); }
+
+  void enable_allocation_latency_timing(bool enabled)
+  {
+    if (enabled)
+      detail::cycle_clock_nanoseconds_per_tick();
+    detail::latency_timing_enabled.store(enabled, std::memory_order_relaxed);
+  }
+
+  bool is_allocation_latency_timing_enabled() { return detail::latency_timing_enabled.load(std::memory_order_relaxed); }
+
+  allocation_latencies get_allocation_latencies()
+  {
+    allocation_latencies latencies{};
+
+    auto scale = detail::nanoseconds_per_tick.load(std::memory_order_acquire);
+    for (std::size_t i = 0; i < latency_size_class_count; ++i)
+      latencies.allocations[i].nanoseconds_per_tick = latencies.deallocations[i].nanoseconds_per_tick = scale;
+
+    for (const auto& slot : detail::latency_shards)
+      if (const auto* shard = slot.load(std::memory_order_acquire))
+        for (std::size_t i = 0; i < latency_size_class_count; ++i)
+          for (std::size_t bin = 0; bin < latency_histogram::bin_count; ++bin)
+          {
+            latencies.allocations[i].bins[bin] += shard->allocations[i][bin].load(std::memory_order_relaxed);
+            latencies.deallocations[i].bins[bin] += shard->deallocations[i][bin].load(std::memory_order_relaxed);
+          }
+    return latencies;
+  }
+
+  instrumentation_overhead get_instrumentation_overhead()
+  {
+    auto&            calibration = detail::get_overhead_calibration();
+    std::scoped_lock lock{calibration.mutex};
+    if (!calibration.calibrated)
+    {
+      calibration.overhead   = detail::measure_instrumentation_overhead();
+      calibration.calibrated = true;
+    }
+    return calibration.overhead;
+  }
+
+  instrumentation_overhead calibrate_instrumentation_overhead()
+  {
+    auto&            calibration = detail::get_overhead_calibration();
+    std::scoped_lock lock{calibration.mutex};
+    calibration.overhead   = detail::measure_instrumentation_overhead();
+    calibration.calibrated = true;
+    return calibration.overhead;
+  }
+
+  void enable_allocation_lifetime_profiling(bool enabled)
+  {
+    if (enabled)
+      detail::cycle_clock_nanoseconds_per_tick();
+    detail::lifetime_profiling_enabled.store(enabled, std::memory_order_relaxed);
+  }
+
+  bool is_allocation_lifetime_profiling_enabled() { return detail::lifetime_profiling_enabled.load(std::memory_order_relaxed); }
+
+  allocation_lifetimes get_allocation_lifetimes(std::string_view scope) { return detail::get_scope(detail::register_scope(scope)).infos.load_lifetimes(); }
+
+  void enable_allocation_slack_tracking(bool enabled) { detail::slack_tracking_enabled.store(enabled, std::memory_order_relaxed); }
+
+  bool is_allocation_slack_tracking_enabled() { return detail::slack_tracking_enabled.load(std::memory_order_relaxed); }
+
+  heap_overhead get_heap_overhead()
+  {
+    heap_overhead overhead{};
+    for (const auto& slot : detail::slack_shards)
+      if (const auto* shard = slot.load(std::memory_order_acquire))
+        for (std::size_t i = 0; i < latency_size_class_count; ++i)
+          overhead.size_classes[i] += shard->size_classes[i].load();
+
+    overhead.live_memory = detail::get_global_memory_information().to_user_info().current_memory_used();
+
+    static const detail::resident_memory_reader resident_memory;
+    overhead.resident_memory = resident_memory.read();
+
+    auto heap                 = detail::read_system_heap_usage();
+    overhead.system_heap_size = heap.size;
+    overhead.system_heap_used = heap.used;
+    return overhead;
+  }
+
+  allocation_slack get_allocation_slack(std::string_view scope)
+  {
+    return detail::get_scope(detail::register_scope(scope)).slack.load();
+  }
+
+  void set_sampling_interval(std::size_t bytes) { detail::sampling_interval.store(bytes, std::memory_order_relaxed); }
+
+  std::size_t get_sampling_interval() { return detail::sampling_interval.load(std::memory_order_relaxed); }
+
+  bool start_allocation_trace(std::string_view directory, std::size_t records_per_thread)
+  {
+    auto& settings = detail::get_trace_settings();
+    if (directory.size() >= detail::max_trace_path_length || records_per_thread == 0)
+      return false;
+
+    std::scoped_lock lock{settings.mutex};
+    std::memcpy(settings.directory, directory.data(), directory.size());
+    settings.directory[directory.size()] = '\0';
+    if (!detail::is_writable_directory(settings.directory))
+      return false;
+    settings.records_per_thread = records_per_thread;
+
+    // generation 0 means no trace
+    auto generation = detail::last_trace_generation.fetch_add(1, std::memory_order_relaxed) + 1;
+    if (generation == 0)
+      generation = detail::last_trace_generation.fetch_add(1, std::memory_order_relaxed) + 1;
+    detail::trace_generation.store(generation, std::memory_order_release);
+    return true;
+  }
+
+  void stop_allocation_trace() { detail::trace_generation.store(0, std::memory_order_release); }
+
+  bool start_memory_sampler([[maybe_unused]] std::chrono::nanoseconds interval, [[maybe_unused]] std::size_t capacity, [[maybe_unused]] const std::string_view* scopes,
+                            [[maybe_unused]] std::size_t scope_count)
+  {
+#ifdef _WIN32
+    return false;
+#else
+    auto&            state = detail::get_memory_sampler_state();
+    std::scoped_lock lock{state.control_mutex};
+    if (state.running || interval <= interval.zero() || scope_count > max_sampled_scope_count)
+      return false;
+
+    for (std::size_t i = 0; i < scope_count; ++i)
+      state.scopes[i] = detail::register_scope(scopes[i]);
+    state.scope_count = scope_count;
+    if (!state.series.allocate(detail::sampler_counter_column_count + scope_count, capacity))
+      return false;
+
+    state.interval       = interval;
+    state.stop_requested = false;
+    if (::pthread_create(&state.thread, nullptr, &detail::memory_sampler_thread, &state) != 0)
+    {
+      state.series.release();
+      return false;
+    }
+    state.running = true;
+    return true;
+#endif
+  }
+
+  void stop_memory_sampler()
+  {
+#ifndef _WIN32
+    auto&            state = detail::get_memory_sampler_state();
+    std::scoped_lock lock{state.control_mutex};
+    if (!state.running)
+      return;
+
+    {
+      std::scoped_lock wake_lock{state.wake_mutex};
+      state.stop_requested = true;
+    }
+    state.wake.notify_one();
+    ::pthread_join(state.thread, nullptr);
+    state.running = false;
+#endif
+  }
+
+  memory_time_series get_memory_time_series()
+  {
+    auto&            state = detail::get_memory_sampler_state();
+    std::scoped_lock lock{state.control_mutex};
+
+    const auto&        series = state.series;
+    memory_time_series infos{series.size(), state.scope_count, series.column(0), series.column(1), series.column(2), series.column(3), series.column(4), series.column(5), {}};
+    for (std::size_t i = 0; i < state.scope_count; ++i)
+      infos.scope_live_memory[i] = series.column(detail::sampler_counter_column_count + i);
+    return infos;
+  }
+
+  bool write_memory_time_series(std::string_view path, time_series_format format)
+  {
+    char file_path[detail::max_trace_path_length];
+    if (path.size() >= sizeof(file_path))
+      return false;
+    std::memcpy(file_path, path.data(), path.size());
+    file_path[path.size()] = '\0';
+
+    auto&            state = detail::get_memory_sampler_state();
+    std::scoped_lock lock{state.control_mutex};
+
+    std::array<std::string_view, detail::sampler_counter_column_count + max_sampled_scope_count> column_names{
+      "timestamp_ns", "resident_memory", "live_memory", "allocation_count", "deallocation_count", "total_memory_allocated"};
+    for (std::size_t i = 0; i < state.scope_count; ++i)
+      column_names[detail::sampler_counter_column_count + i] = detail::get_scope(state.scopes[i]).name;
+
+    return format == time_series_format::csv ? state.series.write_csv(file_path, column_names.data()) : state.series.write_binary(file_path, column_names.data());
+  }
+
+  std::size_t register_allocator_backend(const allocator_backend& backend)
+  {
+    std::scoped_lock lock{detail::allocator_backend_registration_mutex};
+
+    auto index = detail::allocator_backend_count.load(std::memory_order_relaxed);
+    if (index >= max_allocator_backend_count)
+      throw std::length_error("MicrobenchMemory: too many allocator backends.");
+
+    detail::allocator_backends[index] = backend;
+    detail::allocator_backend_count.store(index + 1, std::memory_order_release);
+    return index;
+  }
+
+  void set_allocator_backend(std::size_t index)
+  {
+    if (index >= detail::allocator_backend_count.load(std::memory_order_acquire))
+      throw std::out_of_range("MicrobenchMemory: unknown allocator backend.");
+    detail::current_allocator_backend.store(index, std::memory_order_release);
+  }
+
+  std::size_t get_allocator_backend() { return detail::current_allocator_backend.load(std::memory_order_acquire); }
+
+  const char* get_allocator_backend_name(std::size_t index)
+  {
+    if (index >= detail::allocator_backend_count.load(std::memory_order_acquire))
+      throw std::out_of_range("MicrobenchMemory: unknown allocator backend.");
+    return detail::allocator_backends[index].name;
+  }
+
+  void reset_bump_arena() { detail::builtin_arena.reset(); }
+
+  scoped_memory_informations get_region_memory_information_snapshot(std::string_view path)
+  {
+    auto        id    = detail::register_scope(path);
+    const auto& entry = detail::get_scope(id);
+    auto        infos = entry.infos.to_user_info(entry.name);
+
+    // the nested regions are the scopes named after the path followed by '/', contiguous in the ordered registry
+    auto&            registry = detail::get_scope_registry();
+    std::scoped_lock lock{registry.mutex};
+    for (auto it = registry.ids.upper_bound(path); it != registry.ids.end() && it->first.starts_with(path); ++it)
+      if (it->first[path.size()] == '/')
+        infos = infos + detail::get_scope(it->second).infos.to_user_info(it->first);
+    infos.scope = entry.name;
+    return infos;
+  }
+
+  object_pool_statistics get_object_pool_statistics(std::string_view scope)
+  {
+    auto index = detail::get_scope(detail::register_scope(scope)).pool_index.load(std::memory_order_acquire);
+    if (index == 0 || index == detail::no_object_pool)
+      return {};
+
+    std::size_t cached = 0, allocation_count = 0, hits = 0;
+    for (auto* cache = detail::pool_thread_caches.load(std::memory_order_acquire); cache; cache = cache->next)
+    {
+      const auto& entry = cache->entries[index - 1];
+      cached += entry.count.load(std::memory_order_relaxed);
+      allocation_count += entry.allocation_count.load(std::memory_order_relaxed);
+      hits += entry.hits.load(std::memory_order_relaxed);
+    }
+
+    // the counters are read while the threads keep moving blocks around, the difference can't go below 0
+    const auto& pool = *detail::object_pools[index - 1].load(std::memory_order_acquire);
+    auto        idle = pool.free_count() + cached;
+    auto        live = pool.carved_count() > idle ? pool.carved_count() - idle : 0;
+    return {pool.block_size(), pool.slab_count(), pool.capacity(), live, allocation_count, hits};
+  }
+
+  void set_backtrace_mode(backtrace_mode mode) { detail::backtrace_capture.store(mode, std::memory_order_relaxed); }
+
+  std::size_t get_top_allocation_sites(allocation_site* sites, std::size_t count, allocation_site_order order)
+  {
+    if (count == 0)
+      return 0;
+
+    auto key     = [order](const allocation_site& site) { return order == allocation_site_order::by_bytes ? site.total_memory_allocated : site.allocation_count; };
+    auto greater = [&key](const allocation_site& lhs, const allocation_site& rhs) { return key(lhs) > key(rhs); };
+
+    // the buffer is a min-heap of the best sites seen so far
+    const auto& trie = detail::get_stack_trie();
+    std::size_t size = 0;
+    trie.for_each_stack([&](detail::stack_trie::node_id id, std::uint64_t allocation_count, std::uint64_t total_memory_allocated) {
+      allocation_site site{allocation_count, total_memory_allocated, 0, {}};
+      if (size == count)
+      {
+        if (!greater(site, sites[0]))
+          return;
+        std::pop_heap(sites, sites + size, greater);
+        --size;
+      }
+      site.depth    = trie.frames(id, site.frames.data(), site.frames.size());
+      sites[size++] = site;
+      std::push_heap(sites, sites + size, greater);
+    });
+    std::sort_heap(sites, sites + size, greater);
+    return size;
+  }
 
 } // namespace MicrobenchMemory
@@ -0,0 +1,118 @@
+#pragma once
+
+#include "detail/system_allocator.hpp"
+
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+#include <new>
+
+namespace MicrobenchMemory::detail
+{
+  /*
+  every instrumented allocation is prefixed by a small header so that deallocations always learn the freed size,
+  even through the unsized delete overloads
+
+  the header sits right before the pointer handed to the user, the offset gives back the start of the underlying
+  block: it is the header size for regular allocations, and the alignment for over-aligned ones
+  the flags also keep the index of the backing allocator the block comes from, and the region it was allocated in
+  */
+  struct allocation_header
+  {
+    std::size_t   size;
+    std::uint32_t offset;
+    std::uint32_t flags;
+  };
+
+  inline constexpr std::size_t allocation_header_size = 16;
+  static_assert(sizeof(allocation_header) <= allocation_header_size);
+
+  enum allocation_flags : std::uint32_t
+  {
+    allocation_flag_aligned = 1u << 0,
+    // recorded by the scope registry: every allocation when sampling is disabled, only the sampled ones otherwise
+    allocation_flag_sampled = 1u << 1,
+    // block of an object pool, see MICROBENCH_MEMORY_INSTRUMENT_POOLED_CLASS
+    allocation_flag_pooled = 1u << 2,
+    // not in the global counters: allocated by the malloc family from within the instrumentation, see managed_malloc, or
+    // for the upstream resource of a tracking_memory_resource, see managed_upstream_new
+    allocation_flag_untracked = 1u << 3,
+    // counted by the slack tracking, see log_allocation_slack
+    allocation_flag_slack_measured = 1u << 4,
+  };
+
+  inline constexpr std::uint32_t allocation_backend_shift = 8;
+  inline constexpr std::uint32_t allocation_backend_mask  = 0xFFu << allocation_backend_shift;
+
+  // scope of the memory_region a global allocation was made in, 0 outside of any region
+  inline constexpr std::uint32_t allocation_region_shift = 16;
+  inline constexpr std::uint32_t allocation_region_mask  = 0xFFFu << allocation_region_shift;
+
+  inline allocation_header& header_of(void* ptr) { return *reinterpret_cast<allocation_header*>(static_cast<std::byte*>(ptr) - allocation_header_size); }
+
+  inline std::uint32_t backend_of(const allocation_header& header) { return (header.flags & allocation_backend_mask) >> allocation_backend_shift; }
+  inline std::uint32_t region_of(const allocation_header& header) { return (header.flags & allocation_region_mask) >> allocation_region_shift; }
+
+  /*
+  whether the header could have been written by allocate_with_header: a debugging check for the blocks that reach the
+  instrumented deallocations without having been allocated by them
+  */
+  inline bool is_plausible_header(const allocation_header& header)
+  {
+    if (header.size > static_cast<std::size_t>(-1) / 2)
+      return false;
+    if (header.flags & allocation_flag_aligned)
+      return header.offset > allocation_header_size && std::has_single_bit(header.offset);
+    return header.offset == allocation_header_size;
+  }
+
+  // The underlying block of an allocation, as requested to its backing allocator
+  struct allocation_block
+  {
+    void*       base;
+    std::size_t size;
+    std::size_t alignment;
+  };
+
+  inline allocation_block block_of(void* ptr)
+  {
+    const auto& header    = header_of(ptr);
+    std::size_t alignment = header.offset;
+    std::size_t size      = header.offset + header.size;
+    if (header.flags & allocation_flag_aligned)
+      size = (size + alignment - 1) & ~(alignment - 1);
+    return {static_cast<std::byte*>(ptr) - header.offset, size, alignment};
+  }
+
+  /*
+  the underlying block is requested to allocate(size, alignment), which returns nullptr on failure: the alignment is at
+  least the header size, and for over-aligned blocks the size is a multiple of it, as aligned_alloc wants
+  */
+  // Returns nullptr on failure. An alignment of 0 means the default new alignment.
+  template <typename Allocate>
+  [[nodiscard]] inline void* allocate_with_header(std::size_t sz, std::size_t alignment, std::uint32_t backend_index, Allocate&& allocate) noexcept
+  {
+    if (sz > static_cast<std::size_t>(-1) / 2)
+      return nullptr;
+
+    std::uint32_t offset = allocation_header_size;
+    std::uint32_t flags  = backend_index << allocation_backend_shift;
+    std::size_t   size   = allocation_header_size + sz;
+
+    if (alignment > allocation_header_size)
+    {
+      // the header lives in the padding in front of the aligned pointer
+      offset = static_cast<std::uint32_t>(alignment);
+      flags |= allocation_flag_aligned;
+      size = (alignment + sz + alignment - 1) & ~(alignment - 1);
+    }
+
+    auto* base = static_cast<std::byte*>(allocate(size, std::size_t{offset}));
+    if (!base)
+      return nullptr;
+
+    auto* ptr = base + offset;
+    new (ptr - allocation_header_size) allocation_header{sz, offset, flags};
+    return ptr;
+  }
+} // namespace MicrobenchMemory::detail
@@ -0,0 +1,107 @@
+#pragma once
+
+#include "detail/page_allocator.hpp"
+#include "detail/spin_lock.hpp"
+
+#include <algorithm>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <mutex>
+
+namespace MicrobenchMemory::detail
+{
+  /*
+  bump arena allocator
+  each thread bumps a cursor in its own chunk, the deallocations are no-ops: the memory is only reclaimed all at once,
+  by a reset
+  the chunks come from the page allocator and are linked together so that the reset can give them back to the OS
+
+  there is a single arena in the program: the cursor of a thread is only valid for the generation of the arena it was
+  taken in, which a reset bumps
+  */
+  class bump_arena
+  {
+    static constexpr std::size_t chunk_size        = 1024 * 1024;
+    static constexpr std::size_t chunk_header_size = 64;
+
+  public:
+    bump_arena() = default;
+
+    bump_arena(const bump_arena&)            = delete;
+    bump_arena& operator=(const bump_arena&) = delete;
+
+    // Returns nullptr on failure, the alignment is a power of two
+    void* allocate(std::size_t size, std::size_t alignment)
+    {
+      thread_local thread_cursor cursor;
+
+      auto generation = generation_.load(std::memory_order_acquire);
+      if (cursor.generation != generation)
+        cursor = {nullptr, nullptr, generation};
+
+      auto* block = align_up(cursor.position, alignment);
+      if (!cursor.position || block + size > cursor.end)
+      {
+        auto  bytes = std::max(chunk_size, chunk_header_size + size + alignment);
+        auto* chunk = new_chunk(bytes);
+        if (!chunk)
+          return nullptr;
+        cursor.position = chunk + chunk_header_size;
+        cursor.end      = chunk + bytes;
+        block           = align_up(cursor.position, alignment);
+      }
+      cursor.position = block + size;
+      return block;
+    }
+
+    // Gives all the memory back: no block of the arena may still be used, nor allocated concurrently
+    void reset()
+    {
+      std::scoped_lock lock{lock_};
+      while (chunks_)
+      {
+        auto* next = chunks_->next;
+        deallocate_pages(chunks_, chunks_->bytes);
+        chunks_ = next;
+      }
+      generation_.fetch_add(1, std::memory_order_release);
+    }
+
+  private:
+    struct chunk_header
+    {
+      chunk_header* next;
+      std::size_t   bytes;
+    };
+
+    struct thread_cursor
+    {
+      std::byte*    position   = nullptr;
+      std::byte*    end        = nullptr;
+      std::uint64_t generation = 0;
+    };
+
+    static std::byte* align_up(std::byte* ptr, std::size_t alignment)
+    {
+      auto address = reinterpret_cast<std::uintptr_t>(ptr);
+      return ptr + (((address + alignment - 1) & ~(alignment - 1)) - address);
+    }
+
+    std::byte* new_chunk(std::size_t bytes)
+    {
+      auto* chunk = static_cast<chunk_header*>(allocate_pages(bytes));
+      if (!chunk)
+        return nullptr;
+
+      std::scoped_lock lock{lock_};
+      *chunk  = {chunks_, bytes};
+      chunks_ = chunk;
+      return reinterpret_cast<std::byte*>(chunk);
+    }
+
+    spin_lock                  lock_;
+    chunk_header*              chunks_ = nullptr;
+    std::atomic<std::uint64_t> generation_{1};
+  };
+} // namespace MicrobenchMemory::detail
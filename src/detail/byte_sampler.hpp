@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cmath>
+#include <cstddef>
+#include <cstdint>
+
+namespace MicrobenchMemory::detail
+{
+  /*
+  byte-interval poisson sampler, one per thread
+
+  the allocated bytes are seen as a stream on which sampling points are laid with exponentially distributed gaps of
+  mean `interval`: an allocation is sampled when it covers at least one of them, which happens with probability
+  1 - exp(-size / interval)
+  the common case is a single decrement of the countdown to the next sampling point
+  */
+  class byte_sampler
+  {
+  public:
+    // Returns true if the allocation is sampled
+    bool sample(std::size_t sz, std::size_t interval)
+    {
+      if (interval != interval_) [[unlikely]]
+        reset(interval);
+
+      bytes_until_sample_ -= static_cast<std::int64_t>(sz);
+      if (bytes_until_sample_ > 0) [[likely]]
+        return false;
+
+      // several sampling points may fall in a large allocation, it is sampled only once
+      do
+        bytes_until_sample_ += next_gap();
+      while (bytes_until_sample_ <= 0);
+      return true;
+    }
+
+    // Probability for an allocation of this size to be sampled
+    static double probability(std::size_t sz, std::size_t interval)
+    {
+      if (interval == 0)
+        return 1.;
+      return -std::expm1(-static_cast<double>(sz) / static_cast<double>(interval));
+    }
+
+  private:
+    void reset(std::size_t interval)
+    {
+      interval_           = interval;
+      bytes_until_sample_ = next_gap();
+    }
+
+    std::int64_t next_gap()
+    {
+      // uniform in (0, 1], from the 53 high bits of the generator
+      double uniform = static_cast<double>((next_random() >> 11) + 1) * 0x1.0p-53;
+      auto   gap     = static_cast<std::int64_t>(-std::log(uniform) * static_cast<double>(interval_));
+      return gap > 0 ? gap : 1;
+    }
+
+    // splitmix64: cheap, and good enough to draw the gaps
+    std::uint64_t next_random()
+    {
+      std::uint64_t z = (state_ += 0x9E3779B97F4A7C15ull);
+      z               = (z ^ (z >> 30)) * 0xBF58476D1CE4E5B9ull;
+      z               = (z ^ (z >> 27)) * 0x94D049BB133111EBull;
+      return z ^ (z >> 31);
+    }
+
+    std::int64_t  bytes_until_sample_ = 0;
+    std::size_t   interval_           = 0;
+    std::uint64_t state_              = reinterpret_cast<std::uintptr_t>(this);
+  };
+} // namespace MicrobenchMemory::detail
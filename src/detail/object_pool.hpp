@@ -0,0 +1,108 @@
+#pragma once
+
+#include "detail/page_allocator.hpp"
+#include "detail/spin_lock.hpp"
+
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <mutex>
+
+namespace MicrobenchMemory::detail
+{
+  struct pool_free_block
+  {
+    pool_free_block* next;
+  };
+
+  /*
+  fixed-size object pool, shared by all the threads
+  the blocks are carved from slabs taken from the page allocator, and recycled through a free list; the threads mostly
+  work in their own cache of blocks (see pool_thread_cache) and only come here by batches
+  the slabs are never given back to the OS
+  */
+  class object_pool
+  {
+    static constexpr std::size_t min_slab_size   = 64 * 1024;
+    static constexpr std::size_t min_slab_blocks = 16;
+
+  public:
+    explicit object_pool(std::size_t block_size) : block_size_{block_size} {}
+
+    object_pool(const object_pool&)            = delete;
+    object_pool& operator=(const object_pool&) = delete;
+
+    std::size_t block_size() const { return block_size_; }
+
+    // Links up to count blocks in front of head, recycled ones first. Returns the number of blocks taken.
+    std::size_t acquire(pool_free_block*& head, std::size_t count)
+    {
+      std::scoped_lock lock{lock_};
+
+      std::size_t taken = 0;
+      for (; taken < count && free_; ++taken)
+      {
+        auto* block = free_;
+        free_       = block->next;
+        block->next = head;
+        head        = block;
+      }
+      free_count_.store(free_count_.load(std::memory_order_relaxed) - taken, std::memory_order_relaxed);
+
+      std::size_t carved = 0;
+      for (; taken < count; ++taken, ++carved)
+      {
+        if (static_cast<std::size_t>(end_ - cursor_) < block_size_ && !add_slab())
+          break;
+        auto* block = reinterpret_cast<pool_free_block*>(cursor_);
+        cursor_ += block_size_;
+        block->next = head;
+        head        = block;
+      }
+      carved_.store(carved_.load(std::memory_order_relaxed) + carved, std::memory_order_relaxed);
+      return taken;
+    }
+
+    // Gives back the chain of count blocks from head to tail
+    void release(pool_free_block* head, pool_free_block* tail, std::size_t count)
+    {
+      std::scoped_lock lock{lock_};
+      tail->next = free_;
+      free_      = head;
+      free_count_.store(free_count_.load(std::memory_order_relaxed) + count, std::memory_order_relaxed);
+    }
+
+    std::size_t slab_count() const { return slab_count_.load(std::memory_order_relaxed); }
+    std::size_t capacity() const { return capacity_.load(std::memory_order_relaxed); }
+    // Blocks carved from the slabs so far, and the ones back in the shared free list
+    std::size_t carved_count() const { return carved_.load(std::memory_order_relaxed); }
+    std::size_t free_count() const { return free_count_.load(std::memory_order_relaxed); }
+
+  private:
+    bool add_slab()
+    {
+      auto  slab_size = std::max(min_slab_size, min_slab_blocks * block_size_);
+      auto* slab      = static_cast<std::byte*>(allocate_pages(slab_size));
+      if (!slab)
+        return false;
+
+      // the tail of the previous slab is lost, it is smaller than a block
+      cursor_ = slab;
+      end_    = slab + slab_size;
+      slab_count_.store(slab_count_.load(std::memory_order_relaxed) + 1, std::memory_order_relaxed);
+      capacity_.store(capacity_.load(std::memory_order_relaxed) + slab_size / block_size_, std::memory_order_relaxed);
+      return true;
+    }
+
+    const std::size_t        block_size_;
+    spin_lock                lock_;
+    pool_free_block*         free_   = nullptr;
+    std::byte*               cursor_ = nullptr;
+    std::byte*               end_    = nullptr;
+    std::atomic<std::size_t> free_count_{0};
+    std::atomic<std::size_t> slab_count_{0};
+    std::atomic<std::size_t> capacity_{0};
+    std::atomic<std::size_t> carved_{0};
+  };
+} // namespace MicrobenchMemory::detail
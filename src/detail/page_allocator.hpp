@@ -0,0 +1,49 @@
+#pragma once
+
+#include <cstddef>
+
+#ifdef _WIN32
+#ifndef WIN32_LEAN_AND_MEAN
+#define WIN32_LEAN_AND_MEAN
+#endif
+#ifndef NOMINMAX
+#define NOMINMAX
+#endif
+#include <windows.h>
+#else
+#include <sys/mman.h>
+#endif
+
+namespace MicrobenchMemory::detail
+{
+  /*
+  private memory source of the library internals
+  pages are taken straight from the OS so that the book-keeping never goes through the heap being measured
+  the returned memory is zero-filled and only backed by physical memory once touched
+  */
+  [[nodiscard]] inline void* allocate_pages(std::size_t bytes) noexcept
+  {
+#ifdef _WIN32
+    return ::VirtualAlloc(nullptr, bytes, MEM_RESERVE | MEM_COMMIT, PAGE_READWRITE);
+#else
+#ifdef MAP_NORESERVE
+    constexpr int flags = MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE;
+#else
+    constexpr int flags = MAP_PRIVATE | MAP_ANONYMOUS;
+#endif
+    void* ptr = ::mmap(nullptr, bytes, PROT_READ | PROT_WRITE, flags, -1, 0);
+    return ptr == MAP_FAILED ? nullptr : ptr;
+#endif
+  }
+
+  inline void deallocate_pages(void* ptr, [[maybe_unused]] std::size_t bytes) noexcept
+  {
+    if (!ptr)
+      return;
+#ifdef _WIN32
+    ::VirtualFree(ptr, 0, MEM_RELEASE);
+#else
+    ::munmap(ptr, bytes);
+#endif
+  }
+} // namespace MicrobenchMemory::detail
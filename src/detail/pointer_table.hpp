@@ -0,0 +1,214 @@
+#pragma once
+
+#include "detail/page_allocator.hpp"
+
+#include <array>
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <optional>
+
+namespace MicrobenchMemory::detail
+{
+  struct internal_ptr_infos
+  {
+    std::size_t size              = 0;
+    std::size_t sampling_interval = 0;
+
+    // lifetime profiling, the allocating thread is 0 when the pointer isn't profiled
+    std::uint64_t allocation_ticks        = 0;
+    std::uint64_t thread_allocation_index = 0;
+    std::uint32_t thread                  = 0;
+    std::uint32_t thread_live_count       = 0;
+  };
+
+  /*
+  lock-free registry of live pointers
+
+  flat open addressing: a pointer hashes to a home slot and lives in the fixed-size probing window that starts there
+  lookups always scan the whole window instead of stopping at the first empty slot, so erasing is a plain reset of the
+  slot and no tombstone is ever needed
+
+  when every window a pointer can go to is full, a new level eight times as large as the previous one is added
+  levels are never rehashed nor moved, which keeps insert and erase lock-free
+  the storage of each level comes from the private page allocator
+  */
+  class pointer_table
+  {
+    struct slot
+    {
+      std::atomic<void*> ptr;
+      internal_ptr_infos infos;
+    };
+
+    static constexpr std::size_t   window_size       = 16;
+    static constexpr std::size_t   first_level_bits  = 12;
+    static constexpr std::size_t   level_growth_bits = 3;
+    static constexpr std::size_t   max_level_count   = 8;
+    static constexpr std::uint64_t hash_multiplier   = 0x9E3779B97F4A7C15ull;
+
+  public:
+    pointer_table() = default;
+
+    pointer_table(const pointer_table&)            = delete;
+    pointer_table& operator=(const pointer_table&) = delete;
+
+    ~pointer_table()
+    {
+      for (std::size_t i = 0; i < max_level_count; ++i)
+        deallocate_pages(levels_[i].load(std::memory_order_relaxed), level_bytes(i));
+    }
+
+    // Returns false if the table can't grow anymore
+    bool insert(void* ptr, internal_ptr_infos infos)
+    {
+      const auto hash = hash_ptr(ptr);
+
+      // newest levels are the emptiest ones, try them first
+      auto level_count = level_count_.load(std::memory_order_acquire);
+      for (auto i = level_count; i > 0; --i)
+        if (try_insert(i - 1, hash, ptr, infos))
+          return true;
+
+      for (auto i = level_count; i < max_level_count; ++i)
+      {
+        if (!ensure_level(i))
+          return false;
+        if (try_insert(i, hash, ptr, infos))
+          return true;
+      }
+      return false;
+    }
+
+    // Returns the infos the pointer was registered with, or nothing if it is not in the table
+    std::optional<internal_ptr_infos> erase(void* ptr)
+    {
+      const auto hash = hash_ptr(ptr);
+
+      for (auto i = level_count_.load(std::memory_order_acquire); i > 0; --i)
+      {
+        auto* slots = levels_[i - 1].load(std::memory_order_acquire);
+        auto  mask  = level_size(i - 1) - 1;
+        auto  home  = home_index(hash, i - 1);
+        for (std::size_t j = 0; j < window_size; ++j)
+        {
+          auto& s = slots[(home + j) & mask];
+          if (s.ptr.load(std::memory_order_acquire) == ptr)
+          {
+            // read the infos before releasing the slot to a concurrent insert
+            auto infos = s.infos;
+            s.ptr.store(nullptr, std::memory_order_release);
+            return infos;
+          }
+        }
+      }
+      return std::nullopt;
+    }
+
+    // Calls f(ptr, infos) for each live pointer. Meant to be used when the table is quiescent.
+    template <typename F>
+    void for_each(F&& f) const
+    {
+      auto level_count = level_count_.load(std::memory_order_acquire);
+      for (std::size_t i = 0; i < level_count; ++i)
+      {
+        const auto* slots = levels_[i].load(std::memory_order_acquire);
+        for (std::size_t j = 0; j < level_size(i); ++j)
+          if (auto* ptr = slots[j].ptr.load(std::memory_order_acquire))
+            f(ptr, slots[j].infos);
+      }
+    }
+
+    /*
+    Calls f(ptr, infos) for the live pointers found from the slot position, until max_count of them are visited or the
+    end of the table is reached, and moves position past the last visited slot. Returns the number of pointers visited.
+    Can run concurrently with insertions and erasures, which may or may not be seen.
+    */
+    template <typename F>
+    std::size_t for_each_from(std::size_t& position, std::size_t max_count, F&& f) const
+    {
+      std::size_t visited = 0;
+      std::size_t first   = 0;
+      auto        count   = level_count_.load(std::memory_order_acquire);
+      for (std::size_t i = 0; i < count && visited < max_count; first += level_size(i), ++i)
+      {
+        if (position >= first + level_size(i))
+          continue;
+
+        const auto* slots = levels_[i].load(std::memory_order_acquire);
+        for (auto j = position - first; j < level_size(i) && visited < max_count; ++j)
+        {
+          position = first + j + 1;
+          if (auto* ptr = slots[j].ptr.load(std::memory_order_acquire))
+          {
+            f(ptr, slots[j].infos);
+            ++visited;
+          }
+        }
+      }
+      return visited;
+    }
+
+  private:
+    static std::uint64_t hash_ptr(void* ptr)
+    {
+      std::uint64_t address = reinterpret_cast<std::uintptr_t>(ptr);
+      return address * hash_multiplier;
+    }
+
+    static constexpr std::size_t level_bits(std::size_t level) { return first_level_bits + level * level_growth_bits; }
+    static constexpr std::size_t level_size(std::size_t level) { return std::size_t{1} << level_bits(level); }
+    static constexpr std::size_t level_bytes(std::size_t level) { return level_size(level) * sizeof(slot); }
+
+    // fibonacci hashing: the top bits of the product are the best mixed ones
+    static std::size_t home_index(std::uint64_t hash, std::size_t level)
+    {
+      std::size_t index = hash >> (64 - level_bits(level));
+      return index;
+    }
+
+    bool try_insert(std::size_t level, std::uint64_t hash, void* ptr, internal_ptr_infos infos)
+    {
+      auto* slots = levels_[level].load(std::memory_order_acquire);
+      auto  mask  = level_size(level) - 1;
+      auto  home  = home_index(hash, level);
+      for (std::size_t j = 0; j < window_size; ++j)
+      {
+        auto& s        = slots[(home + j) & mask];
+        void* expected = nullptr;
+        if (s.ptr.load(std::memory_order_relaxed) == nullptr && s.ptr.compare_exchange_strong(expected, ptr, std::memory_order_acq_rel))
+        {
+          // the pointer is not handed to the user yet, nobody can look for it before the infos are written
+          s.infos = infos;
+          return true;
+        }
+      }
+      return false;
+    }
+
+    bool ensure_level(std::size_t level)
+    {
+      if (!levels_[level].load(std::memory_order_acquire))
+      {
+        // zero-filled pages are valid empty slots
+        auto* slots = static_cast<slot*>(allocate_pages(level_bytes(level)));
+        if (!slots)
+          return false;
+
+        slot* expected = nullptr;
+        if (!levels_[level].compare_exchange_strong(expected, slots, std::memory_order_acq_rel))
+          deallocate_pages(slots, level_bytes(level));
+      }
+
+      // publish the level before anything is inserted in it so that erase always sees it
+      auto count = level_count_.load(std::memory_order_acquire);
+      while (count < level + 1 && !level_count_.compare_exchange_weak(count, level + 1, std::memory_order_acq_rel))
+      {
+      }
+      return true;
+    }
+
+    std::array<std::atomic<slot*>, max_level_count> levels_{};
+    std::atomic<std::size_t>                        level_count_{0};
+  };
+} // namespace MicrobenchMemory::detail
@@ -0,0 +1,68 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+
+#if defined(__linux__)
+#include <fcntl.h>
+#include <unistd.h>
+#endif
+
+namespace MicrobenchMemory::detail
+{
+  /*
+  resident memory of the process, read from /proc/self/statm (linux only, 0 elsewhere)
+  the file is kept open and read again in place, without going through the heap
+  */
+  class resident_memory_reader
+  {
+  public:
+    resident_memory_reader()
+    {
+#if defined(__linux__)
+      fd_        = ::open("/proc/self/statm", O_RDONLY | O_CLOEXEC);
+      page_size_ = static_cast<std::uint64_t>(::sysconf(_SC_PAGESIZE));
+#endif
+    }
+
+    resident_memory_reader(const resident_memory_reader&)            = delete;
+    resident_memory_reader& operator=(const resident_memory_reader&) = delete;
+
+    ~resident_memory_reader()
+    {
+#if defined(__linux__)
+      if (fd_ >= 0)
+        ::close(fd_);
+#endif
+    }
+
+    // In bytes, 0 if unknown
+    std::uint64_t read() const
+    {
+#if defined(__linux__)
+      if (fd_ < 0)
+        return 0;
+
+      // "size resident shared text lib data dt", in pages
+      char buffer[128];
+      auto length = ::pread(fd_, buffer, sizeof(buffer) - 1, 0);
+      if (length <= 0)
+        return 0;
+      buffer[length] = '\0';
+
+      char* resident = nullptr;
+      std::strtoull(buffer, &resident, 10);
+      return std::strtoull(resident, nullptr, 10) * page_size_;
+#else
+      return 0;
+#endif
+    }
+
+  private:
+#if defined(__linux__)
+    int           fd_        = -1;
+    std::uint64_t page_size_ = 0;
+#endif
+  };
+} // namespace MicrobenchMemory::detail
@@ -0,0 +1,99 @@
+#pragma once
+
+#include "detail/page_allocator.hpp"
+#include "detail/spin_lock.hpp"
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstddef>
+#include <mutex>
+
+namespace MicrobenchMemory::detail
+{
+  /*
+  size-class pool allocator
+  the sizes are rounded up to a class: every 16 bytes up to 1 KiB, then every power of two up to 64 KiB
+  each class keeps a free list of its blocks, and carves new ones from runs of pages taken from the page allocator
+  the memory of the pool is never given back to the OS
+
+  like jemalloc, the pool is split in arenas, each thread working with one of them to spread the contention; a freed
+  block goes to the free list of the thread that frees it
+  */
+  class size_class_pool
+  {
+    static constexpr std::size_t small_class_count = 64;
+    static constexpr std::size_t class_count       = small_class_count + 6;
+    static constexpr std::size_t min_run_size      = 64 * 1024;
+
+  public:
+    static constexpr std::size_t max_size    = 64 * 1024;
+    static constexpr std::size_t arena_count = 16;
+
+    // Returns nullptr on failure, the size must be at most max_size
+    void* allocate(std::size_t size, std::size_t arena_index)
+    {
+      auto  size_class = class_of(size);
+      auto& list       = arenas_[arena_index % arena_count][size_class];
+
+      std::scoped_lock lock{list.lock};
+      if (auto* block = list.head)
+      {
+        list.head = block->next;
+        return block;
+      }
+
+      auto block_size = class_size(size_class);
+      if (list.cursor + block_size > list.end)
+      {
+        auto  run_size = std::max(min_run_size, 16 * block_size);
+        auto* run      = static_cast<std::byte*>(allocate_pages(run_size));
+        if (!run)
+          return nullptr;
+        list.cursor = run;
+        list.end    = run + run_size;
+      }
+      auto* block = list.cursor;
+      list.cursor += block_size;
+      return block;
+    }
+
+    // Size of the blocks of the class the size falls in
+    static std::size_t usable_size(std::size_t size) { return class_size(class_of(size)); }
+
+    void deallocate(void* ptr, std::size_t size, std::size_t arena_index)
+    {
+      auto& list  = arenas_[arena_index % arena_count][class_of(size)];
+      auto* block = static_cast<free_block*>(ptr);
+
+      std::scoped_lock lock{list.lock};
+      block->next = list.head;
+      list.head   = block;
+    }
+
+  private:
+    struct free_block
+    {
+      free_block* next;
+    };
+
+    struct alignas(64) size_class_list
+    {
+      spin_lock   lock;
+      free_block* head   = nullptr;
+      std::byte*  cursor = nullptr;
+      std::byte*  end    = nullptr;
+    };
+
+    static std::size_t class_of(std::size_t size)
+    {
+      if (size <= small_class_count * 16)
+        return size == 0 ? 0 : (size - 1) / 16;
+      return small_class_count + static_cast<std::size_t>(64 - std::countl_zero(size - 1)) - 11;
+    }
+
+    static std::size_t class_size(std::size_t size_class) { return size_class < small_class_count ? (size_class + 1) * 16 : std::size_t{2048} << (size_class - small_class_count); }
+
+    std::array<std::array<size_class_list, class_count>, arena_count> arenas_{};
+  };
+} // namespace MicrobenchMemory::detail
@@ -0,0 +1,58 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <thread>
+
+namespace MicrobenchMemory::detail
+{
+  /*
+  seqlock for a group of counters updated by several threads at once
+  the writers never wait: they count the updates they begin and the ones they finish, and a reader retries until no
+  update began during its read nor was still running when it started; it then saw every counter of the group at the
+  same point of the updates
+
+  the counters themselves stay atomics written with relaxed operations, only the sequence orders them
+  */
+  class snapshot_sequence
+  {
+  public:
+    constexpr snapshot_sequence() = default;
+
+    void begin_update()
+    {
+      begun_.fetch_add(1, std::memory_order_relaxed);
+      // the counter updates can't be seen before the update is counted as begun
+      std::atomic_thread_fence(std::memory_order_release);
+    }
+
+    void end_update() { done_.fetch_add(1, std::memory_order_release); }
+
+    /*
+    Calls read() until it ran while no update was in progress
+    past a few attempts the reader yields: the update it keeps seeing may come from a writer that was preempted in the
+    middle of it
+    */
+    template <typename F>
+    void read(F&& read) const
+    {
+      for (std::size_t attempt = 0;; ++attempt)
+      {
+        auto done = done_.load(std::memory_order_acquire);
+        read();
+        std::atomic_thread_fence(std::memory_order_acquire);
+        if (begun_.load(std::memory_order_relaxed) == done)
+          return;
+        if (attempt >= spin_attempts)
+          std::this_thread::yield();
+      }
+    }
+
+  private:
+    static constexpr std::size_t spin_attempts = 16;
+
+    std::atomic<std::uint64_t> begun_{0};
+    std::atomic<std::uint64_t> done_{0};
+  };
+} // namespace MicrobenchMemory::detail
@@ -0,0 +1,24 @@
+#pragma once
+
+#include <atomic>
+
+namespace MicrobenchMemory::detail
+{
+  // Lock for the very short critical sections of the built-in allocators, which can't call into the heap
+  class spin_lock
+  {
+  public:
+    void lock()
+    {
+      while (flag_.test_and_set(std::memory_order_acquire))
+        while (flag_.test(std::memory_order_relaxed))
+        {
+        }
+    }
+
+    void unlock() { flag_.clear(std::memory_order_release); }
+
+  private:
+    std::atomic_flag flag_ = ATOMIC_FLAG_INIT;
+  };
+} // namespace MicrobenchMemory::detail
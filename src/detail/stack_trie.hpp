@@ -0,0 +1,145 @@
+#pragma once
+
+#include "detail/page_allocator.hpp"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+
+namespace MicrobenchMemory::detail
+{
+  /*
+  hash-consed trie of the call stacks
+
+  a node is a frame together with the node of its caller: two stacks sharing their outermost frames share the nodes of
+  these frames, and a whole stack is identified by the node of its innermost frame
+  the nodes are interned in a lock-free open-addressing table keyed on (caller node, return address), and never
+  removed: the statistics of a stack are kept in its innermost node
+
+  the storage comes from the private page allocator, only the pages that are used are backed by physical memory
+  */
+  class stack_trie
+  {
+  public:
+    using node_id = std::uint32_t;
+
+    // the empty stack, also the stack of everything that doesn't fit in the trie anymore
+    static constexpr node_id root = 0;
+
+    stack_trie()
+      : nodes_(static_cast<node*>(allocate_pages(node_capacity * sizeof(node))))
+      , slots_(static_cast<std::atomic<node_id>*>(allocate_pages(slot_count * sizeof(std::atomic<node_id>))))
+    {
+    }
+
+    stack_trie(const stack_trie&)            = delete;
+    stack_trie& operator=(const stack_trie&) = delete;
+
+    ~stack_trie()
+    {
+      deallocate_pages(nodes_, node_capacity * sizeof(node));
+      deallocate_pages(slots_, slot_count * sizeof(std::atomic<node_id>));
+    }
+
+    // frames are given innermost first
+    node_id insert(void* const* frames, std::size_t depth)
+    {
+      if (!nodes_ || !slots_)
+        return root;
+
+      node_id id = root;
+      for (auto i = depth; i > 0; --i)
+      {
+        id = find_or_insert_child(id, reinterpret_cast<std::uintptr_t>(frames[i - 1]));
+        if (id == root)
+          break;
+      }
+      return id;
+    }
+
+    void record(node_id id, std::uint64_t count, std::uint64_t bytes)
+    {
+      auto& n = id == root ? root_ : nodes_[id];
+      n.allocation_count.fetch_add(count, std::memory_order_relaxed);
+      n.total_memory_allocated.fetch_add(bytes, std::memory_order_relaxed);
+    }
+
+    // Writes the frames of the stack, innermost first, returns the depth
+    std::size_t frames(node_id id, void** out, std::size_t max_depth) const
+    {
+      std::size_t depth = 0;
+      for (; id != root && depth < max_depth; id = nodes_[id].parent)
+        out[depth++] = reinterpret_cast<void*>(nodes_[id].pc);
+      return depth;
+    }
+
+    // Calls f(id, allocation_count, total_memory_allocated) for each stack that allocated
+    template <typename F>
+    void for_each_stack(F&& f) const
+    {
+      visit(root, root_, f);
+      auto count = next_node_.load(std::memory_order_acquire);
+      for (node_id id = 1; id < count && id < node_capacity; ++id)
+        visit(id, nodes_[id], f);
+    }
+
+  private:
+    struct node
+    {
+      std::uintptr_t             pc;
+      node_id                    parent;
+      std::atomic<std::uint64_t> allocation_count;
+      std::atomic<std::uint64_t> total_memory_allocated;
+    };
+
+    static constexpr std::size_t   node_capacity   = std::size_t{1} << 20;
+    static constexpr std::size_t   slot_count      = node_capacity * 2;
+    static constexpr std::uint64_t hash_multiplier = 0x9E3779B97F4A7C15ull;
+
+    template <typename F>
+    static void visit(node_id id, const node& n, F& f)
+    {
+      if (auto count = n.allocation_count.load(std::memory_order_relaxed))
+        f(id, count, n.total_memory_allocated.load(std::memory_order_relaxed));
+    }
+
+    // Returns root when the trie is full
+    node_id find_or_insert_child(node_id parent, std::uintptr_t pc)
+    {
+      std::uint64_t hash = (pc ^ (std::uint64_t{parent} << 40) ^ parent) * hash_multiplier;
+      std::size_t   home = hash >> 43;
+      static_assert(slot_count == std::size_t{1} << 21);
+
+      node_id fresh = root;
+      for (std::size_t i = 0; i < slot_count; ++i)
+      {
+        auto& slot = slots_[(home + i) & (slot_count - 1)];
+        auto  id   = slot.load(std::memory_order_acquire);
+        if (id == root)
+        {
+          // the node is written before being published in the table
+          if (fresh == root)
+          {
+            auto next = next_node_.fetch_add(1, std::memory_order_relaxed);
+            if (next >= node_capacity)
+              return root;
+            fresh                = static_cast<node_id>(next);
+            nodes_[fresh].pc     = pc;
+            nodes_[fresh].parent = parent;
+          }
+          if (slot.compare_exchange_strong(id, fresh, std::memory_order_acq_rel))
+            return fresh;
+        }
+        // either the slot was taken, or another thread just published a node in it
+        if (nodes_[id].pc == pc && nodes_[id].parent == parent)
+          return id;
+      }
+      return root;
+    }
+
+    node*                    nodes_;
+    std::atomic<node_id>*    slots_;
+    std::atomic<std::size_t> next_node_{1};
+    node                     root_{};
+  };
+} // namespace MicrobenchMemory::detail
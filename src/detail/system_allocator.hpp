@@ -0,0 +1,124 @@
+#pragma once
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+
+#if defined(__APPLE__)
+#include <malloc/malloc.h>
+#elif defined(__linux__)
+#include <malloc.h>
+#endif
+
+#if defined(MICROBENCH_MEMORY_PRELOAD)
+#include <dlfcn.h>
+
+// Entry points of the glibc allocator, which the LD_PRELOAD shim reaches directly since it replaces malloc itself
+extern "C"
+{
+  void* __libc_malloc(std::size_t size);
+  void  __libc_free(void* ptr);
+  void* __libc_memalign(std::size_t alignment, std::size_t size);
+}
+#endif
+
+namespace MicrobenchMemory::detail
+{
+  /*
+  allocator underneath the library, for the blocks of the malloc backend and the book-keeping
+  it is malloc, unless the library is built into the LD_PRELOAD shim (tools/src/preload.cpp): malloc then goes through
+  the instrumentation, and the shim calls the allocator of the C library instead
+  */
+  [[nodiscard]] inline void* system_malloc(std::size_t size) noexcept
+  {
+#if defined(MICROBENCH_MEMORY_PRELOAD)
+    return __libc_malloc(size);
+#else
+    return std::malloc(size);
+#endif
+  }
+
+  inline void system_free(void* ptr) noexcept
+  {
+#if defined(MICROBENCH_MEMORY_PRELOAD)
+    __libc_free(ptr);
+#else
+    std::free(ptr);
+#endif
+  }
+
+  // As of MSVC 19.29 (VS 16.11)
+  // std::aligned_alloc is a compiler intrinsic instead of a standard function
+  // As of apple clang, aligned_alloc is not part of std, the c function from stdlib.h is used instead
+  [[nodiscard]] inline void* aligned_malloc(std::size_t alignment, std::size_t size) noexcept
+  {
+#if defined(MICROBENCH_MEMORY_PRELOAD)
+    return __libc_memalign(alignment, size);
+#elif defined(_MSC_VER)
+    return _aligned_malloc(size, alignment);
+#elif defined(__APPLE__)
+    return ::aligned_alloc(alignment, size);
+#else
+    return std::aligned_alloc(alignment, size);
+#endif
+  }
+
+  inline void aligned_free(void* ptr) noexcept
+  {
+#if defined(_MSC_VER)
+    _aligned_free(ptr);
+#else
+    system_free(ptr);
+#endif
+  }
+
+  /*
+  usable size of a block of system_malloc, or of aligned_malloc given its alignment (0 for system_malloc), as reported
+  by the C library: at least the requested size
+  the shim replaces malloc_usable_size as well: the one of the C library is looked up once, behind it
+  */
+  [[nodiscard]] inline std::size_t system_usable_size(void* ptr, [[maybe_unused]] std::size_t alignment, [[maybe_unused]] std::size_t size) noexcept
+  {
+#if defined(MICROBENCH_MEMORY_PRELOAD)
+    using usable_size_function = std::size_t (*)(void*);
+    static std::atomic<usable_size_function> libc_usable_size{nullptr};
+
+    auto function = libc_usable_size.load(std::memory_order_acquire);
+    if (!function)
+    {
+      function = reinterpret_cast<usable_size_function>(::dlsym(RTLD_NEXT, "malloc_usable_size"));
+      if (!function)
+        return size;
+      libc_usable_size.store(function, std::memory_order_release);
+    }
+    return function(ptr);
+#elif defined(_MSC_VER)
+    return alignment != 0 ? _aligned_msize(ptr, alignment, 0) : _msize(ptr);
+#elif defined(__APPLE__)
+    return ::malloc_size(ptr);
+#elif defined(__linux__)
+    return ::malloc_usable_size(ptr);
+#else
+    return size;
+#endif
+  }
+
+  // Memory of the C library allocator in bytes, both 0 if unknown
+  struct system_heap_usage
+  {
+    std::uint64_t size; // obtained from the OS, mapped chunks included
+    std::uint64_t used; // handed out to the program
+  };
+
+  inline system_heap_usage read_system_heap_usage() noexcept
+  {
+#if defined(__GLIBC__) && (__GLIBC__ > 2 || (__GLIBC__ == 2 && __GLIBC_MINOR__ >= 33))
+    // mallinfo2 walks the arenas under their locks, it is meant for occasional reports
+    auto infos = ::mallinfo2();
+    return {infos.arena + infos.hblkhd, infos.uordblks + infos.hblkhd};
+#else
+    return {0, 0};
+#endif
+  }
+} // namespace MicrobenchMemory::detail
@@ -0,0 +1,151 @@
+#pragma once
+
+#include "detail/page_allocator.hpp"
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <cstdio>
+#include <string_view>
+
+namespace MicrobenchMemory::detail
+{
+  /*
+  columnar time series of fixed capacity: each column is a contiguous array of capacity values, all of them in a single
+  block of pages taken when the series is created
+
+  a single writer appends the samples: a sample is published by the release of the size once all its values are
+  written, so that readers can go through the published samples while the writer fills the next ones
+  */
+  class time_series
+  {
+  public:
+    constexpr time_series() = default;
+
+    time_series(const time_series&)            = delete;
+    time_series& operator=(const time_series&) = delete;
+
+    ~time_series() { release(); }
+
+    // Returns false if the pages can't be allocated, the series is then empty
+    bool allocate(std::size_t column_count, std::size_t capacity)
+    {
+      release();
+      if (column_count == 0 || capacity == 0 || capacity > static_cast<std::size_t>(-1) / sizeof(std::uint64_t) / column_count)
+        return false;
+
+      values_ = static_cast<std::uint64_t*>(allocate_pages(column_count * capacity * sizeof(std::uint64_t)));
+      if (!values_)
+        return false;
+      column_count_ = column_count;
+      capacity_     = capacity;
+      return true;
+    }
+
+    void release()
+    {
+      deallocate_pages(values_, column_count_ * capacity_ * sizeof(std::uint64_t));
+      values_       = nullptr;
+      column_count_ = 0;
+      capacity_     = 0;
+      size_.store(0, std::memory_order_relaxed);
+    }
+
+    // Appends a sample of column_count values, returns false if the series is full
+    bool append(const std::uint64_t* sample)
+    {
+      auto index = size_.load(std::memory_order_relaxed);
+      if (index >= capacity_)
+        return false;
+
+      for (std::size_t column = 0; column < column_count_; ++column)
+        values_[column * capacity_ + index] = sample[column];
+      size_.store(index + 1, std::memory_order_release);
+      return true;
+    }
+
+    std::size_t          size() const { return size_.load(std::memory_order_acquire); }
+    std::size_t          capacity() const { return capacity_; }
+    std::size_t          column_count() const { return column_count_; }
+    const std::uint64_t* column(std::size_t column) const { return values_ ? values_ + column * capacity_ : nullptr; }
+
+    // One line of column names, then one line per sample. The names are quoted when they hold a comma or a quote.
+    bool write_csv(const char* path, const std::string_view* column_names) const
+    {
+      auto* file = std::fopen(path, "w");
+      if (!file)
+        return false;
+
+      for (std::size_t column = 0; column < column_count_; ++column)
+      {
+        if (column != 0)
+          std::fputc(',', file);
+        write_csv_field(file, column_names[column]);
+      }
+      std::fputc('\n', file);
+
+      auto size = this->size();
+      for (std::size_t index = 0; index < size; ++index)
+        for (std::size_t column = 0; column < column_count_; ++column)
+          std::fprintf(file, "%llu%c", static_cast<unsigned long long>(values_[column * capacity_ + index]), column + 1 == column_count_ ? '\n' : ',');
+
+      bool written = !std::ferror(file);
+      return std::fclose(file) == 0 && written;
+    }
+
+    // See MicrobenchMemory::time_series_format for the layout
+    static constexpr char          binary_magic[8] = {'M', 'B', 'M', 'S', 'E', 'R', 'I', 'E'};
+    static constexpr std::uint32_t binary_version  = 1;
+
+    bool write_binary(const char* path, const std::string_view* column_names) const
+    {
+      auto* file = std::fopen(path, "wb");
+      if (!file)
+        return false;
+
+      std::uint32_t column_count = static_cast<std::uint32_t>(column_count_);
+      std::uint64_t size         = this->size();
+      std::fwrite(binary_magic, sizeof(binary_magic), 1, file);
+      std::fwrite(&binary_version, sizeof(binary_version), 1, file);
+      std::fwrite(&column_count, sizeof(column_count), 1, file);
+      std::fwrite(&size, sizeof(size), 1, file);
+
+      for (std::size_t column = 0; column < column_count_; ++column)
+      {
+        auto length = static_cast<std::uint32_t>(column_names[column].size());
+        std::fwrite(&length, sizeof(length), 1, file);
+        std::fwrite(column_names[column].data(), 1, length, file);
+      }
+
+      for (std::size_t column = 0; column < column_count_; ++column)
+        std::fwrite(values_ + column * capacity_, sizeof(std::uint64_t), size, file);
+
+      bool written = !std::ferror(file);
+      return std::fclose(file) == 0 && written;
+    }
+
+  private:
+    static void write_csv_field(std::FILE* file, std::string_view field)
+    {
+      if (field.find_first_of(",\"\n") == std::string_view::npos)
+      {
+        std::fwrite(field.data(), 1, field.size(), file);
+        return;
+      }
+
+      std::fputc('"', file);
+      for (auto c : field)
+      {
+        if (c == '"')
+          std::fputc('"', file);
+        std::fputc(c, file);
+      }
+      std::fputc('"', file);
+    }
+
+    std::uint64_t*           values_       = nullptr;
+    std::size_t              column_count_ = 0;
+    std::size_t              capacity_     = 0;
+    std::atomic<std::size_t> size_{0};
+  };
+} // namespace MicrobenchMemory::detail
@@ -0,0 +1,118 @@
+#pragma once
+
+#include "MicrobenchMemory/trace_format.hpp"
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+
+#ifndef _WIN32
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <unistd.h>
+#if defined(__linux__)
+#include <sys/syscall.h>
+#endif
+#endif
+
+namespace MicrobenchMemory::detail
+{
+  // The traces are only supported on POSIX systems
+  inline bool is_writable_directory([[maybe_unused]] const char* path)
+  {
+#ifdef _WIN32
+    return false;
+#else
+    return ::access(path, W_OK) == 0;
+#endif
+  }
+
+  inline std::int64_t current_process_id()
+  {
+#ifdef _WIN32
+    return 0;
+#else
+    return ::getpid();
+#endif
+  }
+
+  /*
+  per-thread ring of trace records, backed by a memory-mapped file
+  appending a record is a few stores in the mapping, the kernel writes the pages back to the file on its own
+  the file is created and mapped by the first event of the thread, which is the only place with syscalls
+  */
+  class trace_ring
+  {
+  public:
+    // Returns false if the file can't be created, the ring is left closed
+    bool open(const char* path, std::uint64_t capacity, std::uint32_t thread_index)
+    {
+#ifdef _WIN32
+      return false;
+#else
+      close();
+
+      auto bytes = sizeof(trace_file_header) + capacity * sizeof(trace_record);
+      int  fd    = ::open(path, O_RDWR | O_CREAT | O_TRUNC, 0644);
+      if (fd < 0)
+        return false;
+
+      void* mapping = MAP_FAILED;
+      if (::ftruncate(fd, static_cast<off_t>(bytes)) == 0)
+        mapping = ::mmap(nullptr, bytes, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+      ::close(fd);
+      if (mapping == MAP_FAILED)
+        return false;
+
+      header_   = static_cast<trace_file_header*>(mapping);
+      records_  = reinterpret_cast<trace_record*>(header_ + 1);
+      capacity_ = capacity;
+      written_  = 0;
+      thread_   = static_cast<std::uint16_t>(thread_index);
+
+      std::memcpy(header_->magic, trace_magic, sizeof(trace_magic));
+      header_->version      = trace_version;
+      header_->record_size  = sizeof(trace_record);
+      header_->capacity     = capacity;
+      header_->record_count = 0;
+      header_->thread_id    = current_thread_id();
+      header_->thread_index = thread_index;
+      return true;
+#endif
+    }
+
+    void close()
+    {
+#ifndef _WIN32
+      if (header_)
+        ::munmap(header_, sizeof(trace_file_header) + capacity_ * sizeof(trace_record));
+#endif
+      header_  = nullptr;
+      records_ = nullptr;
+    }
+
+    bool is_open() const { return header_ != nullptr; }
+
+    void append(std::uint64_t timestamp, const void* ptr, std::size_t size, std::uint32_t scope, std::uint8_t alignment, trace_event_kind kind)
+    {
+      records_[written_ % capacity_] = trace_record{timestamp, reinterpret_cast<std::uintptr_t>(ptr), size, scope, thread_, alignment, kind};
+      header_->record_count          = ++written_;
+    }
+
+  private:
+    static std::uint64_t current_thread_id()
+    {
+#if defined(__linux__)
+      return static_cast<std::uint64_t>(::syscall(SYS_gettid));
+#else
+      return 0;
+#endif
+    }
+
+    trace_file_header* header_   = nullptr;
+    trace_record*      records_  = nullptr;
+    std::uint64_t      capacity_ = 0;
+    std::uint64_t      written_  = 0;
+    std::uint16_t      thread_   = 0;
+  };
+} // namespace MicrobenchMemory::detail
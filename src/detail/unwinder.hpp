@@ -0,0 +1,73 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+#if defined(__linux__)
+#include <pthread.h>
+#endif
+
+namespace MicrobenchMemory::detail
+{
+#if defined(__linux__) && (defined(__x86_64__) || defined(__aarch64__))
+  struct stack_bounds
+  {
+    std::uintptr_t low;
+    std::uintptr_t high;
+  };
+
+  inline stack_bounds current_stack_bounds()
+  {
+    thread_local stack_bounds bounds = [] {
+      stack_bounds   thread_bounds{0, 0};
+      pthread_attr_t attr;
+      if (pthread_getattr_np(pthread_self(), &attr) == 0)
+      {
+        void*       addr = nullptr;
+        std::size_t size = 0;
+        if (pthread_attr_getstack(&attr, &addr, &size) == 0)
+          thread_bounds = {reinterpret_cast<std::uintptr_t>(addr), reinterpret_cast<std::uintptr_t>(addr) + size};
+        pthread_attr_destroy(&attr);
+      }
+      return thread_bounds;
+    }();
+    return bounds;
+  }
+
+  /*
+  frame-pointer unwinder
+  each frame starts with the frame pointer of the caller followed by the return address: following the chain gives the
+  call stack for a couple of loads per frame
+  the walk stops at the first frame pointer that leaves the thread stack or does not go up, so code compiled without
+  frame pointers gives truncated stacks, never a crash
+
+  writes the return addresses, innermost first, and returns the depth of the stack
+  */
+  [[gnu::noinline]] inline std::size_t capture_backtrace(void** frames, std::size_t max_depth)
+  {
+    const auto  bounds = current_stack_bounds();
+    auto        fp     = reinterpret_cast<std::uintptr_t>(__builtin_frame_address(0));
+    std::size_t depth  = 0;
+    while (depth < max_depth)
+    {
+      if (fp < bounds.low || fp + 2 * sizeof(void*) > bounds.high || fp % sizeof(void*) != 0)
+        break;
+
+      const auto* frame  = reinterpret_cast<const std::uintptr_t*>(fp);
+      auto        caller = frame[0];
+      auto        ret    = frame[1];
+      if (ret == 0)
+        break;
+
+      frames[depth++] = reinterpret_cast<void*>(ret);
+      if (caller <= fp)
+        break;
+      fp = caller;
+    }
+    return depth;
+  }
+#else
+  // no unwinder for this platform: stacks are always empty
+  inline std::size_t capture_backtrace([[maybe_unused]] void** frames, [[maybe_unused]] std::size_t max_depth) { return 0; }
+#endif
+} // namespace MicrobenchMemory::detail
@@ -0,0 +1,37 @@
+#pragma once
+
+#include "detail/system_allocator.hpp"
+
+#include <memory>
+#include <new>
+
+namespace MicrobenchMemory::detail
+{
+  // Allocator for the library internals: goes straight to the system allocator so that the book-keeping is never instrumented
+  template <typename T>
+  struct vanilla_allocator : std::allocator<T>
+  {
+    using value_type                             = typename std::allocator<T>::value_type;
+    using size_type                              = typename std::allocator<T>::size_type;
+    using difference_type                        = typename std::allocator<T>::difference_type;
+    using propagate_on_container_move_assignment = typename std::allocator<T>::propagate_on_container_move_assignment;
+
+    vanilla_allocator() {}
+
+    template <typename U>
+    vanilla_allocator(const vanilla_allocator<U>& u)
+      : std::allocator<T>(u)
+    {
+    }
+
+    [[nodiscard]] constexpr T* allocate(size_type size)
+    {
+      void* p = system_malloc(size * sizeof(T));
+      if (!p)
+        throw std::bad_alloc();
+      return static_cast<T*>(p);
+    }
+
+    constexpr void deallocate(T* p, size_type) { system_free(p); }
+  };
+} // namespace MicrobenchMemory::detail
@@ -3,19 +3,227 @@
 
 #include <benchmark/benchmark.h>
 
+#include <algorithm>
 #include <cstddef>
+#include <cstdint>
+#include <mutex>
+#include <optional>
+#include <string_view>
+#include <vector>
 
 namespace MicrobenchMemory::fixtures::GoogleBenchmarkBridge
 {
 
-  void MemoryManager::Start() { start_ = MicrobenchMemory::get_global_memory_information_snapshot(); }
+  namespace
+  {
+    // scope filter requested by the benchmark being run, and the scope statistics when it was requested
+    struct run_scope_filter
+    {
+      std::string_view                             scope;
+      MicrobenchMemory::scoped_memory_informations start;
+    };
+
+    /*
+    the benchmarks run one at a time, a single filter is enough: the filter belongs to the run between Start and Stop
+    the threads of a multithreaded benchmark all request it, concurrently, only the first request of the run is kept
+    */
+    struct run_scope_filter_state
+    {
+      std::mutex                      mutex;
+      std::optional<run_scope_filter> filter;
+    };
+
+    run_scope_filter_state& get_run_scope_filter()
+    {
+      static run_scope_filter_state state;
+      return state;
+    }
+
+    void fill_result(const MicrobenchMemory::global_memory_informations& start, const MicrobenchMemory::global_memory_informations& stop,
+                     ::benchmark::MemoryManager::Result* result)
+    {
+      auto diff                     = stop - start;
+      auto start_memory_used        = static_cast<std::int64_t>(start.current_memory_used());
+      auto peak_memory_used         = static_cast<std::int64_t>(stop.peak_memory_used);
+      result->num_allocs            = static_cast<std::int64_t>(diff.allocation_count);
+      result->max_bytes_used        = peak_memory_used > start_memory_used ? peak_memory_used - start_memory_used : 0;
+      result->total_allocated_bytes = static_cast<std::int64_t>(diff.total_memory_allocated);
+      result->net_heap_growth       = static_cast<std::int64_t>(diff.total_memory_allocated) - static_cast<std::int64_t>(diff.total_memory_deallocated);
+    }
+  } // namespace
+
+  MemoryManager::MemoryManager(std::string_view scope)
+    : scope_(scope)
+  {
+  }
+
+  void MemoryManager::filter_scope(std::string_view scope)
+  {
+    auto&                       state = get_run_scope_filter();
+    std::lock_guard<std::mutex> lock{state.mutex};
+    if (state.filter)
+      return;
+
+    MicrobenchMemory::reset_peak_memory(scope);
+    state.filter = run_scope_filter{scope, MicrobenchMemory::get_memory_information_snapshot(scope)};
+  }
+
+  void MemoryManager::Start()
+  {
+    // a filter requested during the timing runs doesn't apply to this memory run
+    {
+      auto&                       state = get_run_scope_filter();
+      std::lock_guard<std::mutex> lock{state.mutex};
+      state.filter.reset();
+    }
+
+    if (scope_)
+    {
+      MicrobenchMemory::reset_peak_memory(*scope_);
+      scoped_start_ = MicrobenchMemory::get_memory_information_snapshot(*scope_);
+    }
+    else
+    {
+      MicrobenchMemory::reset_global_peak_memory();
+      start_ = MicrobenchMemory::get_global_memory_information_snapshot();
+    }
+  }
 
   void MemoryManager::Stop(::benchmark::MemoryManager::Result* result)
   {
-    auto stop              = MicrobenchMemory::get_global_memory_information_snapshot();
-    auto diff              = stop - start_;
-    result->num_allocs     = static_cast<std::ptrdiff_t>(diff.allocation_count);
-    result->max_bytes_used = static_cast<std::ptrdiff_t>(diff.total_memory_allocated);
+    std::optional<run_scope_filter> filter;
+    {
+      auto&                       state = get_run_scope_filter();
+      std::lock_guard<std::mutex> lock{state.mutex};
+      filter.swap(state.filter);
+    }
+
+    if (filter)
+      fill_result(filter->start, MicrobenchMemory::get_memory_information_snapshot(filter->scope), result);
+    else if (scope_)
+      fill_result(scoped_start_, MicrobenchMemory::get_memory_information_snapshot(*scope_), result);
+    else
+      fill_result(start_, MicrobenchMemory::get_global_memory_information_snapshot(), result);
+  }
+
+  AllocationLatencyCounters::AllocationLatencyCounters(::benchmark::State& state)
+    : state_(state)
+    , reporting_(state.thread_index() == 0)
+  {
+    if (!reporting_)
+      return;
+
+    was_enabled_ = MicrobenchMemory::is_allocation_latency_timing_enabled();
+    MicrobenchMemory::enable_allocation_latency_timing(true);
+    start_ = MicrobenchMemory::get_allocation_latencies();
+  }
+
+  AllocationLatencyCounters::~AllocationLatencyCounters()
+  {
+    if (!reporting_)
+      return;
+
+    auto latencies = MicrobenchMemory::get_allocation_latencies() - start_;
+    MicrobenchMemory::enable_allocation_latency_timing(was_enabled_);
+
+    auto allocations   = latencies.all_allocations();
+    auto deallocations = latencies.all_deallocations();
+    state_.counters["new_p50_ns"]     = allocations.percentile(0.5);
+    state_.counters["new_p99_ns"]     = allocations.percentile(0.99);
+    state_.counters["new_p999_ns"]    = allocations.percentile(0.999);
+    state_.counters["delete_p50_ns"]  = deallocations.percentile(0.5);
+    state_.counters["delete_p99_ns"]  = deallocations.percentile(0.99);
+    state_.counters["delete_p999_ns"] = deallocations.percentile(0.999);
+  }
+
+  AllocationsPerIteration::AllocationsPerIteration(::benchmark::State& state, std::size_t max_allocations_per_iteration)
+    : state_(state)
+    , max_allocations_per_iteration_(max_allocations_per_iteration)
+    , budget_(MicrobenchMemory::unlimited_budget)
+  {
   }
 
+  AllocationsPerIteration::~AllocationsPerIteration()
+  {
+    auto allocations = budget_.allocation_count();
+    auto bytes       = budget_.allocated_bytes();
+    auto iterations  = static_cast<std::size_t>(state_.iterations());
+
+    state_.counters["allocs_per_iter"] = ::benchmark::Counter(static_cast<double>(allocations), ::benchmark::Counter::kAvgIterations);
+    state_.counters["bytes_per_iter"]  = ::benchmark::Counter(static_cast<double>(bytes), ::benchmark::Counter::kAvgIterations);
+    if (max_allocations_per_iteration_ != MicrobenchMemory::unlimited_budget && allocations > max_allocations_per_iteration_ * iterations)
+      state_.SkipWithError("more allocations per iteration than the budget");
+  }
+
+  InstrumentationOverheadCounters::InstrumentationOverheadCounters(::benchmark::State& state)
+    : state_(state)
+    , reporting_(state.thread_index() == 0)
+  {
+    if (reporting_)
+      start_ = MicrobenchMemory::get_global_memory_information_snapshot();
+  }
+
+  InstrumentationOverheadCounters::InstrumentationOverheadCounters(::benchmark::State& state, std::string_view scope)
+    : InstrumentationOverheadCounters(state)
+  {
+    scope_ = scope;
+    if (reporting_)
+      scoped_start_ = MicrobenchMemory::get_memory_information_snapshot(scope);
+  }
+
+  InstrumentationOverheadCounters::~InstrumentationOverheadCounters()
+  {
+    if (!reporting_)
+      return;
+
+    auto allocations = MicrobenchMemory::get_global_memory_information_snapshot().allocation_count - start_.allocation_count;
+    state_.counters["instrumented_allocations"] = ::benchmark::Counter(static_cast<double>(allocations), ::benchmark::Counter::kAvgIterations);
+    if (scope_)
+    {
+      auto scoped_allocations = MicrobenchMemory::get_memory_information_snapshot(*scope_).allocation_count - scoped_start_.allocation_count;
+      state_.counters["instrumented_scoped_allocations"] = ::benchmark::Counter(static_cast<double>(scoped_allocations), ::benchmark::Counter::kAvgIterations);
+    }
+  }
+
+  OverheadCompensatingReporter::OverheadCompensatingReporter(::benchmark::BenchmarkReporter& reporter)
+    : OverheadCompensatingReporter(reporter, MicrobenchMemory::get_instrumentation_overhead())
+  {
+  }
+
+  OverheadCompensatingReporter::OverheadCompensatingReporter(::benchmark::BenchmarkReporter& reporter, MicrobenchMemory::instrumentation_overhead overhead)
+    : reporter_(reporter)
+    , overhead_(overhead)
+  {
+  }
+
+  bool OverheadCompensatingReporter::ReportContext(const Context& context)
+  {
+    // the streams are given to this reporter by the library, the wrapped one writes to them
+    reporter_.SetOutputStream(&GetOutputStream());
+    reporter_.SetErrorStream(&GetErrorStream());
+    return reporter_.ReportContext(context);
+  }
+
+  void OverheadCompensatingReporter::ReportRuns(const std::vector<Run>& runs)
+  {
+    auto compensated = runs;
+    for (auto& run : compensated)
+    {
+      double overhead_per_iteration = 0;
+      if (auto it = run.counters.find("instrumented_allocations"); it != run.counters.end())
+        overhead_per_iteration += it->second.value * overhead_.global_nanoseconds;
+      if (auto it = run.counters.find("instrumented_scoped_allocations"); it != run.counters.end())
+        overhead_per_iteration += it->second.value * overhead_.scoped_nanoseconds;
+      if (overhead_per_iteration == 0 || run.run_type != Run::RT_Iteration)
+        continue;
+
+      auto overhead = overhead_per_iteration * 1e-9 * static_cast<double>(run.iterations);
+      run.real_accumulated_time = std::max(run.real_accumulated_time - overhead / static_cast<double>(run.threads), 0.);
+      run.cpu_accumulated_time  = std::max(run.cpu_accumulated_time - overhead, 0.);
+    }
+    reporter_.ReportRuns(compensated);
+  }
+
+  void OverheadCompensatingReporter::Finalize() { reporter_.Finalize(); }
+
 } // namespace MicrobenchMemory::fixtures::GoogleBenchmarkBridge
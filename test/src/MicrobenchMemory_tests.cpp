@@ -1,8 +1,28 @@
 #include "MicrobenchMemory/MicrobenchMemory.hpp"
+#include "MicrobenchMemory/ext/exporters.hpp"
 #include "MicrobenchMemory/ext/io.hpp"
+#include "MicrobenchMemory/ext/trace_reader.hpp"
+#include "MicrobenchMemory/fixture/GoogleTestAssertions/GoogleTestAssertions.hpp"
+#include "MicrobenchMemory/memory_resource.hpp"
+#include "MicrobenchMemory/tracking_policy.hpp"
 
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cmath>
+#include <cstdint>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
 #include <iostream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <vector>
 
+#include <gtest/gtest-spi.h>
 #include <gtest/gtest.h>
 
 MICROBENCH_MEMORY_OVERLOAD_GLOBAL()
@@ -25,6 +45,209 @@ TEST(MicrobenchMemory, GlobalOneAllocation)
   std::cout << mem_infos_after_dealloc;
 }
 
+TEST(MicrobenchMemory, GlobalConcurrentAllocations)
+{
+  constexpr std::size_t nb_threads = 8;
+  constexpr std::size_t nb_allocs  = 10000;
+
+  std::vector<std::thread> threads;
+  threads.reserve(nb_threads);
+
+  auto mem_infos_before = MicrobenchMemory::get_global_memory_information_snapshot();
+
+  for (std::size_t i = 0; i < nb_threads; ++i)
+    threads.emplace_back([] {
+      for (std::size_t j = 0; j < nb_allocs; ++j)
+      {
+        auto* ptr = new int{0};
+        delete ptr;
+      }
+    });
+  for (auto& t : threads)
+    t.join();
+
+  auto diff = MicrobenchMemory::get_global_memory_information_snapshot() - mem_infos_before;
+  std::cout << diff;
+
+  EXPECT_GE(diff.allocation_count, nb_threads * nb_allocs);
+  EXPECT_EQ(diff.allocation_count, diff.deallocation_count);
+  EXPECT_GE(diff.total_memory_allocated, nb_threads * nb_allocs * sizeof(int));
+}
+
+TEST(MicrobenchMemory, GlobalPeakMemory)
+{
+  MicrobenchMemory::reset_global_peak_memory();
+  auto mem_infos_before = MicrobenchMemory::get_global_memory_information_snapshot();
+  EXPECT_EQ(mem_infos_before.peak_memory_used, mem_infos_before.current_memory_used());
+
+  char* a = new char[1000];
+  char* b = new char[2000];
+  delete[] a;
+  char* c = new char[500];
+  delete[] b;
+  delete[] c;
+
+  auto mem_infos_after = MicrobenchMemory::get_global_memory_information_snapshot();
+  std::cout << mem_infos_after;
+
+  auto diff = mem_infos_after - mem_infos_before;
+  EXPECT_EQ(diff.total_memory_allocated, 3500u);
+  EXPECT_EQ(diff.total_memory_deallocated, 3500u);
+  EXPECT_EQ(mem_infos_after.current_memory_used(), mem_infos_before.current_memory_used());
+  EXPECT_EQ(mem_infos_after.peak_memory_used, mem_infos_before.current_memory_used() + 3000);
+
+  // a new region only sees its own peak
+  MicrobenchMemory::reset_global_peak_memory();
+  delete[] new char[100];
+  EXPECT_EQ(MicrobenchMemory::get_global_memory_information_snapshot().peak_memory_used, mem_infos_before.current_memory_used() + 100);
+}
+
+TEST(MicrobenchMemory, GlobalNothrowAllocations)
+{
+  struct alignas(64) aligned_block
+  {
+    char bytes[64];
+  };
+
+  auto mem_infos_before = MicrobenchMemory::get_global_memory_information_snapshot();
+
+  // the nothrow blocks are freed by the usual deletes, they must carry the allocation header too
+  auto* a = new (std::nothrow) char[24];
+  auto* b = new (std::nothrow) aligned_block;
+  auto* c = new (std::nothrow) aligned_block[2];
+  ASSERT_NE(a, nullptr);
+  ASSERT_NE(b, nullptr);
+  ASSERT_NE(c, nullptr);
+  EXPECT_EQ(reinterpret_cast<std::uintptr_t>(b) % alignof(aligned_block), 0u);
+  EXPECT_EQ(reinterpret_cast<std::uintptr_t>(c) % alignof(aligned_block), 0u);
+  delete[] a;
+  delete b;
+  delete[] c;
+
+  auto diff = MicrobenchMemory::get_global_memory_information_snapshot() - mem_infos_before;
+  EXPECT_EQ(diff.allocation_count, 3u);
+  EXPECT_EQ(diff.deallocation_count, 3u);
+  EXPECT_EQ(diff.total_memory_allocated, 24 + sizeof(aligned_block) * 3);
+  EXPECT_EQ(diff.total_memory_deallocated, diff.total_memory_allocated);
+
+  // failures are reported with nullptr
+  volatile std::size_t too_large = static_cast<std::size_t>(-1) / 2 + 1;
+  EXPECT_EQ(::operator new(too_large, std::nothrow), nullptr);
+}
+
+// keeps the allocations from being elided
+static char* volatile allocation_sink = nullptr;
+
+TEST(MicrobenchMemory, SizeHistogramBins)
+{
+  using MicrobenchMemory::allocation_size_histogram;
+
+  for (std::size_t size : {0u, 1u, 3u, 4u, 5u, 7u, 8u, 15u, 16u, 100u, 1000u, 4096u, 1000000u})
+  {
+    auto bin = allocation_size_histogram::bin_index(size);
+    EXPECT_LE(allocation_size_histogram::bin_lower_bound(bin), size);
+    EXPECT_GE(allocation_size_histogram::bin_upper_bound(bin), size);
+  }
+  EXPECT_EQ(allocation_size_histogram::bin_index(static_cast<std::size_t>(-1)), allocation_size_histogram::bin_count - 1);
+
+  // 4 bins per power of two
+  EXPECT_EQ(allocation_size_histogram::bin_lower_bound(allocation_size_histogram::bin_index(1000)), 896u);
+  EXPECT_EQ(allocation_size_histogram::bin_upper_bound(allocation_size_histogram::bin_index(1000)), 1023u);
+}
+
+TEST(MicrobenchMemory, GlobalSizeHistogram)
+{
+  using MicrobenchMemory::allocation_size_histogram;
+
+  MicrobenchMemory::enable_allocation_size_histogram(true);
+  auto mem_infos_before = MicrobenchMemory::get_global_memory_information_snapshot();
+
+  delete[] new char[1000];
+  delete[] new char[1000];
+  delete[] new char[5];
+
+  auto diff = MicrobenchMemory::get_global_memory_information_snapshot() - mem_infos_before;
+  MicrobenchMemory::enable_allocation_size_histogram(false);
+  std::cout << diff;
+
+  EXPECT_EQ(diff.size_histogram.total_count(), 3u);
+  EXPECT_EQ(diff.size_histogram.bins[allocation_size_histogram::bin_index(1000)], 2u);
+  EXPECT_EQ(diff.size_histogram.bins[allocation_size_histogram::bin_index(5)], 1u);
+
+  // disabled again
+  delete[] new char[1000];
+  EXPECT_EQ((MicrobenchMemory::get_global_memory_information_snapshot() - mem_infos_before).size_histogram.total_count(), 3u);
+}
+
+
+TEST(MicrobenchMemory, BuiltinAllocatorBackends)
+{
+  using namespace MicrobenchMemory;
+
+  for (auto backend : {pool_allocator_backend, bump_arena_allocator_backend})
+  {
+    auto mem_infos_before = get_global_memory_information_snapshot();
+
+    set_allocator_backend(backend);
+    auto* small   = new char[24];
+    auto* large   = new char[100'000];
+    auto* aligned = new (std::align_val_t{256}) char[64];
+    // freed after switching back: the block still goes to the backend that allocated it
+    set_allocator_backend(malloc_allocator_backend);
+    auto* other = new char[24];
+
+    EXPECT_EQ(reinterpret_cast<std::uintptr_t>(aligned) % 256, 0u);
+    std::fill_n(large, 100'000, 'x');
+
+    delete[] small;
+    delete[] large;
+    ::operator delete[](aligned, std::align_val_t{256});
+    delete[] other;
+
+    auto diff = get_global_memory_information_snapshot() - mem_infos_before;
+    EXPECT_EQ(diff.allocation_count, 4u) << get_allocator_backend_name(backend);
+    EXPECT_EQ(diff.deallocation_count, 4u);
+    EXPECT_EQ(diff.total_memory_allocated, 24u + 100'000u + 64u + 24u);
+    EXPECT_EQ(diff.current_memory_used(), 0u);
+  }
+  reset_bump_arena();
+}
+
+struct counting_backend
+{
+  std::size_t allocated_blocks   = 0;
+  std::size_t deallocated_blocks = 0;
+
+  static void* allocate(void* context, std::size_t size, [[maybe_unused]] std::size_t alignment)
+  {
+    ++static_cast<counting_backend*>(context)->allocated_blocks;
+    return std::malloc(size);
+  }
+
+  static void deallocate(void* context, void* ptr, [[maybe_unused]] std::size_t size, [[maybe_unused]] std::size_t alignment)
+  {
+    ++static_cast<counting_backend*>(context)->deallocated_blocks;
+    std::free(ptr);
+  }
+};
+
+TEST(MicrobenchMemory, UserAllocatorBackend)
+{
+  using namespace MicrobenchMemory;
+
+  static counting_backend counts;
+  auto                    index = register_allocator_backend({"counting", counting_backend::allocate, counting_backend::deallocate, &counts});
+  EXPECT_STREQ(get_allocator_backend_name(index), "counting");
+  EXPECT_THROW(set_allocator_backend(max_allocator_backend_count), std::out_of_range);
+
+  set_allocator_backend(index);
+  auto* ptr = new int{1};
+  set_allocator_backend(malloc_allocator_backend);
+  EXPECT_EQ(counts.allocated_blocks, 1u);
+
+  delete ptr;
+  EXPECT_EQ(counts.deallocated_blocks, 1u);
+}
 
 struct A
 {
@@ -50,6 +273,900 @@ TEST(MicrobenchMemory, ScopedOneAllocation)
   std::cout << mem_infos_3;
 }
 
+TEST(MicrobenchMemory, ScopedManyAllocations)
+{
+  constexpr std::size_t nb_objects = 10000;
+
+  auto mem_infos_before = MicrobenchMemory::get_memory_information_snapshot("A");
+
+  std::vector<A*> ptrs;
+  for (std::size_t i = 0; i < nb_objects; ++i)
+    ptrs.push_back(new A{});
+
+  auto diff_alloc = MicrobenchMemory::get_memory_information_snapshot("A") - mem_infos_before;
+  EXPECT_EQ(diff_alloc.allocation_count, nb_objects);
+  EXPECT_EQ(diff_alloc.nb_ptr_leaked, nb_objects);
+
+  for (auto* ptr : ptrs)
+    delete ptr;
+
+  auto diff_dealloc = MicrobenchMemory::get_memory_information_snapshot("A") - mem_infos_before;
+  std::cout << diff_dealloc;
+  EXPECT_EQ(diff_dealloc.deallocation_count, nb_objects);
+  EXPECT_EQ(diff_dealloc.total_memory_deallocated, nb_objects * sizeof(A));
+  EXPECT_EQ(diff_dealloc.nb_ptr_leaked, 0u);
+}
+
+TEST(MicrobenchMemory, ScopedLeakedPointers)
+{
+  constexpr std::size_t nb_objects = 1000;
+
+  auto leaked_before = MicrobenchMemory::get_memory_information_snapshot("A").nb_ptr_leaked;
+
+  std::vector<A*> ptrs;
+  for (std::size_t i = 0; i < nb_objects; ++i)
+    ptrs.push_back(new A{});
+  EXPECT_EQ(MicrobenchMemory::get_memory_information_snapshot("A").nb_ptr_leaked - leaked_before, nb_objects);
+
+  std::vector<void*> listed;
+  MicrobenchMemory::for_each_leaked_pointer("A", [&listed](const MicrobenchMemory::leaked_pointer& leak) {
+    EXPECT_EQ(leak.size, sizeof(A));
+    listed.push_back(leak.ptr);
+  });
+  EXPECT_EQ(listed.size(), nb_objects + leaked_before);
+  for (auto* ptr : ptrs)
+    EXPECT_NE(std::find(listed.begin(), listed.end(), ptr), listed.end());
+
+  // streamed by batches
+  std::array<MicrobenchMemory::leaked_pointer, 7> batch;
+  std::size_t                                     cursor = 0, count = 0;
+  while (auto n = MicrobenchMemory::get_leaked_pointers("A", batch.data(), batch.size(), cursor))
+    count += n;
+  EXPECT_EQ(count, listed.size());
+
+  for (auto* ptr : ptrs)
+    delete ptr;
+  EXPECT_EQ(MicrobenchMemory::get_memory_information_snapshot("A").nb_ptr_leaked, leaked_before);
+}
+
+TEST(MicrobenchMemory, ScopedPeakMemory)
+{
+  MicrobenchMemory::reset_peak_memory("A");
+  auto mem_infos_before = MicrobenchMemory::get_memory_information_snapshot("A");
+
+  auto* a = new A{};
+  auto* b = new A{};
+  delete a;
+  delete b;
+
+  auto mem_infos_after = MicrobenchMemory::get_memory_information_snapshot("A");
+  std::cout << mem_infos_after;
+  EXPECT_EQ(mem_infos_after.peak_memory_used, mem_infos_before.current_memory_used() + 2 * sizeof(A));
+  EXPECT_EQ(mem_infos_after.current_memory_used(), mem_infos_before.current_memory_used());
+}
+
+TEST(MicrobenchMemory, ScopedSizeHistogram)
+{
+  using MicrobenchMemory::allocation_size_histogram;
+
+  MicrobenchMemory::enable_allocation_size_histogram(true);
+  auto mem_infos_before = MicrobenchMemory::get_memory_information_snapshot("A");
+
+  delete new A{};
+  delete[] new A[4];
+
+  auto diff = MicrobenchMemory::get_memory_information_snapshot("A") - mem_infos_before;
+  MicrobenchMemory::enable_allocation_size_histogram(false);
+  std::cout << diff;
+
+  EXPECT_EQ(diff.size_histogram.total_count(), 2u);
+  EXPECT_EQ(diff.size_histogram.bins[allocation_size_histogram::bin_index(sizeof(A))], 1u);
+}
+
+TEST(MicrobenchMemory, AllocationBudgets)
+{
+  {
+    MicrobenchMemory::allocation_budget outer{3, 1000};
+    delete[] new char[100];
+    {
+      MicrobenchMemory::no_alloc_guard guard;
+      {
+        MicrobenchMemory::memory_region region{"budget"};
+        delete[] new char[10];
+      }
+      delete new A;
+
+      ASSERT_EQ(guard.violation_count(), 2u);
+      EXPECT_EQ(guard.violations()[0].size, 10u);
+      EXPECT_EQ(guard.violations()[0].scope, "/budget");
+      EXPECT_EQ(guard.violations()[1].size, sizeof(A));
+      EXPECT_EQ(guard.violations()[1].scope, "A");
+      EXPECT_EQ(guard.violations()[1].allocation_index, 1u);
+    }
+    // nested budgets are charged too
+    EXPECT_EQ(outer.allocation_count(), 3u);
+    EXPECT_EQ(outer.allocated_bytes(), 110 + sizeof(A));
+    EXPECT_FALSE(outer.violated());
+
+    delete[] new char[2000];
+    ASSERT_EQ(outer.violation_count(), 1u);
+    EXPECT_EQ(outer.violations()[0].size, 2000u);
+    EXPECT_TRUE(outer.violations()[0].scope.empty());
+    EXPECT_EQ(outer.violations()[0].allocation_index, 3u);
+  }
+
+  EXPECT_DEATH(
+      {
+        MicrobenchMemory::no_alloc_guard guard{MicrobenchMemory::budget_action::trap};
+        delete[] new char[42];
+      },
+      "allocation #0 of 42 bytes");
+}
+
+TEST(MicrobenchMemory, AllocationAssertions)
+{
+  std::vector<int> values(16);
+  EXPECT_NO_ALLOCATION(values[0] = 1);
+  EXPECT_ALLOCATIONS_WITHIN(values.push_back(1), 1, MicrobenchMemory::unlimited_budget);
+  EXPECT_NONFATAL_FAILURE(EXPECT_NO_ALLOCATION(delete[] new char[8]), "allocation #0: 8 bytes");
+}
+
+TEST(MicrobenchMemory, ScopedConcurrentAllocations)
+{
+  constexpr std::size_t nb_threads = 8;
+  constexpr std::size_t nb_objects = 1000;
+
+  auto mem_infos_before = MicrobenchMemory::get_memory_information_snapshot("A");
+
+  std::vector<std::thread> threads;
+  for (std::size_t i = 0; i < nb_threads; ++i)
+    threads.emplace_back([] {
+      std::vector<A*> ptrs;
+      for (std::size_t j = 0; j < nb_objects; ++j)
+        ptrs.push_back(new A{});
+      for (auto* ptr : ptrs)
+        delete ptr;
+    });
+  for (auto& t : threads)
+    t.join();
+
+  auto diff = MicrobenchMemory::get_memory_information_snapshot("A") - mem_infos_before;
+  EXPECT_EQ(diff.allocation_count, nb_threads * nb_objects);
+  EXPECT_EQ(diff.deallocation_count, nb_threads * nb_objects);
+  EXPECT_FALSE(diff.has_memory_leak());
+}
+
+TEST(MicrobenchMemory, ConsistentSnapshotsDuringAllocations)
+{
+  constexpr std::size_t nb_threads = 4;
+
+  auto global_before = MicrobenchMemory::get_global_memory_information_snapshot();
+  auto scope_before  = MicrobenchMemory::get_memory_information_snapshot("A");
+
+  // the objects are freed by the next thread, on another counter shard than the one of their allocation
+  std::atomic<bool>                       stop{false};
+  std::array<std::atomic<A*>, nb_threads> handoff{};
+  std::vector<std::thread>                threads;
+  for (std::size_t i = 0; i < nb_threads; ++i)
+    threads.emplace_back([&, i] {
+      while (!stop.load())
+      {
+        if (auto* ptr = handoff[(i + 1) % nb_threads].exchange(nullptr))
+          delete ptr;
+        if (auto* ptr = handoff[i].exchange(new A{}))
+          delete ptr;
+      }
+    });
+
+  for (int i = 0; i < 200; ++i)
+  {
+    auto global = MicrobenchMemory::get_global_memory_information_snapshot() - global_before;
+    auto scope  = MicrobenchMemory::get_memory_information_snapshot("A") - scope_before;
+    ASSERT_LE(global.deallocation_count, global.allocation_count);
+    ASSERT_LE(global.total_memory_deallocated, global.total_memory_allocated);
+    ASSERT_EQ(scope.total_memory_allocated, scope.allocation_count * sizeof(A));
+    ASSERT_EQ(scope.total_memory_deallocated, scope.deallocation_count * sizeof(A));
+    ASSERT_EQ(scope.nb_ptr_leaked, scope.allocation_count - scope.deallocation_count);
+  }
+
+  stop = true;
+  for (auto& t : threads)
+    t.join();
+  for (auto& ptr : handoff)
+    delete ptr.exchange(nullptr);
+  EXPECT_FALSE((MicrobenchMemory::get_memory_information_snapshot("A") - scope_before).has_memory_leak());
+}
+
+struct SnapshotFirst
+{
+  char buff[32];
+  MICROBENCH_MEMORY_INSTRUMENT_CLASS("SnapshotFirst");
+};
+
+struct SnapshotSecond
+{
+  char buff[64];
+  MICROBENCH_MEMORY_INSTRUMENT_CLASS("SnapshotSecond");
+};
+
+TEST(MicrobenchMemory, SnapshotAllScopes)
+{
+  // both scopes are registered by their first allocation
+  delete new SnapshotFirst{};
+  delete new SnapshotSecond{};
+
+  std::array<MicrobenchMemory::scoped_memory_informations, 1> first;
+  auto                                                        count = MicrobenchMemory::snapshot_all_scopes(first.data(), first.size());
+  ASSERT_GE(count, 2u);
+
+  std::vector<MicrobenchMemory::scoped_memory_informations> all(count);
+  EXPECT_EQ(MicrobenchMemory::snapshot_all_scopes(all.data(), all.size()), count);
+  EXPECT_EQ(all[0].scope, first[0].scope);
+
+  for (std::string_view scope : {"SnapshotFirst", "SnapshotSecond"})
+  {
+    auto infos = std::find_if(all.begin(), all.end(), [&](const auto& scope_infos) { return scope_infos.scope == scope; });
+    ASSERT_NE(infos, all.end());
+    EXPECT_EQ(infos->allocation_count, MicrobenchMemory::get_memory_information_snapshot(scope).allocation_count);
+    EXPECT_GE(infos->allocation_count, 1u);
+  }
+}
+
+TEST(MicrobenchMemory, AllocationTrace)
+{
+  auto directory = std::filesystem::temp_directory_path() / ("microbench_memory_trace_" + std::to_string(::testing::UnitTest::GetInstance()->random_seed()));
+  std::filesystem::remove_all(directory);
+  std::filesystem::create_directories(directory);
+
+  ASSERT_TRUE(MicrobenchMemory::start_allocation_trace(directory.string(), 1024));
+  allocation_sink = new char[100];
+  delete[] allocation_sink;
+  auto* a = new A{};
+  delete a;
+  std::thread([] { delete[] new char[200]; }).join();
+  MicrobenchMemory::stop_allocation_trace();
+
+  auto threads = MicrobenchMemory::read_trace_directory(directory);
+  ASSERT_EQ(threads.size(), 2u);
+  auto records = MicrobenchMemory::merge_trace_records(threads);
+  ASSERT_GE(records.size(), 6u);
+  EXPECT_TRUE(std::is_sorted(records.begin(), records.end(), [](const auto& lhs, const auto& rhs) { return lhs.timestamp < rhs.timestamp; }));
+
+  auto is_event = [](std::uint64_t size, std::uint8_t kind, bool scoped) {
+    return [=](const MicrobenchMemory::trace_record& record) { return record.size == size && record.kind == kind && (record.scope != 0) == scoped; };
+  };
+  EXPECT_EQ(std::count_if(records.begin(), records.end(), is_event(100, MicrobenchMemory::trace_event_allocation, false)), 1);
+  EXPECT_EQ(std::count_if(records.begin(), records.end(), is_event(100, MicrobenchMemory::trace_event_deallocation, false)), 1);
+  EXPECT_EQ(std::count_if(records.begin(), records.end(), is_event(sizeof(A), MicrobenchMemory::trace_event_allocation, true)), 1);
+  EXPECT_EQ(std::count_if(records.begin(), records.end(), is_event(sizeof(A), MicrobenchMemory::trace_event_deallocation, true)), 1);
+  EXPECT_EQ(std::count_if(records.begin(), records.end(), is_event(200, MicrobenchMemory::trace_event_allocation, false)), 1);
+
+  // the test only allocates between the start and the stop what it frees
+  auto curve = MicrobenchMemory::live_heap_curve(records);
+  auto peak  = std::max_element(curve.begin(), curve.end(), [](const auto& lhs, const auto& rhs) { return lhs.live_bytes < rhs.live_bytes; });
+  EXPECT_GE(peak->live_bytes, 200);
+
+  std::filesystem::remove_all(directory);
+}
+
+TEST(MicrobenchMemory, MemorySampler)
+{
+  auto wait_for_samples = [](std::size_t count) {
+    for (int i = 0; i < 1000 && MicrobenchMemory::get_memory_time_series().sample_count < count; ++i)
+      std::this_thread::sleep_for(std::chrono::milliseconds{1});
+  };
+
+  std::array<std::string_view, 1> scopes{"A"};
+  std::array<A*, 10>              objects{};
+  auto                            scope_before  = MicrobenchMemory::get_memory_information_snapshot("A");
+  auto                            global_before = MicrobenchMemory::get_global_memory_information_snapshot();
+
+  ASSERT_TRUE(MicrobenchMemory::start_memory_sampler(std::chrono::milliseconds{1}, 10000, scopes.data(), scopes.size()));
+  EXPECT_FALSE(MicrobenchMemory::start_memory_sampler(std::chrono::milliseconds{1}, 10000));
+  wait_for_samples(2);
+
+  for (auto& a : objects)
+    a = new A{};
+  wait_for_samples(MicrobenchMemory::get_memory_time_series().sample_count + 2);
+  MicrobenchMemory::stop_memory_sampler();
+  for (auto* a : objects)
+    delete a;
+
+  auto series = MicrobenchMemory::get_memory_time_series();
+  auto last   = series.sample_count - 1;
+  ASSERT_GE(series.sample_count, 4u);
+  ASSERT_EQ(series.scope_count, 1u);
+  EXPECT_TRUE(std::is_sorted(series.timestamp, series.timestamp + series.sample_count));
+  EXPECT_EQ(series.scope_live_memory[0][last], scope_before.current_memory_used() + objects.size() * sizeof(A));
+  // neither the sampler nor the instrumented class went through the global operators
+  EXPECT_EQ(series.allocation_count[last], global_before.allocation_count);
+#if defined(__linux__)
+  EXPECT_GT(series.resident_memory[last], 0u);
+#endif
+
+  auto path = std::filesystem::temp_directory_path() / ("microbench_memory_samples_" + std::to_string(::testing::UnitTest::GetInstance()->random_seed()));
+  ASSERT_TRUE(MicrobenchMemory::write_memory_time_series(path.string() + ".csv", MicrobenchMemory::time_series_format::csv));
+  {
+    std::ifstream file{path.string() + ".csv"};
+    std::string   line;
+    std::getline(file, line);
+    EXPECT_EQ(line, "timestamp_ns,resident_memory,live_memory,allocation_count,deallocation_count,total_memory_allocated,A");
+    std::size_t lines = 0;
+    while (std::getline(file, line))
+      ++lines;
+    EXPECT_EQ(lines, series.sample_count);
+  }
+
+  // header, the lengths of the column names and their 95 characters, then the 7 columns
+  ASSERT_TRUE(MicrobenchMemory::write_memory_time_series(path.string() + ".bin", MicrobenchMemory::time_series_format::binary));
+  EXPECT_EQ(std::filesystem::file_size(path.string() + ".bin"), 24 + 7 * 4 + 95 + 7 * 8 * series.sample_count);
+
+  std::filesystem::remove(path.string() + ".csv");
+  std::filesystem::remove(path.string() + ".bin");
+}
+
+TEST(MicrobenchMemory, Exporters)
+{
+  MicrobenchMemory::global_memory_informations global{3, 2, 300, 200, 150, {}};
+  global.size_histogram.bins[MicrobenchMemory::allocation_size_histogram::bin_index(100)] = 3;
+  MicrobenchMemory::scoped_memory_informations scope{1, 0, 16, 0, 1, "a\"b,c", 16, {}, {}};
+  MicrobenchMemory::leaked_pointer             leak{reinterpret_cast<void*>(0x1000), 16};
+
+  std::array<char, 16384> json_buffer, csv_buffer, prometheus_buffer, leaks_buffer;
+  MicrobenchMemory::buffer_writer json{json_buffer.data(), json_buffer.size()}, csv{csv_buffer.data(), csv_buffer.size()};
+  MicrobenchMemory::buffer_writer prometheus{prometheus_buffer.data(), prometheus_buffer.size()}, leaks{leaks_buffer.data(), leaks_buffer.size()};
+
+  // the writers never allocate
+  auto global_before = MicrobenchMemory::get_global_memory_information_snapshot();
+  MicrobenchMemory::write_json(json, global);
+  MicrobenchMemory::write_csv(csv, &scope, 1);
+  MicrobenchMemory::write_prometheus(prometheus, global);
+  MicrobenchMemory::write_prometheus(prometheus, &scope, 1);
+  MicrobenchMemory::write_json(leaks, &leak, 1);
+  EXPECT_EQ(MicrobenchMemory::get_global_memory_information_snapshot().allocation_count, global_before.allocation_count);
+
+  EXPECT_EQ(json.view(), "{\"allocation_count\":3,\"deallocation_count\":2,\"total_memory_allocated\":300,\"total_memory_deallocated\":200,\"current_memory_used\":100,"
+                         "\"peak_memory_used\":150,\"size_histogram\":[{\"lower_bound\":96,\"upper_bound\":111,\"count\":3}]}");
+  EXPECT_EQ(csv.view(), "scope,allocation_count,deallocation_count,total_memory_allocated,total_memory_deallocated,current_memory_used,peak_memory_used,nb_ptr_leaked\n"
+                        "\"a\"\"b,c\",1,0,16,0,16,16,1\n");
+  EXPECT_EQ(leaks.view(), "[{\"address\":\"0x1000\",\"size\":16}]");
+
+  auto metrics = prometheus.view();
+  EXPECT_NE(metrics.find("# TYPE microbench_memory_allocations_total counter\nmicrobench_memory_allocations_total 3\n"), std::string_view::npos);
+  EXPECT_NE(metrics.find("microbench_memory_allocation_size_bytes_bucket{le=\"63\"} 0\nmicrobench_memory_allocation_size_bytes_bucket{le=\"127\"} 3\n"), std::string_view::npos);
+  EXPECT_NE(metrics.find("microbench_memory_allocation_size_bytes_count 3\n"), std::string_view::npos);
+  EXPECT_NE(metrics.find("microbench_memory_scope_live_pointers{scope=\"a\\\"b,c\"} 1\n"), std::string_view::npos);
+  EXPECT_NE(metrics.find("microbench_memory_scope_allocation_size_bytes_bucket{scope=\"a\\\"b,c\",le=\"+Inf\"} 0\n"), std::string_view::npos);
+
+  // a full buffer truncates the output but still measures it
+  std::array<char, 8>             small_buffer;
+  MicrobenchMemory::buffer_writer small{small_buffer.data(), small_buffer.size()};
+  MicrobenchMemory::write_json(small, global);
+  EXPECT_TRUE(small.truncated());
+  EXPECT_EQ(small.size(), json.size());
+  EXPECT_EQ(small.view(), json.view().substr(0, small_buffer.size()));
+}
+
+TEST(MicrobenchMemory, ScopedExactEstimates)
+{
+  auto mem_infos_before = MicrobenchMemory::get_memory_information_snapshot("A");
+
+  delete new A{};
+
+  auto diff = MicrobenchMemory::get_memory_information_snapshot("A") - mem_infos_before;
+  EXPECT_EQ(diff.estimates.sampling_interval, 0u);
+  EXPECT_DOUBLE_EQ(diff.estimates.allocation_count.value, 1.);
+  EXPECT_DOUBLE_EQ(diff.estimates.total_memory_allocated.value, static_cast<double>(sizeof(A)));
+  EXPECT_DOUBLE_EQ(diff.estimates.total_memory_allocated.variance, 0.);
+  EXPECT_DOUBLE_EQ(diff.estimates.current_memory_used().value, 0.);
+}
+
+TEST(MicrobenchMemory, ScopedSampledEstimates)
+{
+  constexpr std::size_t nb_objects = 100000;
+  constexpr std::size_t interval   = 16 * 1024;
+
+  MicrobenchMemory::set_sampling_interval(interval);
+  auto mem_infos_before = MicrobenchMemory::get_memory_information_snapshot("A");
+
+  std::vector<A*> ptrs;
+  for (std::size_t i = 0; i < nb_objects; ++i)
+    ptrs.push_back(new A{});
+
+  auto diff_alloc = MicrobenchMemory::get_memory_information_snapshot("A") - mem_infos_before;
+  std::cout << diff_alloc;
+
+  // only a fraction of the allocations is recorded
+  EXPECT_LT(diff_alloc.allocation_count, nb_objects / 10);
+  EXPECT_GT(diff_alloc.allocation_count, 0u);
+  EXPECT_EQ(diff_alloc.nb_ptr_leaked, diff_alloc.allocation_count);
+
+  // the estimates are unbiased, 4 standard deviations keep the test from being flaky
+  const auto& allocated = diff_alloc.estimates.total_memory_allocated;
+  const auto& count     = diff_alloc.estimates.allocation_count;
+  EXPECT_NEAR(allocated.value, static_cast<double>(nb_objects * sizeof(A)), 4 * std::sqrt(allocated.variance));
+  EXPECT_NEAR(count.value, static_cast<double>(nb_objects), 4 * std::sqrt(count.variance));
+  EXPECT_LT(allocated.upper_bound() - allocated.lower_bound(), 0.5 * static_cast<double>(nb_objects * sizeof(A)));
+
+  // switching the sampling off does not lose track of the sampled pointers
+  MicrobenchMemory::set_sampling_interval(0);
+  for (auto* ptr : ptrs)
+    delete ptr;
+
+  auto diff_dealloc = MicrobenchMemory::get_memory_information_snapshot("A") - mem_infos_before;
+  EXPECT_EQ(diff_dealloc.deallocation_count, diff_alloc.allocation_count);
+  EXPECT_EQ(diff_dealloc.nb_ptr_leaked, 0u);
+  EXPECT_NEAR(diff_dealloc.estimates.current_memory_used().value, 0., 1e-6 * static_cast<double>(nb_objects * sizeof(A)));
+}
+
+struct C
+{
+  char buff[64];
+  MICROBENCH_MEMORY_INSTRUMENT_TYPE(C);
+};
+
+TEST(MicrobenchMemory, TypeScopeName)
+{
+  static_assert(MicrobenchMemory::detail::type_name<C>() == "C");
+  EXPECT_EQ(MicrobenchMemory::get_memory_information_snapshot<C>().scope, "C");
+}
+
+TEST(MicrobenchMemory, TypeScopedAllocations)
+{
+  auto mem_infos_before = MicrobenchMemory::get_memory_information_snapshot<C>();
+
+  auto* c  = new C{};
+  auto* cs = new C[4];
+
+  auto diff_alloc = MicrobenchMemory::get_memory_information_snapshot<C>() - mem_infos_before;
+  EXPECT_EQ(diff_alloc.allocation_count, 2u);
+  EXPECT_EQ(diff_alloc.nb_ptr_leaked, 2u);
+
+  delete c;
+  delete[] cs;
+
+  auto diff_dealloc = MicrobenchMemory::get_memory_information_snapshot<C>() - mem_infos_before;
+  std::cout << diff_dealloc;
+  EXPECT_EQ(diff_dealloc.deallocation_count, 2u);
+  EXPECT_EQ(diff_dealloc.total_memory_deallocated, 5 * sizeof(C));
+  EXPECT_FALSE(diff_dealloc.has_memory_leak());
+
+  // the type scope is an ordinary scope named after the type
+  EXPECT_EQ(MicrobenchMemory::get_memory_information_snapshot("C").allocation_count, MicrobenchMemory::get_memory_information_snapshot<C>().allocation_count);
+}
+
+TEST(MicrobenchMemory, ScopeIdsAreInterned)
+{
+  using MicrobenchMemory::detail::register_scope;
+
+  EXPECT_NE(register_scope("A"), 0u);
+  EXPECT_EQ(register_scope("A"), register_scope(std::string("A")));
+  EXPECT_NE(register_scope("A"), register_scope("C"));
+}
+
+using MicrobenchMemory::tracking_features;
+
+TEST(MicrobenchMemory, TrackingMemoryResource)
+{
+  std::array<std::byte, 1024>         buffer;
+  std::pmr::monotonic_buffer_resource upstream{buffer.data(), buffer.size(), std::pmr::null_memory_resource()};
+  {
+    MicrobenchMemory::tracking_memory_resource resource{"pmr_vector", &upstream};
+    std::pmr::vector<int>                      values{&resource};
+    values.reserve(4);
+    values.reserve(8);
+    values.reserve(16);
+
+    auto growth = resource.growth();
+    EXPECT_EQ(growth.allocation_count, 3u);
+    EXPECT_EQ(growth.reallocation_count, 2u);
+    EXPECT_EQ(growth.bytes_copied, (4u + 8u) * sizeof(int));
+    EXPECT_EQ(growth.current_capacity, 16 * sizeof(int));
+    EXPECT_EQ(growth.peak_capacity, (8u + 16u) * sizeof(int));
+
+    auto infos = MicrobenchMemory::get_memory_information_snapshot("pmr_vector");
+    EXPECT_EQ(infos.allocation_count, 3u);
+    EXPECT_EQ(infos.deallocation_count, 2u);
+    EXPECT_EQ(infos.current_memory_used(), 16 * sizeof(int));
+
+    // the upstream failure is a bad_alloc
+    EXPECT_THROW(values.reserve(1024), std::bad_alloc);
+  }
+  EXPECT_FALSE(MicrobenchMemory::get_memory_information_snapshot("pmr_vector").has_memory_leak());
+}
+
+TEST(MicrobenchMemory, TrackingAllocator)
+{
+  MicrobenchMemory::tracking_memory_resource resource{"allocator_map"};
+  auto                                       global_before = MicrobenchMemory::get_global_memory_information_snapshot();
+  {
+    std::vector<std::string, MicrobenchMemory::tracking_allocator<std::string>> names{resource};
+    for (int i = 0; i < 100; ++i)
+      names.emplace_back("name");
+    EXPECT_GT(resource.growth().reallocation_count, 0u);
+    EXPECT_GT(resource.growth().bytes_copied, 0u);
+
+    std::unordered_map<int, int, std::hash<int>, std::equal_to<int>, MicrobenchMemory::tracking_allocator<std::pair<const int, int>>> map{resource};
+    for (int i = 0; i < 100; ++i)
+      map.emplace(i, i);
+  }
+  auto infos = MicrobenchMemory::get_memory_information_snapshot("allocator_map");
+  EXPECT_GT(infos.allocation_count, 100u);
+  EXPECT_EQ(infos.allocation_count, infos.deallocation_count);
+  EXPECT_EQ(resource.growth().current_capacity, 0u);
+
+  // the default upstream allocates with the global operator new, the blocks are only counted in the scope
+  auto global = MicrobenchMemory::get_global_memory_information_snapshot() - global_before;
+  EXPECT_EQ(global.allocation_count, 0u);
+  EXPECT_EQ(global.deallocation_count, 0u);
+}
+
+struct counted
+{
+  char buff[48];
+  MICROBENCH_MEMORY_INSTRUMENT_CLASS_WITH_POLICY("counted", tracking_features::counts);
+};
+
+struct alignas(64) sized
+{
+  char buff[100];
+  MICROBENCH_MEMORY_INSTRUMENT_CLASS_WITH_POLICY("sized", tracking_features::bytes | tracking_features::live);
+};
+
+struct fully_tracked
+{
+  char buff[48];
+  MICROBENCH_MEMORY_INSTRUMENT_CLASS_WITH_POLICY("fully_tracked", tracking_features::all);
+};
+
+TEST(MicrobenchMemory, TrackingPolicies)
+{
+  using MicrobenchMemory::get_policy_snapshot;
+  using MicrobenchMemory::policy_tracker;
+
+  // the disabled features take no room, and the size header is only there when needed
+  static_assert(sizeof(policy_tracker<tracking_features::none>) == sizeof(std::string_view));
+  static_assert(!policy_tracker<tracking_features::counts>::size_header);
+  static_assert(policy_tracker<tracking_features::bytes>::size_header);
+  static_assert(!policy_tracker<tracking_features::bytes | tracking_features::pointers>::size_header);
+
+  delete new counted;
+  auto* kept  = new counted;
+  auto  count = get_policy_snapshot<counted>();
+  EXPECT_EQ(count.scope, "counted");
+  EXPECT_EQ(count.allocation_count, 2u);
+  EXPECT_EQ(count.deallocation_count, 1u);
+  EXPECT_EQ(count.total_memory_allocated, 0u);
+  delete kept;
+
+  auto* aligned = new sized;
+  EXPECT_EQ(reinterpret_cast<std::uintptr_t>(aligned) % alignof(sized), 0u);
+  EXPECT_EQ(get_policy_snapshot<sized>().current_memory_used, sizeof(sized));
+  delete aligned;
+  auto size = get_policy_snapshot<sized>();
+  EXPECT_EQ(size.allocation_count, 0u);
+  EXPECT_EQ(size.total_memory_deallocated, sizeof(sized));
+  EXPECT_EQ(size.current_memory_used, 0u);
+  EXPECT_EQ(size.peak_memory_used, sizeof(sized));
+
+  auto* objects = new fully_tracked[3];
+  auto  full    = get_policy_snapshot<fully_tracked>();
+  EXPECT_EQ(full.allocation_count, 1u);
+  EXPECT_EQ(full.live_pointer_count, 1u);
+  EXPECT_EQ(full.size_histogram.total_count(), 1u);
+  EXPECT_EQ(full.allocation_latency.total_count(), 1u);
+  EXPECT_GT(full.allocation_latency.nanoseconds_per_tick, 0.);
+  delete[] objects;
+
+  full = get_policy_snapshot<fully_tracked>();
+  EXPECT_EQ(full.live_pointer_count, 0u);
+  EXPECT_EQ(full.current_memory_used, 0u);
+  EXPECT_EQ(full.total_memory_deallocated, full.total_memory_allocated);
+  EXPECT_GE(full.total_memory_allocated, 3 * sizeof(fully_tracked));
+  EXPECT_EQ(full.deallocation_latency.total_count(), 1u);
+}
+
+TEST(MicrobenchMemory, MemoryRegions)
+{
+  auto request_before      = MicrobenchMemory::get_region_memory_information_snapshot("/request");
+  auto request_only_before = MicrobenchMemory::get_memory_information_snapshot("/request");
+  auto parse_before        = MicrobenchMemory::get_memory_information_snapshot("/request/parse");
+
+  char* outlived = nullptr;
+  {
+    MicrobenchMemory::memory_region request{"request"};
+    delete[] new char[100];
+    {
+      MicrobenchMemory::memory_region parse{"parse"};
+      delete[] new char[200];
+      outlived = new char[300];
+    }
+    delete[] new char[400];
+  }
+  // outside of any region: accounted in the global counters only
+  delete[] new char[500];
+
+  auto parse = MicrobenchMemory::get_memory_information_snapshot("/request/parse") - parse_before;
+  EXPECT_EQ(parse.allocation_count, 2u);
+  EXPECT_EQ(parse.current_memory_used(), 300u);
+
+  // freed out of the region, accounted in it anyway
+  delete[] outlived;
+  parse = MicrobenchMemory::get_memory_information_snapshot("/request/parse") - parse_before;
+  EXPECT_EQ(parse.total_memory_deallocated, 500u);
+  EXPECT_FALSE(parse.has_memory_leak());
+
+  auto request = MicrobenchMemory::get_region_memory_information_snapshot("/request") - request_before;
+  std::cout << request;
+  EXPECT_EQ(request.allocation_count, 4u);
+  EXPECT_EQ(request.total_memory_allocated, 1000u);
+  EXPECT_EQ(request.current_memory_used(), 0u);
+  EXPECT_EQ((MicrobenchMemory::get_memory_information_snapshot("/request") - request_only_before).allocation_count, 2u);
+}
+
+struct P
+{
+  char buff[48];
+  MICROBENCH_MEMORY_INSTRUMENT_POOLED_CLASS("P");
+};
+
+TEST(MicrobenchMemory, PooledClassAllocations)
+{
+  constexpr std::size_t nb_objects = 1000;
+
+  auto mem_infos_before = MicrobenchMemory::get_memory_information_snapshot("P");
+  auto stats_before     = MicrobenchMemory::get_object_pool_statistics("P");
+
+  std::vector<P*> ptrs;
+  for (std::size_t i = 0; i < nb_objects; ++i)
+    ptrs.push_back(new P{});
+  auto* array = new P[4];
+
+  auto stats = MicrobenchMemory::get_object_pool_statistics("P");
+  EXPECT_EQ(stats.block_size, 64u);
+  EXPECT_EQ(stats.live_blocks - stats_before.live_blocks, nb_objects);
+  EXPECT_GE(stats.capacity, stats.live_blocks);
+  EXPECT_GE(stats.slab_count, 1u);
+  EXPECT_EQ(stats.allocation_count - stats_before.allocation_count, nb_objects);
+  EXPECT_GT(stats.occupancy(), 0.);
+  EXPECT_LE(stats.occupancy(), 1.);
+
+  for (auto* ptr : ptrs)
+    delete ptr;
+  delete[] array;
+
+  // the freed blocks are recycled: no new slab
+  for (auto*& ptr : ptrs)
+    ptr = new P{};
+  auto stats_recycled = MicrobenchMemory::get_object_pool_statistics("P");
+  EXPECT_EQ(stats_recycled.slab_count, stats.slab_count);
+  EXPECT_GT(static_cast<double>(stats_recycled.free_list_hits - stats.free_list_hits), 0.9 * nb_objects);
+  for (auto* ptr : ptrs)
+    delete ptr;
+
+  stats = MicrobenchMemory::get_object_pool_statistics("P");
+  EXPECT_GT(stats.hit_rate(), 0.);
+  EXPECT_LE(stats.hit_rate(), 1.);
+  EXPECT_LE(stats.occupancy(), 1.);
+  EXPECT_EQ(stats.live_blocks, stats_before.live_blocks);
+  EXPECT_EQ(stats.allocation_count - stats_before.allocation_count, 2 * nb_objects);
+
+  // the scope keeps its full statistics, the array included
+  auto diff = MicrobenchMemory::get_memory_information_snapshot("P") - mem_infos_before;
+  EXPECT_EQ(diff.allocation_count, 2 * nb_objects + 1);
+  EXPECT_EQ(diff.total_memory_deallocated, (2 * nb_objects + 4) * sizeof(P));
+  EXPECT_FALSE(diff.has_memory_leak());
+}
+
+TEST(MicrobenchMemory, PooledClassConcurrentAllocations)
+{
+  constexpr std::size_t nb_threads = 8;
+  constexpr std::size_t nb_allocs  = 10000;
+
+  auto mem_infos_before = MicrobenchMemory::get_memory_information_snapshot("P");
+
+  std::vector<std::thread> threads;
+  for (std::size_t i = 0; i < nb_threads; ++i)
+    threads.emplace_back([] {
+      std::vector<P*> ptrs;
+      for (std::size_t j = 0; j < nb_allocs; ++j)
+        ptrs.push_back(new P{});
+      for (auto* ptr : ptrs)
+        delete ptr;
+    });
+  for (auto& thread : threads)
+    thread.join();
+
+  auto diff = MicrobenchMemory::get_memory_information_snapshot("P") - mem_infos_before;
+  EXPECT_EQ(diff.allocation_count, nb_threads * nb_allocs);
+  EXPECT_FALSE(diff.has_memory_leak());
+  EXPECT_EQ(MicrobenchMemory::get_object_pool_statistics("P").live_blocks, 0u);
+}
+
+[[gnu::noinline]] static void allocate_from_distinct_site(std::size_t nb_allocs)
+{
+  for (std::size_t i = 0; i < nb_allocs; ++i)
+  {
+    allocation_sink = new char[12345];
+    delete[] allocation_sink;
+  }
+}
+
+TEST(MicrobenchMemory, TopAllocationSites)
+{
+  constexpr std::size_t nb_allocs = 1000;
+
+  MicrobenchMemory::set_backtrace_mode(MicrobenchMemory::backtrace_mode::all);
+  allocate_from_distinct_site(nb_allocs);
+  MicrobenchMemory::set_backtrace_mode(MicrobenchMemory::backtrace_mode::disabled);
+
+  std::array<MicrobenchMemory::allocation_site, 4> sites;
+  auto nb_sites = MicrobenchMemory::get_top_allocation_sites(sites.data(), sites.size(), MicrobenchMemory::allocation_site_order::by_bytes);
+  ASSERT_GE(nb_sites, 1u);
+  for (std::size_t i = 1; i < nb_sites; ++i)
+    EXPECT_GE(sites[i - 1].total_memory_allocated, sites[i].total_memory_allocated);
+
+  // the loop is by far the largest site: all of its allocations share the same stack
+  EXPECT_EQ(sites[0].allocation_count, nb_allocs);
+  EXPECT_EQ(sites[0].total_memory_allocated, nb_allocs * 12345);
+#if defined(__linux__) && (defined(__x86_64__) || defined(__aarch64__))
+  EXPECT_GT(sites[0].depth, 2u);
+#endif
+}
+
+TEST(MicrobenchMemory, LatencySizeClasses)
+{
+  using MicrobenchMemory::latency_size_class;
+
+  EXPECT_EQ(latency_size_class(0), 0u);
+  EXPECT_EQ(latency_size_class(64), 0u);
+  EXPECT_EQ(latency_size_class(65), 1u);
+  EXPECT_EQ(latency_size_class(MicrobenchMemory::latency_size_class_upper_bound(3)), 3u);
+  EXPECT_EQ(latency_size_class(std::size_t{1} << 40), MicrobenchMemory::latency_size_class_count - 1);
+
+  using histogram = MicrobenchMemory::latency_histogram;
+  for (std::size_t bin = 0; bin + 1 < histogram::bin_count; ++bin)
+  {
+    EXPECT_EQ(histogram::bin_index(histogram::bin_lower_bound(bin)), bin);
+    EXPECT_EQ(histogram::bin_index(histogram::bin_lower_bound(bin + 1) - 1), bin);
+  }
+  EXPECT_EQ(histogram::bin_index(std::uint64_t{1} << 50), histogram::bin_count - 1);
+}
+
+TEST(MicrobenchMemory, AllocationLatencies)
+{
+  auto before = MicrobenchMemory::get_allocation_latencies();
+
+  MicrobenchMemory::enable_allocation_latency_timing(true);
+  for (int i = 0; i < 1000; ++i)
+    delete[] new char[32];
+  delete[] new char[100'000];
+  MicrobenchMemory::enable_allocation_latency_timing(false);
+  // not timed anymore
+  delete[] new char[32];
+
+  auto diff = MicrobenchMemory::get_allocation_latencies() - before;
+  EXPECT_EQ(diff.allocations[MicrobenchMemory::latency_size_class(32)].total_count(), 1000u);
+  EXPECT_EQ(diff.deallocations[MicrobenchMemory::latency_size_class(32)].total_count(), 1000u);
+  EXPECT_EQ(diff.allocations[MicrobenchMemory::latency_size_class(100'000)].total_count(), 1u);
+
+  auto all = diff.all_allocations();
+  EXPECT_EQ(all.total_count(), 1001u);
+  EXPECT_GT(all.nanoseconds_per_tick, 0.);
+  EXPECT_GT(all.percentile(0.5), 0.);
+  EXPECT_LE(all.percentile(0.5), all.percentile(0.99));
+  EXPECT_LE(all.percentile(0.99), all.percentile(0.999));
+}
+
+TEST(MicrobenchMemory, AllocationSlack)
+{
+  auto size_class = MicrobenchMemory::latency_size_class(20);
+  auto before     = MicrobenchMemory::get_heap_overhead().size_classes[size_class];
+
+  MicrobenchMemory::set_allocator_backend(MicrobenchMemory::pool_allocator_backend);
+  MicrobenchMemory::enable_allocation_slack_tracking(true);
+  char* kept = nullptr;
+  {
+    MicrobenchMemory::memory_region region{"slack"};
+    // with its header, a block of 36 bytes goes to the class of 48
+    kept = new char[20];
+    delete[] new char[20];
+  }
+  MicrobenchMemory::set_allocator_backend(MicrobenchMemory::malloc_allocator_backend);
+  {
+    MicrobenchMemory::memory_region region{"slack_aligned"};
+    // 64 bytes in front of the pointer, header included, and 28 at the end of the block of 192
+    ::operator delete(::operator new(100, std::align_val_t{64}), std::align_val_t{64});
+  }
+  MicrobenchMemory::enable_allocation_slack_tracking(false);
+  // not measured anymore
+  delete[] new char[20];
+
+  auto slack = MicrobenchMemory::get_allocation_slack("/slack");
+  EXPECT_EQ(slack.allocation_count, 2u);
+  EXPECT_EQ(slack.requested_bytes, 40u);
+  EXPECT_EQ(slack.usable_bytes, 64u);
+  EXPECT_EQ(slack.padding_bytes, 0u);
+  EXPECT_EQ(slack.live_slack_bytes(), 12u);
+  EXPECT_DOUBLE_EQ(slack.internal_fragmentation(), 12. / 32.);
+
+  // measured when allocated, the block is taken out of the live slack even though the tracking is disabled
+  delete[] kept;
+  EXPECT_EQ(MicrobenchMemory::get_allocation_slack("/slack").live_usable_bytes, 0u);
+
+  auto aligned = MicrobenchMemory::get_allocation_slack("/slack_aligned");
+  EXPECT_EQ(aligned.padding_bytes, 48u + 28u);
+  EXPECT_GE(aligned.usable_bytes, 176u);
+  EXPECT_EQ(aligned.live_usable_bytes, 0u);
+
+  auto overhead = MicrobenchMemory::get_heap_overhead();
+  EXPECT_EQ(overhead.size_classes[size_class].allocation_count - before.allocation_count, 2u);
+  EXPECT_EQ(overhead.size_classes[size_class].live_usable_bytes, before.live_usable_bytes);
+#if defined(__linux__)
+  EXPECT_GT(overhead.resident_memory, 0u);
+  EXPECT_GT(overhead.overhead_ratio(), 0.);
+#endif
+  EXPECT_GE(overhead.external_fragmentation(), 0.);
+  EXPECT_LE(overhead.external_fragmentation(), 1.);
+}
+
+TEST(MicrobenchMemory, AllocationLifetimes)
+{
+  char* escaping = nullptr;
+  MicrobenchMemory::enable_allocation_lifetime_profiling(true);
+  {
+    MicrobenchMemory::memory_region region{"lifetimes"};
+    // nested: stack buffer candidates
+    auto* outer = new char[8];
+    delete[] new char[8];
+    delete[] outer;
+    // interleaved: arena candidates
+    auto* first  = new char[8];
+    auto* second = new char[8];
+    delete[] first;
+    delete[] second;
+    escaping = new char[8];
+  }
+  MicrobenchMemory::enable_allocation_lifetime_profiling(false);
+  // profiled when allocated, the pointer is classified even though the profiling is disabled
+  std::thread{[escaping] { delete[] escaping; }}.join();
+
+  auto lifetimes = MicrobenchMemory::get_allocation_lifetimes("/lifetimes");
+  EXPECT_EQ(lifetimes.lifo_count, 2u);
+  EXPECT_EQ(lifetimes.same_thread_count, 2u);
+  EXPECT_EQ(lifetimes.cross_thread_count, 1u);
+  EXPECT_DOUBLE_EQ(lifetimes.lifo_share(), 2. / 5.);
+  EXPECT_EQ(lifetimes.durations.total_count(), 5u);
+  EXPECT_GT(lifetimes.durations.percentile(0.5), 0.);
+  // 0 allocation in between for the inner pointer and the first one, 1 for the outer and the second ones
+  EXPECT_EQ(lifetimes.allocations.total_count(), 4u);
+  EXPECT_EQ(lifetimes.allocations.bins[0], 2u);
+  EXPECT_EQ(lifetimes.allocations.bins[1], 2u);
+  EXPECT_DOUBLE_EQ(lifetimes.allocations.percentile(0.9), 1.5);
+}
+
+TEST(MicrobenchMemory, InstrumentationOverhead)
+{
+  MicrobenchMemory::allocation_budget budget{0};
+  auto                                before   = MicrobenchMemory::get_global_memory_information_snapshot();
+  auto                                overhead = MicrobenchMemory::calibrate_instrumentation_overhead();
+  EXPECT_EQ(budget.allocation_count(), 0u);
+  EXPECT_GE(overhead.global_nanoseconds, 0.);
+  EXPECT_GE(overhead.scoped_nanoseconds, 0.);
+  // the calibration pairs are not counted
+  auto diff = MicrobenchMemory::get_global_memory_information_snapshot() - before;
+  EXPECT_EQ(diff.allocation_count, 0u);
+  EXPECT_EQ(diff.deallocation_count, 0u);
+  EXPECT_EQ(diff.total_memory_allocated, 0u);
+
+  // kept until the next calibration
+  auto kept = MicrobenchMemory::get_instrumentation_overhead();
+  EXPECT_EQ(kept.global_nanoseconds, overhead.global_nanoseconds);
+  EXPECT_EQ(kept.scoped_nanoseconds, overhead.scoped_nanoseconds);
+  auto calibration = MicrobenchMemory::get_memory_information_snapshot("microbench_memory_calibration");
+  EXPECT_FALSE(calibration.has_memory_leak());
+}
+
 int main(int argc, char** argv)
 {
   ::testing::InitGoogleTest(&argc, argv);
@@ -4,7 +4,22 @@
 
 #include <benchmark/benchmark.h>
 
+#include <cmath>
+#include <cstdint>
+#include <cstdio>
 #include <memory>
+#include <thread>
+#include <vector>
+
+MICROBENCH_MEMORY_OVERLOAD_GLOBAL()
+
+
+struct B
+{
+  char buff[128];
+  MICROBENCH_MEMORY_INSTRUMENT_CLASS("B");
+};
+
 
 void BM_empty(benchmark::State& state)
 {
@@ -16,12 +31,196 @@ void BM_empty(benchmark::State& state)
 BENCHMARK(BM_empty);
 
 
+void BM_allocate_free(benchmark::State& state)
+{
+  for (auto _ : state)
+  {
+    auto buff = std::make_unique<char[]>(1024);
+    benchmark::DoNotOptimize(buff.get());
+  }
+}
+BENCHMARK(BM_allocate_free);
+
+
+void BM_scoped_allocate_free(benchmark::State& state)
+{
+  MicrobenchMemory::fixtures::GoogleBenchmarkBridge::MemoryManager::filter_scope("B");
+  for (auto _ : state)
+  {
+    auto b = std::make_unique<B>();
+    auto c = std::make_unique<char[]>(1024);
+    benchmark::DoNotOptimize(b.get());
+    benchmark::DoNotOptimize(c.get());
+  }
+}
+BENCHMARK(BM_scoped_allocate_free)->ThreadRange(1, 2);
+
+
+void BM_allocate_free_latencies(benchmark::State& state)
+{
+  MicrobenchMemory::fixtures::GoogleBenchmarkBridge::AllocationLatencyCounters latencies{state};
+  for (auto _ : state)
+  {
+    auto buff = std::make_unique<char[]>(1024);
+    benchmark::DoNotOptimize(buff.get());
+  }
+}
+BENCHMARK(BM_allocate_free_latencies);
+
+
+void BM_allocate_free_per_iteration(benchmark::State& state)
+{
+  MicrobenchMemory::fixtures::GoogleBenchmarkBridge::AllocationsPerIteration allocations{state, 1};
+  for (auto _ : state)
+  {
+    auto buff = std::make_unique<char[]>(1024);
+    benchmark::DoNotOptimize(buff.get());
+  }
+}
+BENCHMARK(BM_allocate_free_per_iteration)->ThreadRange(1, 2);
+
+
+void BM_allocate_free_compensated(benchmark::State& state)
+{
+  MicrobenchMemory::fixtures::GoogleBenchmarkBridge::InstrumentationOverheadCounters overhead{state, "B"};
+  for (auto _ : state)
+  {
+    auto b = std::make_unique<B>();
+    benchmark::DoNotOptimize(b.get());
+  }
+}
+BENCHMARK(BM_allocate_free_compensated);
+
+
+#define CHECK_EQ(lhs, rhs)                                                                                                                                                         \
+  if ((lhs) != (rhs))                                                                                                                                                              \
+  {                                                                                                                                                                                \
+    std::fprintf(stderr, "%s:%d: %s (%lld) != %s (%lld)\n", __FILE__, __LINE__, #lhs, static_cast<long long>(lhs), #rhs, static_cast<long long>(rhs));                        \
+    ok = false;                                                                                                                                                                    \
+  }
+
+// Result's constructor refers to MemoryManager::TombstoneValue, which some packaged builds of Google Benchmark don't export
+struct result_storage
+{
+  alignas(::benchmark::MemoryManager::Result) unsigned char bytes[sizeof(::benchmark::MemoryManager::Result)] = {};
+
+  ::benchmark::MemoryManager::Result* get() { return reinterpret_cast<::benchmark::MemoryManager::Result*>(bytes); }
+};
+
+bool check_global_report()
+{
+  bool                                                             ok = true;
+  MicrobenchMemory::fixtures::GoogleBenchmarkBridge::MemoryManager mm;
+  result_storage                                                   storage;
+  auto&                                                            result = *storage.get();
+
+  mm.Start();
+  {
+    auto a = std::make_unique<char[]>(1000);
+    auto b = std::make_unique<char[]>(2000);
+  }
+  auto c = std::make_unique<char[]>(500);
+  mm.Stop(&result);
+
+  CHECK_EQ(result.num_allocs, 3);
+  CHECK_EQ(result.max_bytes_used, 3000);
+  CHECK_EQ(result.total_allocated_bytes, 3500);
+  CHECK_EQ(result.net_heap_growth, 500);
+  return ok;
+}
+
+bool check_scoped_report()
+{
+  bool                                                             ok = true;
+  MicrobenchMemory::fixtures::GoogleBenchmarkBridge::MemoryManager mm{"B"};
+  result_storage                                                   storage;
+  auto&                                                            result = *storage.get();
+
+  mm.Start();
+  {
+    auto a = std::make_unique<B>();
+    auto b = std::make_unique<char[]>(2000);
+  }
+  auto c = std::make_unique<B>();
+  mm.Stop(&result);
+
+  CHECK_EQ(result.num_allocs, 2);
+  CHECK_EQ(result.max_bytes_used, static_cast<std::int64_t>(sizeof(B)));
+  CHECK_EQ(result.total_allocated_bytes, 2 * static_cast<std::int64_t>(sizeof(B)));
+  CHECK_EQ(result.net_heap_growth, static_cast<std::int64_t>(sizeof(B)));
+  return ok;
+}
+
+bool check_concurrent_scope_filters()
+{
+  constexpr std::size_t nb_threads = 4;
+
+  bool                                                             ok = true;
+  MicrobenchMemory::fixtures::GoogleBenchmarkBridge::MemoryManager mm;
+  result_storage                                                   storage;
+  auto&                                                            result = *storage.get();
+
+  // each thread requests the filter before allocating, the first request of the run is taken before any allocation
+  mm.Start();
+  std::vector<std::thread> threads;
+  for (std::size_t i = 0; i < nb_threads; ++i)
+    threads.emplace_back([] {
+      MicrobenchMemory::fixtures::GoogleBenchmarkBridge::MemoryManager::filter_scope("B");
+      auto b = std::make_unique<B>();
+    });
+  for (auto& thread : threads)
+    thread.join();
+  mm.Stop(&result);
+
+  CHECK_EQ(result.num_allocs, static_cast<std::int64_t>(nb_threads));
+  CHECK_EQ(result.total_allocated_bytes, static_cast<std::int64_t>(nb_threads * sizeof(B)));
+  CHECK_EQ(result.net_heap_growth, 0);
+  return ok;
+}
+
+// Keeps the runs it is given
+struct recording_reporter : ::benchmark::BenchmarkReporter
+{
+  bool ReportContext(const Context&) override { return true; }
+  void ReportRuns(const std::vector<Run>& reported) override { runs = reported; }
+
+  std::vector<Run> runs;
+};
+
+bool check_overhead_compensation()
+{
+  bool                                                                            ok = true;
+  recording_reporter                                                              recorder;
+  MicrobenchMemory::fixtures::GoogleBenchmarkBridge::OverheadCompensatingReporter reporter{recorder, {10., 100.}};
+
+  // 1000 iterations over 2 threads, 2 global and 1 scoped allocations per iteration: 120 us of overhead
+  ::benchmark::BenchmarkReporter::Run run;
+  run.iterations                                   = 1000;
+  run.threads                                      = 2;
+  run.real_accumulated_time                        = 1e-3;
+  run.cpu_accumulated_time                         = 2e-3;
+  run.counters["instrumented_allocations"]        = ::benchmark::Counter(2.);
+  run.counters["instrumented_scoped_allocations"] = ::benchmark::Counter(1.);
+  reporter.ReportRuns({run});
+
+  CHECK_EQ(recorder.runs.size(), 1u);
+  CHECK_EQ(std::lround(recorder.runs[0].real_accumulated_time * 1e9), 1'000'000 - 60'000);
+  CHECK_EQ(std::lround(recorder.runs[0].cpu_accumulated_time * 1e9), 2'000'000 - 120'000);
+  return ok;
+}
+
+
 int main(int argc, char* argv[])
 {
+  if (!check_global_report() || !check_scoped_report() || !check_concurrent_scope_filters() || !check_overhead_compensation())
+    return 1;
+
   std::unique_ptr<::benchmark::MemoryManager> mm(new MicrobenchMemory::fixtures::GoogleBenchmarkBridge::MemoryManager());
 
   ::benchmark::RegisterMemoryManager(mm.get());
   ::benchmark::Initialize(&argc, argv);
-  ::benchmark::RunSpecifiedBenchmarks();
+  ::benchmark::ConsoleReporter                                                    console;
+  MicrobenchMemory::fixtures::GoogleBenchmarkBridge::OverheadCompensatingReporter reporter{console};
+  ::benchmark::RunSpecifiedBenchmarks(&reporter);
   ::benchmark::RegisterMemoryManager(nullptr);
 }
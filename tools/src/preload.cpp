@@ -0,0 +1,317 @@
+#include "MicrobenchMemory/MicrobenchMemory.hpp"
+#include "MicrobenchMemory/ext/exporters.hpp"
+
+#include "detail/page_allocator.hpp"
+
+#include <algorithm>
+#include <cerrno>
+#include <cstddef>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <mutex>
+
+#include <fcntl.h>
+#include <malloc.h>
+#include <pthread.h>
+#include <signal.h>
+#include <unistd.h>
+
+/*
+LD_PRELOAD shim: profiles unmodified binaries (linux only)
+
+usage: LD_PRELOAD=libMicrobenchMemory_preload.so <program>
+
+the malloc family and the global C++ operators of the whole process are served by the instrumentation, on top of the
+C library allocator; a report of the global counters and of the memory regions is written when the process exits, and
+every time it receives the report signal
+
+environment:
+  MICROBENCH_MEMORY_REPORT          file the reports are appended to, the standard error by default
+  MICROBENCH_MEMORY_REPORT_FORMAT   json (default, one object per line), csv or prometheus
+  MICROBENCH_MEMORY_REPORT_SIGNAL   number of the signal requesting a report, e.g. 10 for SIGUSR1 on x86, none by default
+*/
+
+MICROBENCH_MEMORY_OVERLOAD_GLOBAL()
+
+using MicrobenchMemory::detail::managed_free;
+using MicrobenchMemory::detail::managed_malloc;
+using MicrobenchMemory::detail::managed_usable_size;
+
+static void* managed_malloc_or_enomem(std::size_t size, std::size_t alignment) noexcept
+{
+  auto* ptr = managed_malloc(size, alignment);
+  if (!ptr)
+    errno = ENOMEM;
+  return ptr;
+}
+
+static bool is_valid_alignment(std::size_t alignment) noexcept { return alignment != 0 && (alignment & (alignment - 1)) == 0; }
+
+static std::size_t page_size() noexcept { return static_cast<std::size_t>(::sysconf(_SC_PAGESIZE)); }
+
+extern "C"
+{
+  void* malloc(std::size_t size) noexcept { return managed_malloc_or_enomem(size, 0); }
+
+  void free(void* ptr) noexcept { managed_free(ptr); }
+
+  void* calloc(std::size_t count, std::size_t size) noexcept
+  {
+    std::size_t bytes = 0;
+    if (__builtin_mul_overflow(count, size, &bytes))
+    {
+      errno = ENOMEM;
+      return nullptr;
+    }
+
+    auto* ptr = managed_malloc_or_enomem(bytes, 0);
+    if (ptr)
+      std::memset(ptr, 0, bytes);
+    return ptr;
+  }
+
+  // the blocks are never grown in place: a realloc is accounted as an allocation followed by a deallocation
+  void* realloc(void* ptr, std::size_t size) noexcept
+  {
+    if (!ptr)
+      return managed_malloc_or_enomem(size, 0);
+    if (size == 0)
+    {
+      managed_free(ptr);
+      return nullptr;
+    }
+
+    auto* resized = managed_malloc_or_enomem(size, 0);
+    if (!resized)
+      return nullptr;
+    std::memcpy(resized, ptr, std::min(size, managed_usable_size(ptr)));
+    managed_free(ptr);
+    return resized;
+  }
+
+  void* reallocarray(void* ptr, std::size_t count, std::size_t size) noexcept
+  {
+    std::size_t bytes = 0;
+    if (__builtin_mul_overflow(count, size, &bytes))
+    {
+      errno = ENOMEM;
+      return nullptr;
+    }
+    return realloc(ptr, bytes);
+  }
+
+  int posix_memalign(void** ptr, std::size_t alignment, std::size_t size) noexcept
+  {
+    if (!is_valid_alignment(alignment) || alignment % sizeof(void*) != 0)
+      return EINVAL;
+
+    auto* block = managed_malloc(size, alignment);
+    if (!block)
+      return ENOMEM;
+    *ptr = block;
+    return 0;
+  }
+
+  void* aligned_alloc(std::size_t alignment, std::size_t size) noexcept
+  {
+    if (!is_valid_alignment(alignment))
+    {
+      errno = EINVAL;
+      return nullptr;
+    }
+    return managed_malloc_or_enomem(size, alignment);
+  }
+
+  void* memalign(std::size_t alignment, std::size_t size) noexcept { return aligned_alloc(alignment, size); }
+
+  void* valloc(std::size_t size) noexcept { return managed_malloc_or_enomem(size, page_size()); }
+
+  void* pvalloc(std::size_t size) noexcept
+  {
+    auto page = page_size();
+    if (size > static_cast<std::size_t>(-1) - page)
+    {
+      errno = ENOMEM;
+      return nullptr;
+    }
+    return managed_malloc_or_enomem((size + page - 1) / page * page, page);
+  }
+
+  std::size_t malloc_usable_size(void* ptr) noexcept { return managed_usable_size(ptr); }
+}
+
+
+namespace
+{
+  enum class report_format
+  {
+    json,
+    csv,
+    prometheus
+  };
+
+  struct report_settings
+  {
+    int           fd             = STDERR_FILENO;
+    report_format format         = report_format::json;
+    int           signal_pipe[2] = {-1, -1};
+    std::mutex    mutex;
+  };
+
+  constinit report_settings settings;
+
+  void write_fully(int fd, const char* data, std::size_t size)
+  {
+    while (size > 0)
+    {
+      auto written = ::write(fd, data, size);
+      if (written < 0 && errno == EINTR)
+        continue;
+      if (written <= 0)
+        return;
+      data += written;
+      size -= static_cast<std::size_t>(written);
+    }
+  }
+
+  void format_report(MicrobenchMemory::buffer_writer& writer, const MicrobenchMemory::global_memory_informations& global,
+                     const MicrobenchMemory::scoped_memory_informations* scopes, std::size_t scope_count)
+  {
+    switch (settings.format)
+    {
+    case report_format::json:
+      writer.write("{\"pid\":");
+      writer.write_number(static_cast<std::uint64_t>(::getpid()));
+      writer.write(",\"global\":");
+      MicrobenchMemory::write_json(writer, global);
+      writer.write(",\"scopes\":");
+      MicrobenchMemory::write_json(writer, scopes, scope_count);
+      writer.write("}\n");
+      break;
+    case report_format::csv:
+      // two tables, separated by an empty line
+      MicrobenchMemory::write_csv(writer, global);
+      writer.put('\n');
+      MicrobenchMemory::write_csv(writer, scopes, scope_count);
+      writer.put('\n');
+      break;
+    case report_format::prometheus:
+      MicrobenchMemory::write_prometheus(writer, global);
+      MicrobenchMemory::write_prometheus(writer, scopes, scope_count);
+      break;
+    }
+  }
+
+  /*
+  the snapshots and the report are kept in private pages, not to show up in the counters they report; the report buffer
+  starts at a page and is formatted again once grown to the size the truncated attempt asked for
+  */
+  void write_report()
+  {
+    std::lock_guard lock{settings.mutex};
+
+    using MicrobenchMemory::detail::allocate_pages;
+    using MicrobenchMemory::detail::deallocate_pages;
+
+    auto global      = MicrobenchMemory::get_global_memory_information_snapshot();
+    auto scope_count = MicrobenchMemory::snapshot_all_scopes(nullptr, 0);
+
+    auto  scopes_bytes = std::max<std::size_t>(scope_count * sizeof(MicrobenchMemory::scoped_memory_informations), 1);
+    auto* scopes       = static_cast<MicrobenchMemory::scoped_memory_informations*>(allocate_pages(scopes_bytes));
+    if (!scopes)
+      return;
+    std::uninitialized_default_construct_n(scopes, scope_count);
+    scope_count = std::min(scope_count, MicrobenchMemory::snapshot_all_scopes(scopes, scope_count));
+
+    auto capacity = page_size();
+    for (;;)
+    {
+      auto* buffer = static_cast<char*>(allocate_pages(capacity));
+      if (!buffer)
+        break;
+
+      MicrobenchMemory::buffer_writer writer{buffer, capacity};
+      format_report(writer, global, scopes, scope_count);
+      if (!writer.truncated())
+        write_fully(settings.fd, buffer, writer.size());
+      deallocate_pages(buffer, capacity);
+
+      if (!writer.truncated())
+        break;
+      capacity = writer.size();
+    }
+
+    std::destroy_n(scopes, scope_count);
+    deallocate_pages(scopes, scopes_bytes);
+  }
+
+  // the handler only wakes the reporter thread up: formatting the report is not async-signal-safe
+  void request_report(int)
+  {
+    auto saved_errno = errno;
+    char byte        = 0;
+    [[maybe_unused]] auto written = ::write(settings.signal_pipe[1], &byte, 1);
+    errno = saved_errno;
+  }
+
+  void* run_reporter(void*)
+  {
+    for (;;)
+    {
+      char byte = 0;
+      auto read = ::read(settings.signal_pipe[0], &byte, 1);
+      if (read == 1)
+        write_report();
+      else if (read == 0 || errno != EINTR)
+        return nullptr;
+    }
+  }
+
+  void start_signal_reporter(int signal)
+  {
+    if (::pipe2(settings.signal_pipe, O_CLOEXEC) != 0)
+      return;
+
+    pthread_t      thread;
+    pthread_attr_t attributes;
+    ::pthread_attr_init(&attributes);
+    ::pthread_attr_setdetachstate(&attributes, PTHREAD_CREATE_DETACHED);
+    bool started = ::pthread_create(&thread, &attributes, run_reporter, nullptr) == 0;
+    ::pthread_attr_destroy(&attributes);
+    if (!started)
+      return;
+
+    struct sigaction action = {};
+    action.sa_handler       = request_report;
+    action.sa_flags         = SA_RESTART;
+    ::sigemptyset(&action.sa_mask);
+    ::sigaction(signal, &action, nullptr);
+  }
+
+  __attribute__((constructor)) void start_preload()
+  {
+    // the standard error is duplicated, programs may close it before the report at exit
+    auto fd = -1;
+    if (const char* path = std::getenv("MICROBENCH_MEMORY_REPORT"); path && *path)
+      fd = ::open(path, O_WRONLY | O_CREAT | O_APPEND | O_CLOEXEC, 0644);
+    else
+      fd = ::fcntl(STDERR_FILENO, F_DUPFD_CLOEXEC, 0);
+    if (fd >= 0)
+      settings.fd = fd;
+
+    if (const char* format = std::getenv("MICROBENCH_MEMORY_REPORT_FORMAT"))
+    {
+      if (std::strcmp(format, "csv") == 0)
+        settings.format = report_format::csv;
+      else if (std::strcmp(format, "prometheus") == 0)
+        settings.format = report_format::prometheus;
+    }
+
+    if (const char* signal = std::getenv("MICROBENCH_MEMORY_REPORT_SIGNAL"))
+      if (auto number = std::atoi(signal); number > 0 && number < NSIG)
+        start_signal_reporter(number);
+  }
+
+  __attribute__((destructor)) void stop_preload() { write_report(); }
+} // namespace
@@ -0,0 +1,100 @@
+#include "MicrobenchMemory/ext/trace_reader.hpp"
+
+#include <algorithm>
+#include <cstdint>
+#include <cstdlib>
+#include <exception>
+#include <filesystem>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/*
+rebuilds the live heap over time from allocation traces
+
+usage: MicrobenchMemory_trace_replay [--points N] <trace file or directory>...
+
+writes the curve as CSV on the standard output (time since the first event, live bytes and live allocations), keeping at
+most N points (1000 by default): each point is the highest live heap of its time slice, so that the peaks are never
+smoothed out
+*/
+
+static int usage()
+{
+  std::cerr << "usage: MicrobenchMemory_trace_replay [--points N] <trace file or directory>...\n";
+  return EXIT_FAILURE;
+}
+
+int main(int argc, char** argv)
+{
+  std::size_t                                 max_points = 1000;
+  std::vector<MicrobenchMemory::trace_thread> threads;
+
+  try
+  {
+    for (int i = 1; i < argc; ++i)
+    {
+      std::string_view arg = argv[i];
+      if (arg == "--points")
+      {
+        if (++i == argc)
+          return usage();
+        max_points = std::max<std::size_t>(std::stoull(argv[i]), 1);
+      }
+      else if (std::filesystem::is_directory(arg))
+      {
+        auto directory_threads = MicrobenchMemory::read_trace_directory(arg);
+        threads.insert(threads.end(), directory_threads.begin(), directory_threads.end());
+      }
+      else
+        threads.push_back(MicrobenchMemory::read_trace_file(arg));
+    }
+  }
+  catch (const std::exception& e)
+  {
+    std::cerr << e.what() << '\n';
+    return EXIT_FAILURE;
+  }
+
+  if (threads.empty())
+    return usage();
+
+  for (const auto& thread : threads)
+    if (thread.wrapped())
+      std::cerr << "warning: the ring of thread " << thread.header.thread_index << " wrapped, its " << thread.header.record_count - thread.header.capacity
+                << " oldest events are lost\n";
+
+  auto records = MicrobenchMemory::merge_trace_records(threads);
+  auto curve   = MicrobenchMemory::live_heap_curve(records);
+  if (curve.empty())
+  {
+    std::cerr << "no event in the traces\n";
+    return EXIT_SUCCESS;
+  }
+
+  const auto start    = curve.front().timestamp;
+  const auto duration = curve.back().timestamp - start;
+
+  std::cout << "time_ns,live_bytes,live_allocations\n";
+  auto slice_peak = curve.front();
+  auto slice      = std::uint64_t{0};
+  for (const auto& sample : curve)
+  {
+    auto sample_slice = duration == 0 ? 0 : static_cast<std::uint64_t>(static_cast<double>(sample.timestamp - start) / static_cast<double>(duration) * static_cast<double>(max_points - 1));
+    if (sample_slice != slice)
+    {
+      std::cout << slice_peak.timestamp - start << ',' << slice_peak.live_bytes << ',' << slice_peak.live_allocations << '\n';
+      slice      = sample_slice;
+      slice_peak = sample;
+    }
+    else if (sample.live_bytes > slice_peak.live_bytes)
+      slice_peak = sample;
+  }
+  std::cout << slice_peak.timestamp - start << ',' << slice_peak.live_bytes << ',' << slice_peak.live_allocations << '\n';
+
+  auto peak = std::max_element(curve.begin(), curve.end(), [](const auto& lhs, const auto& rhs) { return lhs.live_bytes < rhs.live_bytes; });
+  std::cerr << records.size() << " events from " << threads.size() << " threads over " << duration << " ns, peak live heap: " << peak->live_bytes << " bytes at "
+            << peak->timestamp - start << " ns, final live heap: " << curve.back().live_bytes << " bytes\n";
+  return EXIT_SUCCESS;
+}